@@ -1,7 +1,7 @@
 Summary:	fastcgi-daemon2 is an application server for FastCGI
 Name:		fastcgi-daemon2
-Version:	2.10
-Release:	5%{?dist}
+Version:	2.11
+Release:	1%{?dist}
 
 License:	Yandex License
 Group:		System Environment/Libraries
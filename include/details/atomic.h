@@ -0,0 +1,122 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_ATOMIC_H_
+#define _FASTCGI_DETAILS_ATOMIC_H_
+
+namespace fastcgi
+{
+
+/**
+ * Thin wrappers over gcc atomic builtins. Old compilers have only
+ * full-barrier __sync builtins, newer ones get relaxed/acquire/release
+ * memory orders via __atomic builtins.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+
+template<typename T> inline T
+atomicLoad(const volatile T *ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+template<typename T> inline T
+atomicLoadRelaxed(const volatile T *ptr) {
+	return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+template<typename T> inline void
+atomicStore(volatile T *ptr, T value) {
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+template<typename T> inline T
+atomicIncrement(volatile T *ptr) {
+	return __atomic_add_fetch(ptr, 1, __ATOMIC_RELAXED);
+}
+
+template<typename T> inline T
+atomicDecrement(volatile T *ptr) {
+	return __atomic_sub_fetch(ptr, 1, __ATOMIC_RELAXED);
+}
+
+template<typename T> inline T
+atomicAdd(volatile T *ptr, T value) {
+	return __atomic_add_fetch(ptr, value, __ATOMIC_RELAXED);
+}
+
+template<typename T> inline bool
+atomicCompareAndSwap(volatile T *ptr, T expected, T desired) {
+	return __atomic_compare_exchange_n(ptr, &expected, desired, false,
+		__ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+inline void
+atomicFence() {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#else
+
+template<typename T> inline T
+atomicLoad(const volatile T *ptr) {
+	T value = *ptr;
+	__sync_synchronize();
+	return value;
+}
+
+template<typename T> inline T
+atomicLoadRelaxed(const volatile T *ptr) {
+	return *ptr;
+}
+
+template<typename T> inline void
+atomicStore(volatile T *ptr, T value) {
+	__sync_synchronize();
+	*ptr = value;
+}
+
+template<typename T> inline T
+atomicIncrement(volatile T *ptr) {
+	return __sync_add_and_fetch(ptr, 1);
+}
+
+template<typename T> inline T
+atomicDecrement(volatile T *ptr) {
+	return __sync_sub_and_fetch(ptr, 1);
+}
+
+template<typename T> inline T
+atomicAdd(volatile T *ptr, T value) {
+	return __sync_add_and_fetch(ptr, value);
+}
+
+template<typename T> inline bool
+atomicCompareAndSwap(volatile T *ptr, T expected, T desired) {
+	return __sync_bool_compare_and_swap(ptr, expected, desired);
+}
+
+inline void
+atomicFence() {
+	__sync_synchronize();
+}
+
+#endif
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_ATOMIC_H_
@@ -0,0 +1,47 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_CHAR_SEARCH_H_
+#define _FASTCGI_DETAILS_CHAR_SEARCH_H_
+
+#include <cstddef>
+
+#include <boost/utility.hpp>
+
+namespace fastcgi
+{
+
+/**
+ * Byte search kernels used by parsers. SSE2/AVX2 versions are selected at
+ * runtime on x86, other platforms use scalar loops.
+ */
+
+class CharSearch : private boost::noncopyable {
+public:
+	static const char* find(const char *begin, const char *end, char c);
+	static const char* findFirstOf(const char *begin, const char *end, char c1, char c2);
+	static const char* findString(const char *begin, const char *end, const char *str, std::size_t len);
+
+	static const char* implementation();
+
+private:
+	CharSearch();
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_CHAR_SEARCH_H_
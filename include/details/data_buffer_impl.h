@@ -18,6 +18,8 @@
 #ifndef _FASTCGI_DETAILS_DATA_BUFFER_IMPL_H_
 #define _FASTCGI_DETAILS_DATA_BUFFER_IMPL_H_
 
+#include <sys/uio.h>
+
 #include <string>
 #include <boost/cstdint.hpp>
 
@@ -29,8 +31,16 @@ public:
 	virtual ~DataBufferImpl() {};
 	virtual boost::uint64_t read(boost::uint64_t pos, char *data, boost::uint64_t len) = 0;
 	virtual boost::uint64_t write(boost::uint64_t pos, const char *data, boost::uint64_t len) = 0;
+	virtual boost::uint64_t writev(boost::uint64_t pos, const struct iovec *iov, int count) {
+		boost::uint64_t size = 0;
+		for (int i = 0; i < count; ++i) {
+			size += write(pos + size, static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+		}
+		return size;
+	}
 	virtual char at(boost::uint64_t pos) = 0;
 	virtual boost::uint64_t find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len) = 0;
+	virtual int memcmpAt(boost::uint64_t pos, const char *data, boost::uint64_t len) = 0;
 	virtual std::pair<boost::uint64_t, boost::uint64_t> trim(boost::uint64_t begin, boost::uint64_t end) const = 0;
 	virtual std::pair<char*, boost::uint64_t> chunk(boost::uint64_t pos) const = 0;
 	virtual std::pair<boost::uint64_t, boost::uint64_t> segment(boost::uint64_t pos) const = 0;
@@ -38,6 +48,13 @@ public:
 	virtual void resize(boost::uint64_t size) = 0;
 	virtual const std::string& filename() const = 0;
 	virtual DataBufferImpl* getCopy() const = 0;
+	virtual int fileDescriptor() const {
+		return -1;
+	}
+	/* chunks stay valid while buffer is not resized, iterators may use buffer without copying it */
+	virtual bool stableChunks() const {
+		return false;
+	}
 };
 
 } // namespace fastcgi
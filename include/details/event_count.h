@@ -0,0 +1,90 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_EVENT_COUNT_H_
+#define _FASTCGI_DETAILS_EVENT_COUNT_H_
+
+#include <climits>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <boost/noncopyable.hpp>
+
+#include "details/atomic.h"
+
+#ifndef FUTEX_WAIT_PRIVATE
+#define FUTEX_WAIT_PRIVATE FUTEX_WAIT
+#endif
+
+#ifndef FUTEX_WAKE_PRIVATE
+#define FUTEX_WAKE_PRIVATE FUTEX_WAKE
+#endif
+
+namespace fastcgi
+{
+
+/**
+ * Futex based event count used to park idle threads.
+ * Waiter takes a ticket, rechecks its condition and sleeps only
+ * if nobody has notified since the ticket was taken. Notifier enters
+ * the kernel only if there are parked threads.
+ */
+
+class EventCount : private boost::noncopyable {
+public:
+	EventCount() : value_(0), waiters_(0)
+	{}
+
+	int prepareWait() {
+		int ticket = atomicLoad(&value_);
+		atomicIncrement(&waiters_);
+		atomicFence();
+		return ticket;
+	}
+
+	void cancelWait() {
+		atomicDecrement(&waiters_);
+	}
+
+	void wait(int ticket) {
+		syscall(SYS_futex, &value_, FUTEX_WAIT_PRIVATE, ticket, NULL, NULL, 0);
+		atomicDecrement(&waiters_);
+	}
+
+	void notifyOne() {
+		atomicFence();
+		if (atomicLoad(&waiters_) > 0) {
+			atomicIncrement(&value_);
+			syscall(SYS_futex, &value_, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		}
+	}
+
+	void notifyAll() {
+		atomicIncrement(&value_);
+		syscall(SYS_futex, &value_, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+
+private:
+	volatile int value_;
+	volatile int waiters_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_EVENT_COUNT_H_
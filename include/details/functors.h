@@ -46,14 +46,23 @@ struct RangeCILess : public std::binary_function<const Range&, const Range&, boo
 	}
 };
 
-#if defined(HAVE_GNUCXX_HASHMAP) || defined(HAVE_EXT_HASH_MAP) || defined(HAVE_STLPORT_HASHMAP)
+struct StringHash : public std::unary_function<const std::string&, boost::uint32_t>
+{
+	boost::uint32_t operator () (const std::string &str) const {
+		boost::uint32_t value = 2166136261u;
+		for (std::string::const_iterator i = str.begin(), end = str.end(); i != end; ++i) {
+			value = (value ^ static_cast<unsigned char>(*i)) * 16777619u;
+		}
+		return value;
+	}
+};
 
 struct StringCIHash : public std::unary_function<const std::string&, boost::uint32_t>
 {
 	boost::uint32_t operator () (const std::string &str) const {
-		boost::uint32_t value = 0;
+		boost::uint32_t value = 2166136261u;
 		for (std::string::const_iterator i = str.begin(), end = str.end(); i != end; ++i) {
-			value += 5 * tolower(*i);
+			value = (value ^ static_cast<unsigned char>(tolower(*i))) * 16777619u;
 		}
 		return value;
 	}
@@ -69,17 +78,13 @@ struct StringCIEqual : public std::binary_function<const std::string&, const std
 	}
 };
 
-#else
-
 struct StringCILess : public std::binary_function<const std::string&, const std::string&, bool>
 {
 	bool operator () (const std::string& str, const std::string& target) const {
-		return std::lexicagraphical_compare(str.begin(), str.end(), target.begin(), target.end(), CharCILess());
+		return std::lexicographical_compare(str.begin(), str.end(), target.begin(), target.end(), CharCILess());
 	}
 };
 
-#endif
-
 } // namespace fastcgi
 
 #endif // _FASTCGI_DETAILS_FUNCTORS_H_
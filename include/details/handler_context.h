@@ -18,6 +18,7 @@
 #ifndef _FASTCGI_DETAILS_HANDLER_CONTEXT_H_
 #define _FASTCGI_DETAILS_HANDLER_CONTEXT_H_
 
+#include <fastcgi2/arena.h>
 #include <fastcgi2/handler.h>
 
 #include <map>
@@ -27,11 +28,17 @@ namespace fastcgi
 
 class HandlerContextImpl : public HandlerContext {
 public:
+	explicit HandlerContextImpl(Arena *arena);
+
 	virtual boost::any getParam(const std::string &name) const;
 	virtual void setParam(const std::string &name, const boost::any &value);
 
+	virtual Arena* arena() const;
+
 private:
-	typedef std::map<std::string, boost::any> ParamsMapType;
+	typedef std::map<std::string, boost::any, std::less<std::string>,
+		ArenaAllocator<std::pair<const std::string, boost::any> > > ParamsMapType;
+	Arena *arena_;
 	ParamsMapType params_;
 };
 
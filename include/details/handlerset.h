@@ -25,6 +25,20 @@
 
 #include <boost/utility.hpp>
 #include <boost/regex.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "settings.h"
+
+#if defined(HAVE_STLPORT_HASHMAP)
+#include <hash_map>
+#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_GNUCXX_HASHMAP)
+#include <ext/hash_map>
+#endif
+
+#include "details/functors.h"
+#include "details/request_filter.h"
 
 namespace fastcgi
 {
@@ -33,17 +47,32 @@ class Config;
 class ComponentSet;
 class Handler;
 class Request;
-class RequestFilter;
+
+struct RouteCacheInfo
+{
+	uint64_t size;
+	uint64_t capacity;
+	uint64_t hits;
+	uint64_t misses;
+};
+
+/**
+ * Handler descriptions in configuration order. Lookup goes through compiled
+ * route indexes and optional bounded cache of results keyed by request fields
+ * used by filters. Results that depend on param filters are never cached.
+ */
 
 class HandlerSet : private boost::noncopyable
 {
 public:
 	struct HandlerDescription {
-		typedef std::vector<std::pair<std::string, boost::shared_ptr<RequestFilter> > > FilterArray;
+		HandlerDescription() : streamingBody(false) {}
+		typedef std::vector<std::pair<RequestFilterType, boost::shared_ptr<RequestFilter> > > FilterArray;
 		FilterArray filters;
 		std::vector<Handler*> handlers;
 		std::string poolName;
 		std::string id;
+		bool streamingBody;
 	};
 	typedef std::vector<HandlerDescription> HandlerArray;
 
@@ -56,9 +85,70 @@ public:
 	const HandlerSet::HandlerDescription* findURIHandler(const Request *request) const;
 	void findPoolHandlers(const std::string &poolName, std::set<Handler*> &handlers) const;
 	std::set<std::string> getPoolsNeeded() const;
-	
+
+	RouteCacheInfo getRouteCacheInfo() const;
+
+	bool hasStreamingBody() const;
+	/**
+	 * Handler found before request body is read is final only if it takes body unread
+	 * and no handler before it has param filters, which could match body arguments.
+	 */
+	bool isStreamingBody(const HandlerDescription *handler) const;
+
+private:
+	typedef std::vector<unsigned int> HandlerIndexList;
+
+#if defined(HAVE_GNUCXX_HASHMAP)
+	typedef __gnu_cxx::hash_map<std::string, HandlerIndexList, StringHash> RouteMap;
+#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_STLPORT_HASHMAP)
+	typedef std::hash_map<std::string, HandlerIndexList, StringHash> RouteMap;
+#else
+	typedef std::map<std::string, HandlerIndexList> RouteMap;
+#endif
+
+#if defined(HAVE_GNUCXX_HASHMAP)
+	typedef __gnu_cxx::hash_map<std::string, int, StringHash> RouteCacheMap;
+#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_STLPORT_HASHMAP)
+	typedef std::hash_map<std::string, int, StringHash> RouteCacheMap;
+#else
+	typedef std::map<std::string, int> RouteCacheMap;
+#endif
+
+	struct RouteCacheShard {
+		RouteCacheShard() : hits(0), misses(0) {}
+		boost::mutex mutex;
+		RouteCacheMap routes;
+		uint64_t hits;
+		uint64_t misses;
+	};
+
+	struct RouteTrieNode {
+		std::map<char, unsigned int> children;
+		HandlerIndexList handlers;
+	};
+
+	void compileRoutes();
+	void addPrefixRoute(const std::string &prefix, unsigned int index);
+	static void addRoutes(const RouteMap &routes, const std::string &key, HandlerIndexList &candidates);
+	int findRoute(const Request *request, bool &cacheable) const;
+	std::string routeCacheKey(const Request *request) const;
+	RouteCacheShard& routeCacheShard(const std::string &key) const;
+	static bool matches(const HandlerDescription &handler, const Request *request, bool &paramsChecked);
+
 private:
 	HandlerArray handlers_;
+
+	RouteMap urls_, hosts_, ports_;
+	std::vector<RouteTrieNode> url_prefixes_;
+	/* handlers without exact or prefix filter, in ascending order */
+	HandlerIndexList unindexed_;
+
+	bool streaming_body_;
+	unsigned int first_param_handler_;
+
+	unsigned int route_cache_fields_;
+	std::size_t route_cache_shard_capacity_;
+	std::vector<boost::shared_ptr<RouteCacheShard> > route_cache_;
 };
 
 } // namespace fastcgi
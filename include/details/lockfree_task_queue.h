@@ -0,0 +1,163 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_LOCKFREE_TASK_QUEUE_H_
+#define _FASTCGI_DETAILS_LOCKFREE_TASK_QUEUE_H_
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+
+#include "details/atomic.h"
+#include "details/event_count.h"
+#include "details/task_queue.h"
+
+namespace fastcgi
+{
+
+/**
+ * Bounded multi-producer multi-consumer ring.
+ * Every cell carries a sequence number telling whether it is ready
+ * for the producer or for the consumer at the given position,
+ * so push and pop contend only on a single CAS of their position counter.
+ * Idle workers park on futex instead of condition variable.
+ */
+
+template<typename T>
+class LockFreeTaskQueue : public TaskQueue<T> {
+public:
+	LockFreeTaskQueue(const unsigned queueLength) :
+		queueLength_(queueLength), cells_(new Cell[queueLength ? queueLength : 1]),
+		enqueuePos_(0), dequeuePos_(0), stopped_(false)
+	{
+		for (unsigned i = 0; i < queueLength_; ++i) {
+			cells_[i].sequence = i;
+		}
+	}
+
+	virtual ~LockFreeTaskQueue() {
+	}
+
+	virtual bool push(const T &task) {
+		if (0 == queueLength_) {
+			return false;
+		}
+		Cell *cell = NULL;
+		boost::uint64_t pos = atomicLoadRelaxed(&enqueuePos_);
+		while (true) {
+			cell = &cells_[pos % queueLength_];
+			boost::int64_t diff = static_cast<boost::int64_t>(atomicLoad(&cell->sequence) - pos);
+			if (0 == diff) {
+				if (atomicCompareAndSwap(&enqueuePos_, pos, pos + 1)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			pos = atomicLoadRelaxed(&enqueuePos_);
+		}
+		cell->task = task;
+		atomicStore(&cell->sequence, pos + 1);
+		event_.notifyOne();
+		return true;
+	}
+
+	virtual bool pop(T &task, unsigned worker) {
+		(void)worker;
+		while (true) {
+			if (atomicLoad(&stopped_)) {
+				return false;
+			}
+			if (tryPop(task)) {
+				return true;
+			}
+			int ticket = event_.prepareWait();
+			if (atomicLoad(&stopped_) || ready()) {
+				event_.cancelWait();
+				continue;
+			}
+			event_.wait(ticket);
+		}
+	}
+
+	virtual void stop() {
+		atomicStore(&stopped_, true);
+		event_.notifyAll();
+	}
+
+	virtual boost::uint64_t size() const {
+		boost::uint64_t dequeued = atomicLoadRelaxed(&dequeuePos_);
+		boost::uint64_t enqueued = atomicLoadRelaxed(&enqueuePos_);
+		return enqueued > dequeued ? enqueued - dequeued : 0;
+	}
+
+private:
+	bool tryPop(T &task) {
+		if (0 == queueLength_) {
+			return false;
+		}
+		Cell *cell = NULL;
+		boost::uint64_t pos = atomicLoadRelaxed(&dequeuePos_);
+		while (true) {
+			cell = &cells_[pos % queueLength_];
+			boost::int64_t diff = static_cast<boost::int64_t>(atomicLoad(&cell->sequence) - (pos + 1));
+			if (0 == diff) {
+				if (atomicCompareAndSwap(&dequeuePos_, pos, pos + 1)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			pos = atomicLoadRelaxed(&dequeuePos_);
+		}
+		task = cell->task;
+		cell->task = T();
+		atomicStore(&cell->sequence, pos + queueLength_);
+		return true;
+	}
+
+	bool ready() const {
+		if (0 == queueLength_) {
+			return false;
+		}
+		boost::uint64_t pos = atomicLoadRelaxed(&dequeuePos_);
+		return atomicLoad(&cells_[pos % queueLength_].sequence) == pos + 1;
+	}
+
+private:
+	struct Cell {
+		volatile boost::uint64_t sequence;
+		T task;
+	};
+
+	enum { CACHE_LINE_SIZE = 64 };
+
+	const unsigned queueLength_;
+	boost::scoped_array<Cell> cells_;
+	char pad0_[CACHE_LINE_SIZE];
+	volatile boost::uint64_t enqueuePos_;
+	char pad1_[CACHE_LINE_SIZE];
+	volatile boost::uint64_t dequeuePos_;
+	char pad2_[CACHE_LINE_SIZE];
+	volatile bool stopped_;
+	EventCount event_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_LOCKFREE_TASK_QUEUE_H_
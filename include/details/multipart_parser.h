@@ -0,0 +1,79 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_MULTIPART_PARSER_H_
+#define _FASTCGI_DETAILS_MULTIPART_PARSER_H_
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+#include <boost/utility.hpp>
+
+#include "details/range.h"
+
+namespace fastcgi
+{
+
+class MultipartHandler;
+
+/**
+ * Incremental multipart/form-data parser. Body is fed in chunks of any size,
+ * part data is passed to handler without waiting for the closing boundary.
+ * Both \r\n and \n line endings are accepted.
+ */
+
+class MultipartParser : private boost::noncopyable {
+public:
+	MultipartParser(const std::string &boundary, MultipartHandler *handler);
+	virtual ~MultipartParser();
+
+	void feed(const char *data, std::size_t size);
+	void finish();
+
+	bool finished() const;
+	boost::uint64_t offset() const;
+
+private:
+	bool parsePreamble();
+	bool parseBoundaryLine();
+	bool parseHeaderLine();
+	bool parseData();
+	void parseHeader(const Range &line);
+	void consume(std::size_t size);
+
+private:
+	enum State {
+		PREAMBLE,
+		BOUNDARY_LINE,
+		HEADERS,
+		DATA,
+		EPILOGUE
+	};
+
+	State state_;
+	std::string boundary_, delimiter_;
+	std::string buffer_;
+	std::size_t pos_;
+	boost::uint64_t consumed_;
+	std::string header_;
+	std::string name_, filename_, type_;
+	MultipartHandler *handler_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_MULTIPART_PARSER_H_
@@ -41,11 +41,12 @@ public:
 	static const char* statusToString(short status);
 	static std::string getBoundary(const Range &range);
 	
-	static void addCookie(RequestImpl *req, const Range &range);
-	static void addHeader(RequestImpl *req, const Range &key, const Range &value);
+	static void addCookie(const RequestImpl *req, const Range &range);
+	static void addHeader(const RequestImpl *req, const Range &key, const Range &value);
 
 	static void parse(RequestImpl *req, char *env[], Logger* logger);
-	static void parseCookies(RequestImpl *req, const Range &range);
+	static void addVariable(const RequestImpl *req, const Range &key, const Range &value);
+	static void parseCookies(const RequestImpl *req, const Range &range);
 	
 	static void parsePart(RequestImpl *req, DataBuffer part);
 	static void parseLine(DataBuffer line, DataBuffer &name, DataBuffer &filename, DataBuffer &type);
@@ -26,6 +26,8 @@
 #include <algorithm>
 #include <string.h>
 
+#include "details/char_search.h"
+
 namespace fastcgi
 {
 
@@ -87,16 +89,15 @@ public:
 	}
 
 	const char* find(const Range& substr) const { 
-		if (substr.size() == 1) {
-			return find(*substr.begin());
-		}
-		else {
-			return std::search(begin(), end(), substr.begin(), substr.end());
-		}
+		return CharSearch::findString(begin_, end_, substr.begin_, substr.size());
 	}
 
 	const char* find(char ch) const {
-		return std::find(begin(), end(), ch);
+		if (empty()) {
+			return end_;
+		}
+		const char *pos = static_cast<const char*>(memchr(begin_, ch, size()));
+		return pos ? pos : end_;
 	}
 
 	bool split(Range const& delim, Range& first, Range& second) const {
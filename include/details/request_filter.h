@@ -28,29 +28,60 @@ namespace fastcgi
 
 class Request;
 
-class RequestFilter {
-public:
-    virtual bool check(const Request *request) const = 0;
+enum RequestFilterType {
+    FILTER_URL,
+    FILTER_HOST,
+    FILTER_PORT,
+    FILTER_ADDRESS,
+    FILTER_PARAM
 };
 
+/**
+ * Regex matched against whole value. Patterns without regex syntax
+ * and literal prefixes followed by .* are checked without regex engine.
+ */
+
 class RegexFilter  {
 public:
+    enum MatchType {
+        MATCH_EXACT,
+        MATCH_PREFIX,
+        MATCH_REGEX
+    };
+
     RegexFilter(const std::string &regex);
     ~RegexFilter();
 
     bool check(const std::string &value) const;
+
+    MatchType matchType() const;
+    const std::string& literal() const;
+
 private:
+    MatchType type_;
+    std::string literal_;
     boost::regex regex_;
 };
 
+class RequestFilter {
+public:
+    RequestFilter(const std::string &regex);
+    virtual ~RequestFilter();
+
+    virtual bool check(const Request *request) const = 0;
+
+    const RegexFilter& regex() const;
+
+protected:
+    RegexFilter regex_;
+};
+
 class UrlFilter : public RequestFilter {
 public:
     UrlFilter(const std::string &regex);
     ~UrlFilter();
 
     virtual bool check(const Request *request) const;
-private:
-    RegexFilter regex_;
 };
 
 class HostFilter : public RequestFilter {
@@ -59,8 +90,6 @@ public:
     ~HostFilter();
 
     virtual bool check(const Request *request) const;
-private:
-    RegexFilter regex_;
 };
 
 class PortFilter : public RequestFilter {
@@ -69,8 +98,6 @@ public:
     ~PortFilter();
 
     virtual bool check(const Request *request) const;
-private:
-    RegexFilter regex_;
 };
 
 class AddressFilter : public RequestFilter {
@@ -79,8 +106,6 @@ public:
     ~AddressFilter();
 
     virtual bool check(const Request *request) const;
-private:
-    RegexFilter regex_;
 };
 
 class ParamFilter : public RequestFilter {
@@ -91,7 +116,6 @@ public:
     virtual bool check(const Request *request) const;
 private:
     std::string name_;
-    RegexFilter regex_;
 };
 
 } // namespace fastcgi
@@ -0,0 +1,84 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_REQUEST_FORMAT_H_
+#define _FASTCGI_DETAILS_REQUEST_FORMAT_H_
+
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "fastcgi2/data_buffer.h"
+
+namespace fastcgi
+{
+
+/**
+ * On-disk layout of serialized request. Fixed little-endian header with magic
+ * and section table is followed by sections, key/value sections are sequences
+ * of varint prefixed strings. Header and all sections except body carry crc32,
+ * so truncated or damaged files are rejected, single section can be read
+ * and searched without decoding the whole request.
+ */
+
+class RequestFormat {
+public:
+	enum Section {
+		HEADERS_SECTION,
+		COOKIES_SECTION,
+		VARS_SECTION,
+		BODY_SECTION,
+		FILES_SECTION,
+		ARGS_SECTION,
+		SECTIONS_COUNT
+	};
+
+	static const boost::uint32_t FORMAT_VERSION = 2;
+	static const boost::uint64_t HEADER_SIZE = 16 + SECTIONS_COUNT * 24 + 8;
+
+	RequestFormat();
+
+	boost::uint64_t offset(Section section) const;
+	boost::uint64_t length(Section section) const;
+	void setSection(Section section, boost::uint64_t offset, const std::string &data);
+	void setBody(boost::uint64_t offset, boost::uint64_t length);
+
+	void write(std::string &header) const;
+	void write(DataBuffer &buffer) const;
+	void read(DataBuffer buffer);
+	void readSection(DataBuffer buffer, Section section, std::string &data) const;
+
+	static bool lookup(DataBuffer buffer, Section section, const std::string &name, std::string &value);
+	static bool find(const std::string &data, const std::string &name, std::string &value);
+
+	static void addNumber(std::string &data, boost::uint64_t value);
+	static void addString(std::string &data, const std::string &value);
+	static boost::uint64_t nextNumber(const std::string &data, std::size_t &pos);
+	static void nextString(const std::string &data, std::size_t &pos, std::string &value);
+
+private:
+	struct Entry {
+		boost::uint32_t checksum;
+		boost::uint64_t offset;
+		boost::uint64_t length;
+	};
+	Entry sections_[SECTIONS_COUNT];
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_REQUEST_FORMAT_H_
@@ -38,7 +38,7 @@ struct RequestTask {
 class RequestsThreadPool : public ThreadPool<RequestTask> {
 public:
 	RequestsThreadPool(const unsigned threadsNumber, const unsigned queueLength,
-		fastcgi::Logger *logger);
+		ThreadPoolScheduler scheduler, fastcgi::Logger *logger);
 	virtual ~RequestsThreadPool();
 	virtual void handleTask(RequestTask task);
 private:
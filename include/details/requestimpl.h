@@ -23,22 +23,16 @@
 #include <iosfwd>
 #include <functional>
 #include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "settings.h"
 
-#if defined(HAVE_STLPORT_HASHMAP)
-#include <hash_set>
-#include <hash_map>
-#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_GNUCXX_HASHMAP)
-#include <ext/hash_set>
-#include <ext/hash_map>
-#endif
-
 #include "fastcgi2/util.h"
 #include "fastcgi2/cookie.h"
 
 #include "details/range.h"
 #include "details/functors.h"
+#include "details/string_map.h"
 
 namespace fastcgi
 {
@@ -59,28 +53,14 @@ private:
 	DataBuffer data_;
 };
 
-#if defined(HAVE_GNUCXX_HASHMAP)
-
-typedef __gnu_cxx::hash_map<std::string, std::string, StringCIHash> VarMap;
-typedef __gnu_cxx::hash_map<std::string, std::string, StringCIHash, StringCIEqual> HeaderMap;
-
-#elif defined(HAVE_EXT_HASH_MAP) || defined(HAVE_STLPORT_HASHMAP)
-
-typedef std::hash_map<std::string, std::string, StringCIHash> VarMap;
-typedef std::hash_map<std::string, std::string, StringCIHash, StringCIEqual> HeaderMap;
-
-#else
-
-typedef std::map<std::string, std::string> VarMap;
-typedef std::map<std::string, std::string, StringCILess> HeaderMap;
-
-#endif
-
-class StringCILess;
+typedef StringMap<StringHash, std::equal_to<std::string> > VarMap;
+typedef StringMap<StringCIHash, StringCIEqual> HeaderMap;
 
 class Logger;
+class MultipartHandler;
 class Request;
 class RequestCache;
+class RequestFormat;
 class RequestIOStream;
 
 class RequestImpl : private boost::noncopyable {
@@ -141,6 +121,8 @@ public:
 	
 	void write(std::streambuf *buf);
 	std::streamsize write(const char *buf, std::streamsize size);
+	void write(const DataBuffer &buffer);
+	void writeFile(int fd, boost::uint64_t offset, boost::uint64_t length);
 	std::string outputHeader(const std::string &name) const;
 
 	bool isProcessed() const;
@@ -154,43 +136,76 @@ public:
 	void reset();
 	void sendHeaders();
 	void attach(RequestIOStream *stream, char *env[]);
+	void attachHeaders(RequestIOStream *stream, char *env[]);
+	void attachBody();
+	bool isBodyPending() const;
+
+	std::streamsize readBody(char *buf, std::streamsize size);
+	void readMultipart(MultipartHandler *handler);
 	
 	unsigned short status() const;
 
 private:
 	friend class Parser;
+
+	enum KnownVariable {
+		HTTPS_VAR,
+		SERVER_ADDR_VAR,
+		SERVER_PORT_VAR,
+		PATH_INFO_VAR,
+		PATH_TRANSLATED_VAR,
+		SCRIPT_NAME_VAR,
+		SCRIPT_FILENAME_VAR,
+		DOCUMENT_ROOT_VAR,
+		REMOTE_USER_VAR,
+		REMOTE_ADDR_VAR,
+		QUERY_STRING_VAR,
+		REQUEST_METHOD_VAR,
+		HOST_HEADER,
+		CONTENT_TYPE_HEADER,
+		CONTENT_LENGTH_HEADER,
+		KNOWN_VARIABLES_COUNT
+	};
+
 	void sendHeadersInternal();
 
-	boost::uint64_t serializeEnv(DataBuffer &buffer, boost::uint64_t add_size);
-	boost::uint64_t serializeInt(DataBuffer &buffer, boost::uint64_t pos, boost::uint64_t val);
-	boost::uint64_t serializeString(DataBuffer &buffer, boost::uint64_t pos, const std::string &val);
-	boost::uint64_t serializeBuffer(DataBuffer &buffer, boost::uint64_t pos, const DataBuffer &src);
-	boost::uint64_t serializeFiles(DataBuffer &buffer, boost::uint64_t pos);
-	boost::uint64_t serializeArgs(DataBuffer &buffer, boost::uint64_t pos);
-
-	boost::uint64_t parseInt(DataBuffer buffer, boost::uint64_t pos, boost::uint64_t &val);
-	boost::uint64_t parseString(DataBuffer buffer, boost::uint64_t pos, std::string &val);
-	boost::uint64_t parseHeaders(DataBuffer buffer, boost::uint64_t pos);
-	boost::uint64_t parseCookies(DataBuffer buffer, boost::uint64_t pos);
-	boost::uint64_t parseVars(DataBuffer buffer, boost::uint64_t pos);
-	boost::uint64_t parseBody(DataBuffer buffer, boost::uint64_t pos);
-	boost::uint64_t parseFiles(DataBuffer buffer, boost::uint64_t pos);
-	boost::uint64_t parseArgs(DataBuffer buffer, boost::uint64_t pos);
-
-	boost::uint64_t bodySerializedSize();
-	boost::uint64_t filesSerializedSize();
-	boost::uint64_t argsSerializedSize();
+	/* const because env is parsed into mutable maps from const getters */
+	void setVar(const std::string &name, const std::string &value) const;
+	void setInputHeader(const std::string &name, const std::string &value) const;
+	const std::string& knownVariable(KnownVariable var) const;
+
+	void addEnv(const Range &key, const Range &value);
+	void parseEnv() const;
+
+	void serializeEnv(RequestFormat &format, std::string &data);
+	void serializeTail(RequestFormat &format, boost::uint64_t base, std::string &data);
+	void parseFiles(const std::string &data);
 
 private:
 	bool headers_sent_;
 	unsigned short status_;
 	bool processed_;
 	time_t delay_;
+	bool body_pending_;
+	boost::uint64_t body_remaining_;
 
 	RequestIOStream* stream_;
-	VarMap vars_, cookies_;
 	DataBuffer body_;
-	HeaderMap headers_, out_headers_;
+	HeaderMap out_headers_;
+
+	/*
+	 * Views into env block of endpoint are parsed into vars, cookies and headers
+	 * on first access. Const getters of one request may be called from several
+	 * threads, so parsing is done once under env_mutex_ and published by env_parsed_.
+	 * Known variables are copied in addEnv and never change until parsing is done.
+	 */
+	mutable VarMap vars_, cookies_;
+	mutable HeaderMap headers_;
+	mutable std::size_t known_[KNOWN_VARIABLES_COUNT];
+	mutable std::vector<std::pair<Range, Range> > env_;
+	mutable boost::mutex env_mutex_;
+	mutable volatile bool env_parsed_;
+	std::string known_values_[KNOWN_VARIABLES_COUNT];
 
 	std::set<Cookie> out_cookies_;
 	std::map<std::string, File> files_;
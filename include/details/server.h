@@ -39,6 +39,7 @@ protected:
 	virtual Logger* logger() const = 0;
 
 	void handleRequestInternal(const HandlerSet::HandlerDescription* handler, RequestTask task);
+	bool prepareRequest(RequestTask task, const HandlerSet::HandlerDescription *&handler);
 	const HandlerSet::HandlerDescription* getHandler(RequestTask task) const;
 };
 
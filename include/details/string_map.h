@@ -0,0 +1,143 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_STRING_MAP_H_
+#define _FASTCGI_DETAILS_STRING_MAP_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace fastcgi
+{
+
+/**
+ * Flat string to string map for request-scoped data.
+ * Entries are kept in insertion order in one vector and found through
+ * open addressing index, clear() keeps both allocated for reuse.
+ * Entries are never erased, so entry position stays valid until clear().
+ */
+
+template<typename Hash, typename Equal>
+class StringMap
+{
+public:
+	typedef std::pair<std::string, std::string> value_type;
+	typedef typename std::vector<value_type>::iterator iterator;
+	typedef typename std::vector<value_type>::const_iterator const_iterator;
+
+	StringMap() {
+	}
+
+	iterator begin() {
+		return entries_.begin();
+	}
+
+	iterator end() {
+		return entries_.end();
+	}
+
+	const_iterator begin() const {
+		return entries_.begin();
+	}
+
+	const_iterator end() const {
+		return entries_.end();
+	}
+
+	std::size_t size() const {
+		return entries_.size();
+	}
+
+	bool empty() const {
+		return entries_.empty();
+	}
+
+	const value_type& at(std::size_t pos) const {
+		return entries_[pos];
+	}
+
+	iterator find(const std::string &key) {
+		unsigned int pos = index_.empty() ? 0 : index_[lookup(key)];
+		return pos ? entries_.begin() + (pos - 1) : entries_.end();
+	}
+
+	const_iterator find(const std::string &key) const {
+		unsigned int pos = index_.empty() ? 0 : index_[lookup(key)];
+		return pos ? entries_.begin() + (pos - 1) : entries_.end();
+	}
+
+	std::pair<iterator, bool> insert(const value_type &value) {
+		if (2 * (entries_.size() + 1) > index_.size()) {
+			rehash(std::max(index_.size() * 2, static_cast<std::size_t>(MIN_INDEX_SIZE)));
+		}
+		std::size_t slot = lookup(value.first);
+		if (index_[slot]) {
+			return std::make_pair(entries_.begin() + (index_[slot] - 1), false);
+		}
+		entries_.push_back(value);
+		index_[slot] = entries_.size();
+		return std::make_pair(entries_.end() - 1, true);
+	}
+
+	std::string& operator [] (const std::string &key) {
+		return insert(std::make_pair(key, std::string())).first->second;
+	}
+
+	void clear() {
+		entries_.clear();
+		std::fill(index_.begin(), index_.end(), 0);
+	}
+
+	void swap(StringMap &other) {
+		entries_.swap(other.entries_);
+		index_.swap(other.index_);
+	}
+
+private:
+	enum { MIN_INDEX_SIZE = 32 };
+
+	std::size_t lookup(const std::string &key) const {
+		std::size_t mask = index_.size() - 1;
+		std::size_t slot = Hash()(key) & mask;
+		while (index_[slot] && !Equal()(entries_[index_[slot] - 1].first, key)) {
+			slot = (slot + 1) & mask;
+		}
+		return slot;
+	}
+
+	void rehash(std::size_t size) {
+		index_.assign(size, 0);
+		std::size_t mask = size - 1;
+		for (std::size_t i = 0, count = entries_.size(); i < count; ++i) {
+			std::size_t slot = Hash()(entries_[i].first) & mask;
+			while (index_[slot]) {
+				slot = (slot + 1) & mask;
+			}
+			index_[slot] = i + 1;
+		}
+	}
+
+private:
+	std::vector<value_type> entries_;
+	std::vector<unsigned int> index_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_STRING_MAP_H_
@@ -0,0 +1,108 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_TASK_QUEUE_H_
+#define _FASTCGI_DETAILS_TASK_QUEUE_H_
+
+#include <queue>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+namespace fastcgi
+{
+
+/**
+ * Queue of tasks waiting for ThreadPool workers.
+ * push never blocks and returns false when the queue is full,
+ * pop blocks until a task is available and returns false once the queue is stopped.
+ */
+
+template<typename T>
+class TaskQueue : private boost::noncopyable {
+public:
+	virtual ~TaskQueue() {}
+
+	virtual bool push(const T &task) = 0;
+	virtual bool pop(T &task, unsigned worker) = 0;
+	virtual void stop() = 0;
+	virtual boost::uint64_t size() const = 0;
+};
+
+template<typename T>
+class SharedTaskQueue : public TaskQueue<T> {
+public:
+	SharedTaskQueue(const unsigned queueLength) :
+		queueLength_(queueLength), stopped_(false)
+	{}
+
+	virtual ~SharedTaskQueue() {
+	}
+
+	virtual bool push(const T &task) {
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+			if (tasks_.size() >= queueLength_) {
+				return false;
+			}
+			tasks_.push(task);
+		}
+		condition_.notify_one();
+		return true;
+	}
+
+	virtual bool pop(T &task, unsigned worker) {
+		(void)worker;
+		boost::mutex::scoped_lock lock(mutex_);
+		while (true) {
+			if (stopped_) {
+				return false;
+			}
+			else if (!tasks_.empty()) {
+				break;
+			}
+			condition_.wait(lock);
+		}
+		task = tasks_.front();
+		tasks_.pop();
+		return true;
+	}
+
+	virtual void stop() {
+		boost::mutex::scoped_lock lock(mutex_);
+		stopped_ = true;
+		condition_.notify_all();
+	}
+
+	virtual boost::uint64_t size() const {
+		boost::mutex::scoped_lock lock(mutex_);
+		return tasks_.size();
+	}
+
+private:
+	const unsigned queueLength_;
+	bool stopped_;
+	mutable boost::mutex mutex_;
+	boost::condition condition_;
+	std::queue<T> tasks_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_TASK_QUEUE_H_
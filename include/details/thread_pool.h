@@ -22,11 +22,14 @@
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/thread.hpp>
-#include <boost/thread/condition.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/lexical_cast.hpp>
 
-#include <queue>
+#include "details/atomic.h"
+#include "details/task_queue.h"
+#include "details/lockfree_task_queue.h"
+#include "details/work_stealing_task_queue.h"
 
 namespace fastcgi {
 
@@ -41,6 +44,12 @@ struct ThreadPoolInfo
 	uint64_t badTasksCounter;
 };
 
+enum ThreadPoolScheduler {
+	SCHEDULER_SHARED_QUEUE,
+	SCHEDULER_LOCK_FREE,
+	SCHEDULER_WORK_STEALING
+};
+
 template<typename T>
 class ThreadPool : private boost::noncopyable {
 public:
@@ -48,7 +57,8 @@ public:
 	typedef boost::function<void ()> InitFuncType;
 
 public:
-	ThreadPool(const unsigned threadsNumber, const unsigned queueLength)
+	ThreadPool(const unsigned threadsNumber, const unsigned queueLength,
+		ThreadPoolScheduler scheduler = SCHEDULER_SHARED_QUEUE)
 	{
 		info_.started = false;
 		info_.threadsNumber = threadsNumber;
@@ -57,6 +67,18 @@ public:
 		info_.currentQueue = 0;
 		info_.goodTasksCounter = 0;
 		info_.badTasksCounter = 0;
+
+		switch (scheduler) {
+		case SCHEDULER_LOCK_FREE:
+			tasksQueue_.reset(new LockFreeTaskQueue<T>(queueLength));
+			break;
+		case SCHEDULER_WORK_STEALING:
+			tasksQueue_.reset(new WorkStealingTaskQueue<T>(threadsNumber, queueLength));
+			break;
+		default:
+			tasksQueue_.reset(new SharedTaskQueue<T>(queueLength));
+			break;
+		}
 	}
 
 	virtual ~ThreadPool() {
@@ -71,20 +93,19 @@ public:
 //			throw std::runtime_error("Invalid thread pool state.");
 //		}
 
-		boost::function<void()> f = boost::bind(&ThreadPool<T>::workMethod, this, func);
 		for (unsigned i = 0; i < info_.threadsNumber; ++i) {
-			threads_.create_thread(f);
+			threads_.create_thread(boost::bind(&ThreadPool<T>::workMethod, this, func, i));
 		}
 
-		info_.started = true;
+		atomicStore(&info_.started, true);
 	}
 
 	void stop() {
 		{
 			boost::mutex::scoped_lock lock(mutex_);
-			info_.started = false;
-			condition_.notify_all();
+			atomicStore(&info_.started, false);
 		}
+		tasksQueue_->stop();
 	}
 
 	void join() {
@@ -92,41 +113,33 @@ public:
 	}
 
 	void addTask(T task) {
-		try {
-			boost::mutex::scoped_lock lock(mutex_);
-
-			if (!info_.started) {
-				throw std::runtime_error("Thread pool is not started yet");
-			}
+		if (!atomicLoad(&info_.started)) {
+			throw std::runtime_error("Thread pool is not started yet");
+		}
 
-			if (tasksQueue_.size() >= info_.queueLength) {
-				throw std::runtime_error("Pool::handle: the queue has already reached its maximum size of "
-						+ boost::lexical_cast<std::string>(info_.queueLength) + " elements");
-			}
-			tasksQueue_.push(task);
-		} catch (...) {
-			condition_.notify_one();
-			throw;
+		if (!tasksQueue_->push(task)) {
+			throw std::runtime_error("Pool::handle: the queue has already reached its maximum size of "
+					+ boost::lexical_cast<std::string>(info_.queueLength) + " elements");
 		}
-		condition_.notify_one();
 	}
 
 	ThreadPoolInfo getInfo() const {
-		boost::mutex::scoped_lock lock(mutex_);
-		info_.currentQueue = tasksQueue_.size();
-		return info_;
+		ThreadPoolInfo info;
+		info.started = atomicLoad(&info_.started);
+		info.threadsNumber = info_.threadsNumber;
+		info.queueLength = info_.queueLength;
+		info.busyThreadsCounter = atomicLoadRelaxed(&info_.busyThreadsCounter);
+		info.currentQueue = tasksQueue_->size();
+		info.goodTasksCounter = atomicLoadRelaxed(&info_.goodTasksCounter);
+		info.badTasksCounter = atomicLoadRelaxed(&info_.badTasksCounter);
+		return info;
 	}
 
 protected:
 	virtual void handleTask(T) = 0;
 
 private:
-	void workMethod(InitFuncType func) {
-		const int none = 0;
-		const int good = 1;
-		const int bad = 2;
-		int state = none;
-
+	void workMethod(InitFuncType func, unsigned worker) {
 		try {
 			func();
 		}
@@ -136,41 +149,22 @@ private:
 		while (true) {
 			try
 			{
-				T task;
+				bool good = false;
 				{
-					boost::mutex::scoped_lock lock(mutex_);
-					switch (state) {
-					case none:
-						break;
-					case good:
-						++info_.goodTasksCounter;
-						--info_.busyThreadsCounter;
-						break;
-					case bad:
-						++info_.badTasksCounter;
-						--info_.busyThreadsCounter;
-						break;
+					T task;
+					if (!tasksQueue_->pop(task, worker)) {
+						return;
 					}
-					state = none;
-					while (true) {
-						if (!info_.started) {
-							return;
-						} else if (!tasksQueue_.empty()) {
-							break;
-						}
-						condition_.wait(lock);
-					}
-					task = tasksQueue_.front();
-					tasksQueue_.pop();
-					++info_.busyThreadsCounter;
-				}
+					atomicIncrement(&info_.busyThreadsCounter);
 
-				try {
-					handleTask(task);
-					state = good;
-				} catch (...) {
-					state = bad;
+					try {
+						handleTask(task);
+						good = true;
+					} catch (...) {
+					}
 				}
+				atomicIncrement(good ? &info_.goodTasksCounter : &info_.badTasksCounter);
+				atomicDecrement(&info_.busyThreadsCounter);
 			}
 			catch (...)
 			{
@@ -179,11 +173,10 @@ private:
 	}
 
 private:
-	mutable boost::mutex mutex_;
-	boost::condition condition_;
+	boost::mutex mutex_;
 	boost::thread_group threads_;
-	std::queue<T> tasksQueue_;
-	mutable ThreadPoolInfo info_;
+	boost::scoped_ptr<TaskQueue<T> > tasksQueue_;
+	ThreadPoolInfo info_;
 };
 
 } // namespace fastcgi
@@ -0,0 +1,136 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_DETAILS_WORK_STEALING_TASK_QUEUE_H_
+#define _FASTCGI_DETAILS_WORK_STEALING_TASK_QUEUE_H_
+
+#include <deque>
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "details/atomic.h"
+#include "details/event_count.h"
+#include "details/task_queue.h"
+
+namespace fastcgi
+{
+
+/**
+ * Every worker owns its own deque. Producers put a task to the less loaded
+ * of two round-robin neighbours, worker takes tasks from its own deque first
+ * and steals from peers only when it has nothing to do.
+ * Total number of waiting tasks is tracked separately to keep queue length limit.
+ */
+
+template<typename T>
+class WorkStealingTaskQueue : public TaskQueue<T> {
+public:
+	WorkStealingTaskQueue(const unsigned threadsNumber, const unsigned queueLength) :
+		threadsNumber_(threadsNumber ? threadsNumber : 1), queueLength_(queueLength),
+		workers_(new WorkerQueue[threadsNumber ? threadsNumber : 1]),
+		next_(0), size_(0), stopped_(false)
+	{}
+
+	virtual ~WorkStealingTaskQueue() {
+	}
+
+	virtual bool push(const T &task) {
+		if (atomicIncrement(&size_) > queueLength_) {
+			atomicDecrement(&size_);
+			return false;
+		}
+		unsigned first = atomicIncrement(&next_) % threadsNumber_;
+		unsigned second = (first + 1) % threadsNumber_;
+		WorkerQueue &target = (atomicLoadRelaxed(&workers_[second].size) <
+			atomicLoadRelaxed(&workers_[first].size)) ? workers_[second] : workers_[first];
+		{
+			boost::mutex::scoped_lock lock(target.mutex);
+			target.tasks.push_back(task);
+			atomicIncrement(&target.size);
+		}
+		event_.notifyOne();
+		return true;
+	}
+
+	virtual bool pop(T &task, unsigned worker) {
+		worker %= threadsNumber_;
+		while (true) {
+			if (atomicLoad(&stopped_)) {
+				return false;
+			}
+			for (unsigned i = 0; i < threadsNumber_; ++i) {
+				if (take(workers_[(worker + i) % threadsNumber_], task)) {
+					atomicDecrement(&size_);
+					return true;
+				}
+			}
+			int ticket = event_.prepareWait();
+			if (atomicLoad(&stopped_) || atomicLoad(&size_) > 0) {
+				event_.cancelWait();
+				continue;
+			}
+			event_.wait(ticket);
+		}
+	}
+
+	virtual void stop() {
+		atomicStore(&stopped_, true);
+		event_.notifyAll();
+	}
+
+	virtual boost::uint64_t size() const {
+		return atomicLoadRelaxed(&size_);
+	}
+
+private:
+	struct WorkerQueue {
+		WorkerQueue() : size(0) {}
+		boost::mutex mutex;
+		std::deque<T> tasks;
+		volatile unsigned size;
+		char pad[64];
+	};
+
+	static bool take(WorkerQueue &queue, T &task) {
+		if (0 == atomicLoadRelaxed(&queue.size)) {
+			return false;
+		}
+		boost::mutex::scoped_lock lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			return false;
+		}
+		task = queue.tasks.front();
+		queue.tasks.pop_front();
+		atomicDecrement(&queue.size);
+		return true;
+	}
+
+private:
+	const unsigned threadsNumber_;
+	const unsigned queueLength_;
+	boost::scoped_array<WorkerQueue> workers_;
+	volatile unsigned next_;
+	volatile unsigned size_;
+	volatile bool stopped_;
+	EventCount event_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_DETAILS_WORK_STEALING_TASK_QUEUE_H_
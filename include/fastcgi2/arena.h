@@ -0,0 +1,163 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_ARENA_H_
+#define _FASTCGI_ARENA_H_
+
+#include <cstddef>
+#include <limits>
+#include <new>
+
+#include <boost/utility.hpp>
+
+namespace fastcgi
+{
+
+/**
+ * Monotonic per-request memory arena. Memory is released all at once when
+ * request handling completes, deallocation of single objects is a no-op.
+ * Arenas are recycled through per-thread free lists.
+ */
+
+class Arena : private boost::noncopyable {
+public:
+	explicit Arena(std::size_t blockSize = DEFAULT_BLOCK_SIZE);
+	~Arena();
+
+	void* allocate(std::size_t size);
+	char* duplicate(const char *data, std::size_t size);
+
+	void reset();
+	std::size_t allocated() const;
+
+	static Arena* acquire();
+	static void release(Arena *arena);
+
+	static const std::size_t DEFAULT_BLOCK_SIZE = 16384;
+
+private:
+	struct Block {
+		Block *next;
+		std::size_t size;
+	};
+
+	void addBlock(std::size_t size);
+
+private:
+	Block *blocks_;
+	char *pos_, *end_;
+	std::size_t block_size_;
+	std::size_t allocated_;
+};
+
+/**
+ * Holds arena acquired from free list of current thread for a scope
+ */
+
+class ScopedArena : private boost::noncopyable {
+public:
+	ScopedArena() : arena_(Arena::acquire()) {
+	}
+
+	~ScopedArena() {
+		Arena::release(arena_);
+	}
+
+	Arena* get() const {
+		return arena_;
+	}
+
+private:
+	Arena *arena_;
+};
+
+/**
+ * STL allocator on top of arena for request-scoped containers
+ */
+
+template<typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef std::size_t size_type;
+	typedef std::ptrdiff_t difference_type;
+
+	template<typename U> struct rebind {
+		typedef ArenaAllocator<U> other;
+	};
+
+	explicit ArenaAllocator(Arena *arena) : arena_(arena) {
+	}
+
+	template<typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {
+	}
+
+	pointer address(reference value) const {
+		return &value;
+	}
+
+	const_pointer address(const_reference value) const {
+		return &value;
+	}
+
+	pointer allocate(size_type count, const void* = 0) {
+		if (count > max_size()) {
+			throw std::bad_alloc();
+		}
+		return static_cast<pointer>(arena_->allocate(count * sizeof(T)));
+	}
+
+	void deallocate(pointer, size_type) {
+	}
+
+	size_type max_size() const {
+		return std::numeric_limits<size_type>::max() / sizeof(T);
+	}
+
+	void construct(pointer p, const T &value) {
+		new (p) T(value);
+	}
+
+	void destroy(pointer p) {
+		p->~T();
+	}
+
+	Arena* arena() const {
+		return arena_;
+	}
+
+private:
+	Arena *arena_;
+};
+
+template<typename T, typename U> inline bool
+operator == (const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+	return a.arena() == b.arena();
+}
+
+template<typename T, typename U> inline bool
+operator != (const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+	return a.arena() != b.arena();
+}
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_ARENA_H_
@@ -18,7 +18,11 @@
 #ifndef _FASTCGI_DATA_BUFFER_H_
 #define _FASTCGI_DATA_BUFFER_H_
 
+#include <sys/uio.h>
+
+#include <string>
 #include <utility>
+#include <vector>
 
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
@@ -56,6 +60,8 @@ public:
 	DataBuffer trimn(boost::uint64_t b, boost::uint64_t e) const;
 	bool split(const std::string &delim, DataBuffer &first, DataBuffer &second) const;
 	bool split(char delim, DataBuffer &first, DataBuffer &second) const;
+	void findAll(const std::string &delim, std::vector<boost::uint64_t> &positions) const;
+	int compare(boost::uint64_t pos, const char *data, boost::uint64_t len) const;
 	bool startsWith(const std::string &data) const;
 	bool startsWithCI(const std::string &data) const;
 	bool endsWith(const std::string &data) const;
@@ -64,6 +70,7 @@ public:
 
 	boost::uint64_t read(boost::uint64_t pos, char *data, boost::uint64_t len);
 	boost::uint64_t write(boost::uint64_t pos, const char *data, boost::uint64_t len);
+	boost::uint64_t writev(boost::uint64_t pos, const struct iovec *iov, int count);
 
 	boost::uint64_t beginIndex() const;
 	boost::uint64_t endIndex() const;
@@ -72,6 +79,7 @@ public:
 
 private:
 	void checkIndex(boost::uint64_t index) const;
+	bool matchCI(boost::uint64_t pos, const std::string &data) const;
 	boost::uint64_t find(boost::uint64_t pos, const char* buf, boost::uint64_t len) const;
 
 private:
@@ -28,6 +28,7 @@
 namespace fastcgi
 {
 
+class Arena;
 class Request;
 
 class HandlerContext {
@@ -36,6 +37,9 @@ public:
 
 	virtual boost::any getParam(const std::string &name) const = 0;
 	virtual void setParam(const std::string &name, const boost::any &value) = 0;
+
+	/* request-scoped scratch memory, released after all handlers complete */
+	virtual Arena* arena() const;
 };
 
 class Handler : private boost::noncopyable
@@ -0,0 +1,43 @@
+// Fastcgi Daemon - framework for design highload FastCGI applications on C++
+// Copyright (C) 2011 Ilya Golubtsov <golubtsov@yandex-team.ru>
+
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// as published by the Free Software Foundation; either version 2
+// of the License, or (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+
+#ifndef _FASTCGI_MULTIPART_HANDLER_H_
+#define _FASTCGI_MULTIPART_HANDLER_H_
+
+#include <cstddef>
+#include <string>
+
+namespace fastcgi
+{
+
+/**
+ * Receives parts of multipart request body as they are read from the web server.
+ * Used by handlers with streaming-body="yes".
+ */
+
+class MultipartHandler {
+public:
+	virtual ~MultipartHandler();
+
+	virtual void onPartBegin(const std::string &name, const std::string &filename, const std::string &type) = 0;
+	virtual void onPartData(const char *data, std::size_t size) = 0;
+	virtual void onPartEnd() = 0;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_MULTIPART_HANDLER_H_
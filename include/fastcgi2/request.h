@@ -31,6 +31,7 @@ namespace fastcgi
 
 class Cookie;
 class Logger;
+class MultipartHandler;
 class RequestCache;
 class RequestIOStream;
 class RequestImpl;
@@ -96,11 +97,20 @@ public:
 
     void write(std::streambuf *buf);
     std::streamsize write(const char *buf, std::streamsize size);
+    void write(const DataBuffer &buffer);
+    void writeFile(int fd, boost::uint64_t offset, boost::uint64_t length);
     std::string outputHeader(const std::string &name) const;
 
     void reset();
+    void saveToCache();
     void sendHeaders();
     void attach(RequestIOStream *stream, char *env[]);
+    void attachHeaders(RequestIOStream *stream, char *env[]);
+    void attachBody();
+    bool isBodyPending() const;
+
+    std::streamsize readBody(char *buf, std::streamsize size);
+    void readMultipart(MultipartHandler *handler);
 
     bool isProcessed() const;
     void markAsProcessed();
@@ -18,6 +18,12 @@
 #ifndef _FASTCGI_REQUEST_IO_STREAM_H_
 #define _FASTCGI_REQUEST_IO_STREAM_H_
 
+#include <sys/uio.h>
+
+#include <iosfwd>
+
+#include <boost/cstdint.hpp>
+
 namespace fastcgi
 {
 
@@ -26,6 +32,20 @@ public:
 	virtual int read(char *buf, int size) = 0;
 	virtual int write(const char *buf, int size) = 0;
 	virtual void write(std::streambuf *buf) = 0;
+
+	/**
+	 * Writes several buffers at once. Streams which can pass them
+	 * to the socket without copying should override it.
+	 */
+	virtual int writev(const struct iovec *iov, int count);
+
+	/**
+	 * Writes part of file. Streams attached to socket may send it
+	 * straight from page cache.
+	 */
+	virtual void writeFile(int fd, boost::uint64_t offset, boost::uint64_t length);
+
+	virtual ~RequestIOStream();
 };
 
 } // namespace fastcgi
@@ -0,0 +1,152 @@
+#include "settings.h"
+
+#include <new>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/cstdint.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+#include "fastcgi2/arena.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+union MaxAlign {
+	long double ld;
+	double d;
+	boost::uint64_t i;
+	void *p;
+};
+
+static const std::size_t ALIGNMENT = boost::alignment_of<MaxAlign>::value;
+static const std::size_t MAX_FREE_ARENAS = 32;
+
+static inline std::size_t
+alignSize(std::size_t size) {
+	return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+class ArenaList : private boost::noncopyable {
+public:
+	~ArenaList() {
+		for (std::vector<Arena*>::iterator i = arenas.begin(), end = arenas.end(); i != end; ++i) {
+			delete *i;
+		}
+	}
+	std::vector<Arena*> arenas;
+};
+
+static boost::thread_specific_ptr<ArenaList> free_arenas;
+
+const std::size_t Arena::DEFAULT_BLOCK_SIZE;
+
+Arena::Arena(std::size_t blockSize) :
+	blocks_(NULL), pos_(NULL), end_(NULL), block_size_(blockSize), allocated_(0)
+{}
+
+Arena::~Arena() {
+	while (blocks_) {
+		Block *next = blocks_->next;
+		free(blocks_);
+		blocks_ = next;
+	}
+}
+
+void*
+Arena::allocate(std::size_t size) {
+	size = alignSize(size ? size : 1);
+	if (static_cast<std::size_t>(end_ - pos_) < size) {
+		addBlock(size);
+	}
+	void *result = pos_;
+	pos_ += size;
+	allocated_ += size;
+	return result;
+}
+
+char*
+Arena::duplicate(const char *data, std::size_t size) {
+	char *result = static_cast<char*>(allocate(size + 1));
+	memcpy(result, data, size);
+	result[size] = '\0';
+	return result;
+}
+
+void
+Arena::reset() {
+	Block *keep = NULL;
+	while (blocks_) {
+		Block *next = blocks_->next;
+		if (!keep && block_size_ == blocks_->size) {
+			keep = blocks_;
+			keep->next = NULL;
+		}
+		else {
+			free(blocks_);
+		}
+		blocks_ = next;
+	}
+	blocks_ = keep;
+	pos_ = keep ? reinterpret_cast<char*>(keep) + alignSize(sizeof(Block)) : NULL;
+	end_ = keep ? reinterpret_cast<char*>(keep) + keep->size : NULL;
+	allocated_ = 0;
+}
+
+std::size_t
+Arena::allocated() const {
+	return allocated_;
+}
+
+void
+Arena::addBlock(std::size_t size) {
+	std::size_t header = alignSize(sizeof(Block));
+	std::size_t blockSize = std::max(block_size_, header + size);
+	Block *block = static_cast<Block*>(malloc(blockSize));
+	if (NULL == block) {
+		throw std::bad_alloc();
+	}
+	block->size = blockSize;
+	block->next = blocks_;
+	blocks_ = block;
+	pos_ = reinterpret_cast<char*>(block) + header;
+	end_ = reinterpret_cast<char*>(block) + blockSize;
+}
+
+Arena*
+Arena::acquire() {
+	ArenaList *list = free_arenas.get();
+	if (list && !list->arenas.empty()) {
+		Arena *arena = list->arenas.back();
+		list->arenas.pop_back();
+		return arena;
+	}
+	return new Arena();
+}
+
+void
+Arena::release(Arena *arena) {
+	if (NULL == arena) {
+		return;
+	}
+	arena->reset();
+	ArenaList *list = free_arenas.get();
+	if (NULL == list) {
+		list = new ArenaList();
+		free_arenas.reset(list);
+	}
+	if (list->arenas.size() >= MAX_FREE_ARENAS) {
+		delete arena;
+		return;
+	}
+	list->arenas.push_back(arena);
+}
+
+} // namespace fastcgi
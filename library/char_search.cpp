@@ -0,0 +1,190 @@
+#include "settings.h"
+
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define FASTCGI_X86_SIMD
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#include "details/char_search.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+typedef const char* (*FindFirstOfFunc)(const char*, const char*, char, char);
+typedef const char* (*FindStringFunc)(const char*, const char*, const char*, std::size_t);
+
+static const char*
+findFirstOfScalar(const char *begin, const char *end, char c1, char c2) {
+	for (; begin != end; ++begin) {
+		if (c1 == *begin || c2 == *begin) {
+			break;
+		}
+	}
+	return begin;
+}
+
+/* callers guarantee 2 <= len <= end - begin */
+static const char*
+findStringScalar(const char *begin, const char *end, const char *str, std::size_t len) {
+	const char *last = end - len + 1;
+	while (begin < last) {
+		begin = static_cast<const char*>(memchr(begin, str[0], last - begin));
+		if (NULL == begin) {
+			return end;
+		}
+		if (0 == memcmp(begin + 1, str + 1, len - 1)) {
+			return begin;
+		}
+		++begin;
+	}
+	return end;
+}
+
+#ifdef FASTCGI_X86_SIMD
+
+static const char*
+findFirstOfSSE2(const char *begin, const char *end, char c1, char c2) {
+	const __m128i v1 = _mm_set1_epi8(c1), v2 = _mm_set1_epi8(c2);
+	for (; end - begin >= 16; begin += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, v1), _mm_cmpeq_epi8(chunk, v2)));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findFirstOfScalar(begin, end, c1, c2);
+}
+
+__attribute__((target("avx2"))) static const char*
+findFirstOfAVX2(const char *begin, const char *end, char c1, char c2) {
+	const __m256i v1 = _mm256_set1_epi8(c1), v2 = _mm256_set1_epi8(c2);
+	for (; end - begin >= 32; begin += 32) {
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		unsigned int mask = _mm256_movemask_epi8(
+			_mm256_or_si256(_mm256_cmpeq_epi8(chunk, v1), _mm256_cmpeq_epi8(chunk, v2)));
+		if (mask) {
+			return begin + __builtin_ctz(mask);
+		}
+	}
+	return findFirstOfSSE2(begin, end, c1, c2);
+}
+
+/*
+ * Candidates are positions where both first and last bytes of the string match,
+ * they are compared in full only after that. Block at begin is checked
+ * together with the block at begin + len - 1, both stay inside [begin, end).
+ */
+static const char*
+findStringSSE2(const char *begin, const char *end, const char *str, std::size_t len) {
+	const __m128i first = _mm_set1_epi8(str[0]), last = _mm_set1_epi8(str[len - 1]);
+	const char *limit = end - len + 1;
+	for (; limit - begin >= 16; begin += 16) {
+		__m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+		__m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin + len - 1));
+		unsigned int mask = _mm_movemask_epi8(
+			_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+		while (mask) {
+			const char *pos = begin + __builtin_ctz(mask);
+			if (0 == memcmp(pos + 1, str + 1, len - 2)) {
+				return pos;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return findStringScalar(begin, end, str, len);
+}
+
+__attribute__((target("avx2"))) static const char*
+findStringAVX2(const char *begin, const char *end, const char *str, std::size_t len) {
+	const __m256i first = _mm256_set1_epi8(str[0]), last = _mm256_set1_epi8(str[len - 1]);
+	const char *limit = end - len + 1;
+	for (; limit - begin >= 32; begin += 32) {
+		__m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+		__m256i tail = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin + len - 1));
+		unsigned int mask = _mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+		while (mask) {
+			const char *pos = begin + __builtin_ctz(mask);
+			if (0 == memcmp(pos + 1, str + 1, len - 2)) {
+				return pos;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return findStringSSE2(begin, end, str, len);
+}
+
+static bool
+hasAVX2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+static FindFirstOfFunc
+selectFindFirstOf() {
+#ifdef FASTCGI_X86_SIMD
+	return hasAVX2() ? &findFirstOfAVX2 : &findFirstOfSSE2;
+#else
+	return &findFirstOfScalar;
+#endif
+}
+
+static FindStringFunc
+selectFindString() {
+#ifdef FASTCGI_X86_SIMD
+	return hasAVX2() ? &findStringAVX2 : &findStringSSE2;
+#else
+	return &findStringScalar;
+#endif
+}
+
+static const FindFirstOfFunc find_first_of = selectFindFirstOf();
+static const FindStringFunc find_string = selectFindString();
+
+const char*
+CharSearch::find(const char *begin, const char *end, char c) {
+	if (begin == end) {
+		return end;
+	}
+	const char *pos = static_cast<const char*>(memchr(begin, c, end - begin));
+	return pos ? pos : end;
+}
+
+const char*
+CharSearch::findFirstOf(const char *begin, const char *end, char c1, char c2) {
+	return (find_first_of ? find_first_of : selectFindFirstOf())(begin, end, c1, c2);
+}
+
+const char*
+CharSearch::findString(const char *begin, const char *end, const char *str, std::size_t len) {
+	if (0 == len) {
+		return begin;
+	}
+	if (static_cast<std::size_t>(end - begin) < len) {
+		return end;
+	}
+	if (1 == len) {
+		return find(begin, end, str[0]);
+	}
+	return (find_string ? find_string : selectFindString())(begin, end, str, len);
+}
+
+const char*
+CharSearch::implementation() {
+#ifdef FASTCGI_X86_SIMD
+	return hasAVX2() ? "avx2" : "sse2";
+#else
+	return "scalar";
+#endif
+}
+
+} // namespace fastcgi
@@ -1,10 +1,12 @@
 #include "settings.h"
 
+#include <algorithm>
 #include <stdexcept>
 
 #include "fastcgi2/data_buffer.h"
 #include "fastcgi2/util.h"
 
+#include "details/char_search.h"
 #include "details/data_buffer_impl.h"
 #include "details/string_buffer.h"
 
@@ -70,6 +72,18 @@ DataBuffer::write(boost::uint64_t pos, const char *data, boost::uint64_t len) {
 	return data_->write(pos + begin_, data, std::min(end_ - begin_ - pos, len));
 }
 
+boost::uint64_t
+DataBuffer::writev(boost::uint64_t pos, const struct iovec *iov, int count) {
+	boost::uint64_t len = 0;
+	for (int i = 0; i < count; ++i) {
+		len += iov[i].iov_len;
+	}
+	if (pos > end_ - begin_ || len > end_ - begin_ - pos) {
+		throw std::out_of_range("Incorrect index");
+	}
+	return data_->writev(pos + begin_, iov, count);
+}
+
 boost::uint64_t
 DataBuffer::endIndex() const {
 	return end_;
@@ -180,62 +194,117 @@ DataBuffer::split(char delim, DataBuffer &first, DataBuffer &second) const {
 	return true;
 }
 
-bool
-DataBuffer::startsWith(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	if (data_size > size()) {
-		return false;
+/*
+ * Finds all non-overlapping occurrences of delim in one pass over segments.
+ * Last delim.size() - 1 bytes of previous segments are kept aside to catch
+ * occurrences crossing segment border, segment memory itself is not valid
+ * after iterator is moved.
+ */
+void
+DataBuffer::findAll(const std::string &delim, std::vector<boost::uint64_t> &positions) const {
+	positions.clear();
+	const boost::uint64_t len = delim.size();
+	if (0 == len || len > size()) {
+		return;
 	}
-	for (boost::uint64_t i = 0; i < data_size; ++i) {
-		if (data[i] != at(i)) {
-			return false;
+	const char *str = delim.data();
+	std::vector<char> edge;
+	edge.reserve(2 * len);
+
+	boost::uint64_t offset = 0, next = 0;
+	for (SegmentIterator it = begin(), end; it != end; ++it) {
+		std::pair<char*, boost::uint64_t> chunk = *it;
+		const char *data = chunk.first, *data_end = data + chunk.second;
+
+		if (!edge.empty()) {
+			const boost::uint64_t edge_pos = offset - edge.size();
+			const boost::uint64_t carry = edge.size();
+			edge.insert(edge.end(), data, data + std::min(len - 1, chunk.second));
+			const char *e = &edge[0], *e_end = e + edge.size();
+			const char *pos = e + (next > edge_pos ? std::min(next - edge_pos, carry) : 0);
+			while (pos < e + carry) {
+				pos = CharSearch::findString(pos, e_end, str, len);
+				if (pos >= e + carry) {
+					break;
+				}
+				next = edge_pos + (pos - e) + len;
+				positions.push_back(next - len);
+				pos += len;
+			}
+			edge.resize(carry);
+		}
+
+		const char *pos = data + (next > offset ? std::min(next - offset, chunk.second) : 0);
+		while (pos < data_end) {
+			pos = CharSearch::findString(pos, data_end, str, len);
+			if (pos == data_end) {
+				break;
+			}
+			next = offset + (pos - data) + len;
+			positions.push_back(next - len);
+			pos += len;
+		}
+
+		if (chunk.second >= len - 1) {
+			edge.assign(data_end - (len - 1), data_end);
 		}
+		else {
+			edge.insert(edge.end(), data, data_end);
+			if (edge.size() > len - 1) {
+				edge.erase(edge.begin(), edge.end() - (len - 1));
+			}
+		}
+		offset += chunk.second;
 	}
-	return true;
 }
 
-bool
-DataBuffer::startsWithCI(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	if (data_size > size()) {
-		return false;
+int
+DataBuffer::compare(boost::uint64_t pos, const char *data, boost::uint64_t len) const {
+	if (pos > size() || len > size() - pos) {
+		throw std::out_of_range("Incorrect index");
 	}
-	for (boost::uint64_t i = 0; i < data_size; ++i) {
-		if (tolower(data[i]) != tolower(at(i))) {
-			return false;
+	return 0 == len ? 0 : data_->memcmpAt(begin_ + pos, data, len);
+}
+
+bool
+DataBuffer::matchCI(boost::uint64_t pos, const std::string &data) const {
+	char buffer[256];
+	const char *str = data.data();
+	boost::uint64_t left = data.size();
+	pos += begin_;
+	while (left > 0) {
+		boost::uint64_t len = std::min(left, static_cast<boost::uint64_t>(sizeof(buffer)));
+		data_->read(pos, buffer, len);
+		for (boost::uint64_t i = 0; i < len; ++i) {
+			if (tolower(str[i]) != tolower(buffer[i])) {
+				return false;
+			}
 		}
+		str += len;
+		pos += len;
+		left -= len;
 	}
 	return true;
 }
 
+bool
+DataBuffer::startsWith(const std::string &data) const {
+	return data.size() <= size() && 0 == compare(0, data.data(), data.size());
+}
+
+bool
+DataBuffer::startsWithCI(const std::string &data) const {
+	return data.size() <= size() && matchCI(0, data);
+}
+
 bool
 DataBuffer::endsWith(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	boost::uint64_t sz = size();
-	if (data_size > sz) {
-		return false;
-	}
-	for (boost::uint64_t i = 1; i <= data_size; ++i) {
-		if (data[data_size - i] != at(sz - i)) {
-			return false;
-		}
-	}
-	return true;
+	return data.size() <= size() && 0 == compare(size() - data.size(), data.data(), data.size());
 }
 
 bool
 DataBuffer::endsWithCI(const std::string &data) const {
-	boost::uint64_t data_size = data.size();
-	boost::uint64_t sz = size();
-	if (data_size > sz) {
-		return false;
-	}
-	for (boost::uint64_t i = 1; i <= data_size; ++i) {
-		if (tolower(data[data_size - i]) != tolower(at(sz - i))) {
-			return false;
-		}
-	}
-	return true;
+	return data.size() <= size() && matchCI(size() - data.size(), data);
 }
 
 DataBuffer::SegmentIterator
@@ -271,7 +340,10 @@ DataBuffer::SegmentIterator::SegmentIterator(const DataBuffer &buffer) :
 		pos_end_ = 0;
 		return;
 	}
-	buffer_.data_ = boost::shared_ptr<DataBufferImpl>(buffer.data_->getCopy());
+	if (!buffer_.data_->stableChunks()) {
+		/* windowed file mapping is private to iterator, other users of buffer may move it */
+		buffer_.data_ = boost::shared_ptr<DataBufferImpl>(buffer.data_->getCopy());
+	}
 	std::pair<boost::uint64_t, boost::uint64_t> segment = buffer_.data_->segment(pos_begin_);
 	pos_end_ = std::min(segment.second, buffer_.end_);
 }
@@ -95,6 +95,20 @@ Globals::joinThreadPools() {
 	}
 }
 
+static ThreadPoolScheduler
+getScheduler(const std::string &name) {
+	if ("shared-queue" == name) {
+		return SCHEDULER_SHARED_QUEUE;
+	}
+	else if ("lock-free" == name) {
+		return SCHEDULER_LOCK_FREE;
+	}
+	else if ("work-stealing" == name) {
+		return SCHEDULER_WORK_STEALING;
+	}
+	throw std::runtime_error("unknown pool scheduler: " + name);
+}
+
 void
 Globals::initPools() {
 	std::set<std::string> poolsNeeded = handlerSet_->getPoolsNeeded();
@@ -106,6 +120,7 @@ Globals::initPools() {
         const std::string poolName = config_->asString(*p + "/@name");
         const int threadsNumber = config_->asInt(*p + "/@threads");
         const int queueLength = config_->asInt(*p + "/@queue");
+        const ThreadPoolScheduler scheduler = getScheduler(config_->asString(*p + "/@scheduler", "shared-queue"));
 
 		maxTasksInProcessCounter += (threadsNumber + queueLength);
 		if (maxTasksInProcessCounter > 65535) {
@@ -121,7 +136,7 @@ Globals::initPools() {
 		}
 
 		pools_.insert(make_pair(poolName, boost::shared_ptr<RequestsThreadPool>(
-			new RequestsThreadPool(threadsNumber, queueLength, logger_))));
+			new RequestsThreadPool(threadsNumber, queueLength, scheduler, logger_))));
     }
 
     for (std::set<std::string>::const_iterator i = poolsNeeded.begin(); i != poolsNeeded.end(); ++i) {
@@ -12,6 +12,20 @@ namespace fastcgi
 
 HandlerContext::~HandlerContext() {
 }
+
+Arena*
+HandlerContext::arena() const {
+	return NULL;
+}
+
+HandlerContextImpl::HandlerContextImpl(Arena *arena) :
+	arena_(arena), params_(std::less<std::string>(), ParamsMapType::allocator_type(arena))
+{}
+
+Arena*
+HandlerContextImpl::arena() const {
+	return arena_;
+}
 	
 boost::any HandlerContextImpl::getParam(const std::string &name) const {
 	ParamsMapType::const_iterator itr = params_.find(name);
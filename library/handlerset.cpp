@@ -1,5 +1,7 @@
 #include "settings.h"
 
+#include <algorithm>
+
 #include <boost/lexical_cast.hpp>
 
 #include "details/handlerset.h"
@@ -18,8 +20,12 @@
 namespace fastcgi
 {
 
-HandlerSet::HandlerSet() {
-}
+static const unsigned int ROUTE_CACHE_SHARDS = 16;
+
+HandlerSet::HandlerSet() :
+    streaming_body_(false), first_param_handler_(0),
+    route_cache_fields_(0), route_cache_shard_capacity_(0)
+{}
 
 HandlerSet::~HandlerSet() {
 }
@@ -33,29 +39,30 @@ HandlerSet::init(const Config *config, const ComponentSet *componentSet) {
         HandlerDescription handlerDesc;
         handlerDesc.poolName = config->asString(*k + "/@pool");
         handlerDesc.id = config->asString(*k + "/@id", "");
+        handlerDesc.streamingBody = ("yes" == config->asString(*k + "/@streaming-body", "no"));
 
         std::string url_filter = config->asString(*k + "/@url", "");
         if (!url_filter.empty()) {
               handlerDesc.filters.push_back(std::make_pair(
-                  "url", boost::shared_ptr<RequestFilter>(new UrlFilter(url_filter))));
+                  FILTER_URL, boost::shared_ptr<RequestFilter>(new UrlFilter(url_filter))));
         }
 
         std::string host_filter = config->asString(*k + "/@host", "");
         if (!host_filter.empty()) {
               handlerDesc.filters.push_back(std::make_pair(
-                  "host", boost::shared_ptr<RequestFilter>(new HostFilter(host_filter))));
+                  FILTER_HOST, boost::shared_ptr<RequestFilter>(new HostFilter(host_filter))));
         }
 
         std::string port_filter = config->asString(*k + "/@port", "");
         if (!port_filter.empty()) {
               handlerDesc.filters.push_back(std::make_pair(
-                  "port", boost::shared_ptr<RequestFilter>(new PortFilter(port_filter))));
+                  FILTER_PORT, boost::shared_ptr<RequestFilter>(new PortFilter(port_filter))));
         }
 
         std::string address_filter = config->asString(*k + "/@address", "");
         if (!address_filter.empty()) {
               handlerDesc.filters.push_back(std::make_pair(
-                  "address", boost::shared_ptr<RequestFilter>(new AddressFilter(address_filter))));
+                  FILTER_ADDRESS, boost::shared_ptr<RequestFilter>(new AddressFilter(address_filter))));
         }
 
         std::vector<std::string> q;
@@ -70,7 +77,7 @@ HandlerSet::init(const Config *config, const ComponentSet *componentSet) {
                 continue;
             }
             handlerDesc.filters.push_back(std::make_pair(
-                "param", boost::shared_ptr<RequestFilter>(new ParamFilter(name, value))));
+                FILTER_PARAM, boost::shared_ptr<RequestFilter>(new ParamFilter(name, value))));
         }
 
         std::vector<std::string> components;
@@ -91,42 +98,262 @@ HandlerSet::init(const Config *config, const ComponentSet *componentSet) {
         }
         handlers_.push_back(handlerDesc);
     }
+    compileRoutes();
+
+    streaming_body_ = false;
+    first_param_handler_ = handlers_.size();
+    for (unsigned int index = 0; index < handlers_.size(); ++index) {
+        streaming_body_ = streaming_body_ || handlers_[index].streamingBody;
+        const HandlerDescription::FilterArray &filters = handlers_[index].filters;
+        for (HandlerDescription::FilterArray::const_iterator f = filters.begin(); f != filters.end(); ++f) {
+            if (FILTER_PARAM == f->first) {
+                first_param_handler_ = std::min(first_param_handler_, index);
+            }
+        }
+    }
+
+    int cacheSize = config->asInt("/fastcgi/handlers/@route-cache-size", 0);
+    route_cache_.clear();
+    route_cache_fields_ = 0;
+    if (cacheSize > 0) {
+        route_cache_shard_capacity_ = (cacheSize + ROUTE_CACHE_SHARDS - 1) / ROUTE_CACHE_SHARDS;
+        for (unsigned int i = 0; i < ROUTE_CACHE_SHARDS; ++i) {
+            route_cache_.push_back(boost::shared_ptr<RouteCacheShard>(new RouteCacheShard()));
+        }
+        for (HandlerArray::const_iterator h = handlers_.begin(); h != handlers_.end(); ++h) {
+            for (HandlerDescription::FilterArray::const_iterator f = h->filters.begin(); f != h->filters.end(); ++f) {
+                if (FILTER_PARAM != f->first) {
+                    route_cache_fields_ |= 1 << f->first;
+                }
+            }
+        }
+    }
 }
 
-const HandlerSet::HandlerDescription*
-HandlerSet::findURIHandler(const Request *request) const {
-    for (HandlerArray::const_iterator i = handlers_.begin(); i != handlers_.end(); ++i) {
-        bool matched = true;
-        for (HandlerDescription::FilterArray::const_iterator f = i->filters.begin();
-             f != i->filters.end();
-             ++f) {
-            if (f->first == "url" && !f->second->check(request)) {
-                matched = false;
-                break;
+void
+HandlerSet::compileRoutes() {
+    urls_.clear();
+    hosts_.clear();
+    ports_.clear();
+    unindexed_.clear();
+    url_prefixes_.assign(1, RouteTrieNode());
+
+    /* handlers are added in ascending order, so every index list is sorted once here */
+    for (unsigned int index = 0; index < handlers_.size(); ++index) {
+        const HandlerDescription::FilterArray &filters = handlers_[index].filters;
+        const RegexFilter *url = NULL, *host = NULL, *port = NULL;
+        for (HandlerDescription::FilterArray::const_iterator f = filters.begin(); f != filters.end(); ++f) {
+            const RegexFilter &regex = f->second->regex();
+            if (RegexFilter::MATCH_REGEX == regex.matchType()) {
+                continue;
             }
-            else if (f->first == "host" && !f->second->check(request)) {
-                matched = false;
-                break;
+            if (FILTER_URL == f->first) {
+                url = &regex;
             }
-            else if (f->first == "address" && !f->second->check(request)) {
-                matched = false;
-                break;
+            else if (FILTER_HOST == f->first && RegexFilter::MATCH_EXACT == regex.matchType()) {
+                host = &regex;
             }
-            else if (f->first == "port" && !f->second->check(request)) {
-                matched = false;
+            else if (FILTER_PORT == f->first && RegexFilter::MATCH_EXACT == regex.matchType()) {
+                port = &regex;
+            }
+        }
+
+        if (url && RegexFilter::MATCH_EXACT == url->matchType()) {
+            urls_[url->literal()].push_back(index);
+        }
+        else if (url) {
+            addPrefixRoute(url->literal(), index);
+        }
+        else if (host) {
+            hosts_[host->literal()].push_back(index);
+        }
+        else if (port) {
+            ports_[port->literal()].push_back(index);
+        }
+        else {
+            unindexed_.push_back(index);
+        }
+    }
+}
+
+void
+HandlerSet::addPrefixRoute(const std::string &prefix, unsigned int index) {
+    unsigned int node = 0;
+    for (std::string::const_iterator i = prefix.begin(), end = prefix.end(); i != end; ++i) {
+        std::map<char, unsigned int>::iterator child = url_prefixes_[node].children.find(*i);
+        if (url_prefixes_[node].children.end() == child) {
+            unsigned int next = url_prefixes_.size();
+            url_prefixes_[node].children.insert(std::make_pair(*i, next));
+            url_prefixes_.push_back(RouteTrieNode());
+            node = next;
+        }
+        else {
+            node = child->second;
+        }
+    }
+    url_prefixes_[node].handlers.push_back(index);
+}
+
+void
+HandlerSet::addRoutes(const RouteMap &routes, const std::string &key, HandlerIndexList &candidates) {
+    RouteMap::const_iterator it = routes.find(key);
+    if (routes.end() != it) {
+        candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+    }
+}
+
+bool
+HandlerSet::matches(const HandlerDescription &handler, const Request *request, bool &paramsChecked) {
+    bool hasParams = false;
+    for (HandlerDescription::FilterArray::const_iterator f = handler.filters.begin();
+         f != handler.filters.end();
+         ++f) {
+        if (FILTER_PARAM == f->first) {
+            hasParams = true;
+        }
+        else if (!f->second->check(request)) {
+            return false;
+        }
+    }
+    if (!hasParams) {
+        return true;
+    }
+
+    paramsChecked = true;
+    for (HandlerDescription::FilterArray::const_iterator f = handler.filters.begin();
+         f != handler.filters.end();
+         ++f) {
+        if (FILTER_PARAM == f->first && !f->second->check(request)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const HandlerSet::HandlerDescription*
+HandlerSet::findURIHandler(const Request *request) const {
+    bool cacheable = true;
+    if (route_cache_.empty()) {
+        int index = findRoute(request, cacheable);
+        return index < 0 ? NULL : &handlers_[index];
+    }
+
+    std::string key = routeCacheKey(request);
+    RouteCacheShard &shard = routeCacheShard(key);
+    {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        RouteCacheMap::iterator it = shard.routes.find(key);
+        if (shard.routes.end() != it) {
+            ++shard.hits;
+            return it->second < 0 ? NULL : &handlers_[it->second];
+        }
+        ++shard.misses;
+    }
+
+    int index = findRoute(request, cacheable);
+    if (cacheable) {
+        boost::mutex::scoped_lock lock(shard.mutex);
+        if (shard.routes.size() >= route_cache_shard_capacity_) {
+            shard.routes.clear();
+        }
+        shard.routes.insert(std::make_pair(key, index));
+    }
+    return index < 0 ? NULL : &handlers_[index];
+}
+
+std::string
+HandlerSet::routeCacheKey(const Request *request) const {
+    std::string key;
+    if (route_cache_fields_ & (1 << FILTER_URL)) {
+        key.append(request->getScriptName()).push_back('\0');
+    }
+    if (route_cache_fields_ & (1 << FILTER_HOST)) {
+        key.append(request->getHost()).push_back('\0');
+    }
+    if (route_cache_fields_ & (1 << FILTER_PORT)) {
+        key.append(boost::lexical_cast<std::string>(request->getServerPort())).push_back('\0');
+    }
+    if (route_cache_fields_ & (1 << FILTER_ADDRESS)) {
+        key.append(request->getServerAddr()).push_back('\0');
+    }
+    return key;
+}
+
+HandlerSet::RouteCacheShard&
+HandlerSet::routeCacheShard(const std::string &key) const {
+    return *route_cache_[StringHash()(key) % route_cache_.size()];
+}
+
+bool
+HandlerSet::hasStreamingBody() const {
+    return streaming_body_;
+}
+
+bool
+HandlerSet::isStreamingBody(const HandlerDescription *handler) const {
+    return NULL != handler && handler->streamingBody &&
+        static_cast<unsigned int>(handler - &handlers_[0]) <= first_param_handler_;
+}
+
+RouteCacheInfo
+HandlerSet::getRouteCacheInfo() const {
+    RouteCacheInfo info;
+    info.size = info.hits = info.misses = 0;
+    info.capacity = route_cache_shard_capacity_ * route_cache_.size();
+    for (std::vector<boost::shared_ptr<RouteCacheShard> >::const_iterator i = route_cache_.begin();
+         i != route_cache_.end();
+         ++i) {
+        boost::mutex::scoped_lock lock((*i)->mutex);
+        info.size += (*i)->routes.size();
+        info.hits += (*i)->hits;
+        info.misses += (*i)->misses;
+    }
+    return info;
+}
+
+int
+HandlerSet::findRoute(const Request *request, bool &cacheable) const {
+    HandlerIndexList candidates;
+
+    if (!urls_.empty() || url_prefixes_.size() > 1 || !url_prefixes_[0].handlers.empty()) {
+        const std::string &url = request->getScriptName();
+        addRoutes(urls_, url, candidates);
+
+        unsigned int node = 0;
+        std::string::const_iterator i = url.begin(), end = url.end();
+        while (true) {
+            const RouteTrieNode &current = url_prefixes_[node];
+            candidates.insert(candidates.end(), current.handlers.begin(), current.handlers.end());
+            if (end == i) {
                 break;
             }
-            else if (f->first == "param" && !f->second->check(request)) {
-                matched = false;
+            std::map<char, unsigned int>::const_iterator child = current.children.find(*i++);
+            if (current.children.end() == child) {
                 break;
             }
+            node = child->second;
         }
+    }
+    if (!hosts_.empty()) {
+        addRoutes(hosts_, request->getHost(), candidates);
+    }
+    if (!ports_.empty()) {
+        addRoutes(ports_, boost::lexical_cast<std::string>(request->getServerPort()), candidates);
+    }
 
-        if (matched) {
-            return &(*i);
+    /* few indexed hits are sorted and merged with already sorted unindexed handlers */
+    std::sort(candidates.begin(), candidates.end());
+    bool paramsChecked = false;
+    HandlerIndexList::const_iterator u = unindexed_.begin(), c = candidates.begin();
+    while (unindexed_.end() != u || candidates.end() != c) {
+        unsigned int index = (candidates.end() == c || (unindexed_.end() != u && *u < *c)) ? *u++ : *c++;
+        if (matches(handlers_[index], request, paramsChecked)) {
+            cacheable = !paramsChecked;
+            return index;
         }
     }
-    return NULL;
+    cacheable = !paramsChecked;
+    return -1;
 }
 
 void
@@ -0,0 +1,236 @@
+#include "settings.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "fastcgi2/multipart_handler.h"
+#include "details/multipart_parser.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const std::size_t MAX_LINE_SIZE = 16384;
+
+static const Range CONTENT_DISPOSITION_RANGE = Range::fromChars("content-disposition");
+static const Range CONTENT_TYPE_RANGE = Range::fromChars("content-type");
+static const Range NAME_RANGE = Range::fromChars("name");
+static const Range FILENAME_RANGE = Range::fromChars("filename");
+
+static bool
+equalsCI(const Range &lhs, const Range &rhs) {
+	return lhs.size() == rhs.size() && 0 == strncasecmp(lhs.begin(), rhs.begin(), lhs.size());
+}
+
+static std::string
+unquote(const Range &range) {
+	Range value = range.trim();
+	if (value.size() >= 2 && '"' == value[0] && '"' == value[value.size() - 1]) {
+		value = value.trimn(1, 1);
+	}
+	return value.toString();
+}
+
+MultipartHandler::~MultipartHandler() {
+}
+
+MultipartParser::MultipartParser(const std::string &boundary, MultipartHandler *handler) :
+	state_(PREAMBLE), boundary_(boundary), delimiter_("\n" + boundary), buffer_("\n"), pos_(0), consumed_(0), handler_(handler)
+{
+	if (boundary_.empty()) {
+		throw std::runtime_error("empty multipart boundary");
+	}
+}
+
+MultipartParser::~MultipartParser() {
+}
+
+bool
+MultipartParser::finished() const {
+	return EPILOGUE == state_;
+}
+
+/* position in body of the first byte not consumed yet, buffer starts with extra \n */
+boost::uint64_t
+MultipartParser::offset() const {
+	return consumed_ > 0 ? consumed_ - 1 : 0;
+}
+
+void
+MultipartParser::feed(const char *data, std::size_t size) {
+	if (EPILOGUE == state_) {
+		return;
+	}
+	buffer_.append(data, size);
+
+	bool progress = true;
+	while (progress) {
+		switch (state_) {
+		case PREAMBLE:
+			progress = parsePreamble();
+			break;
+		case BOUNDARY_LINE:
+			progress = parseBoundaryLine();
+			break;
+		case HEADERS:
+			progress = parseHeaderLine();
+			break;
+		case DATA:
+			progress = parseData();
+			break;
+		default:
+			progress = false;
+			break;
+		}
+	}
+
+	buffer_.erase(0, pos_);
+	pos_ = 0;
+}
+
+void
+MultipartParser::finish() {
+	if (EPILOGUE != state_) {
+		throw std::runtime_error("malformed multipart message");
+	}
+}
+
+bool
+MultipartParser::parsePreamble() {
+	Range avail(buffer_.data() + pos_, buffer_.data() + buffer_.size());
+	const char *res = avail.find(Range::fromString(delimiter_));
+	if (avail.end() == res) {
+		if (avail.size() > delimiter_.size()) {
+			consume(avail.size() - delimiter_.size());
+		}
+		return false;
+	}
+	consume(res - avail.begin() + delimiter_.size());
+	state_ = BOUNDARY_LINE;
+	return true;
+}
+
+bool
+MultipartParser::parseBoundaryLine() {
+	Range avail(buffer_.data() + pos_, buffer_.data() + buffer_.size());
+	if (avail.size() >= 2 && '-' == avail[0] && '-' == avail[1]) {
+		consume(avail.size());
+		state_ = EPILOGUE;
+		return false;
+	}
+	const char *res = avail.find('\n');
+	if (avail.end() == res) {
+		if (avail.size() > MAX_LINE_SIZE) {
+			throw std::runtime_error("malformed multipart message");
+		}
+		return false;
+	}
+	consume(res - avail.begin() + 1);
+	name_.clear();
+	filename_.clear();
+	type_.clear();
+	header_.clear();
+	state_ = HEADERS;
+	return true;
+}
+
+bool
+MultipartParser::parseHeaderLine() {
+	Range avail(buffer_.data() + pos_, buffer_.data() + buffer_.size());
+	const char *res = avail.find('\n');
+	if (avail.end() == res) {
+		if (avail.size() + header_.size() > MAX_LINE_SIZE) {
+			throw std::runtime_error("too long multipart header");
+		}
+		return false;
+	}
+	consume(res - avail.begin() + 1);
+	Range line(avail.begin(), res);
+	if (!line.empty() && '\r' == line[line.size() - 1]) {
+		line = line.trimn(0, 1);
+	}
+	if (line.empty()) {
+		parseHeader(Range::fromString(header_));
+		header_.clear();
+		handler_->onPartBegin(name_, filename_, type_);
+		state_ = DATA;
+	}
+	else if (' ' == line[0] || '\t' == line[0]) {
+		if (header_.size() + line.size() > MAX_LINE_SIZE) {
+			throw std::runtime_error("too long multipart header");
+		}
+		header_.append(line.begin(), line.end());
+	}
+	else {
+		parseHeader(Range::fromString(header_));
+		header_.assign(line.begin(), line.end());
+	}
+	return true;
+}
+
+bool
+MultipartParser::parseData() {
+	Range avail(buffer_.data() + pos_, buffer_.data() + buffer_.size());
+	const char *res = avail.find(Range::fromString(delimiter_));
+	if (avail.end() == res) {
+		std::size_t keep = delimiter_.size() + 1;
+		if (avail.size() > keep) {
+			handler_->onPartData(avail.begin(), avail.size() - keep);
+			consume(avail.size() - keep);
+		}
+		return false;
+	}
+
+	const char *end = res;
+	if (end != avail.begin() && '\r' == *(end - 1)) {
+		--end;
+	}
+	if (end != avail.begin()) {
+		handler_->onPartData(avail.begin(), end - avail.begin());
+	}
+	handler_->onPartEnd();
+	consume(res - avail.begin() + delimiter_.size());
+	state_ = BOUNDARY_LINE;
+	return true;
+}
+
+void
+MultipartParser::parseHeader(const Range &line) {
+	Range key, value;
+	if (!line.split(':', key, value)) {
+		return;
+	}
+	key = key.trim();
+	if (equalsCI(key, CONTENT_TYPE_RANGE)) {
+		type_ = value.trim().toString();
+		return;
+	}
+	if (!equalsCI(key, CONTENT_DISPOSITION_RANGE)) {
+		return;
+	}
+	while (!value.empty()) {
+		Range head, tail, name, param;
+		value.split(';', head, tail);
+		if (head.split('=', name, param)) {
+			name = name.trim();
+			if (equalsCI(name, NAME_RANGE)) {
+				name_ = unquote(param);
+			}
+			else if (equalsCI(name, FILENAME_RANGE)) {
+				filename_ = unquote(param);
+			}
+		}
+		value = tail;
+	}
+}
+
+void
+MultipartParser::consume(std::size_t size) {
+	pos_ += size;
+	consumed_ += size;
+}
+
+} // namespace fastcgi
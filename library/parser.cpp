@@ -88,7 +88,7 @@ Parser::getBoundary(const Range &range) {
 }
 
 void
-Parser::addCookie(RequestImpl *req, const Range &range) {
+Parser::addCookie(const RequestImpl *req, const Range &range) {
 	Range tmp = range.trim(), head, tail;
 	tmp.split('=', head, tail);
 	if (!head.empty()) {
@@ -97,34 +97,42 @@ Parser::addCookie(RequestImpl *req, const Range &range) {
 }
 
 void
-Parser::addHeader(RequestImpl *req, const Range &key, const Range &value) {
-	req->headers_[normalizeInputHeaderName(key)] = value.toString();
+Parser::addHeader(const RequestImpl *req, const Range &key, const Range &value) {
+	req->setInputHeader(normalizeInputHeaderName(key), value.toString());
 }
 
 void
 Parser::parse(RequestImpl *req, char *env[], Logger* logger) {
+	bool debug = Logger::DEBUG == logger->getLevel();
 	for (int i = 0; NULL != env[i]; ++i) {
-		logger->debug("env[%d] = %s", i, env[i]);
+		if (debug) {
+			logger->debug("env[%d] = %s", i, env[i]);
+		}
 		Range key, value;
 		Range::fromChars(env[i]).split('=', key, value);
-		if (COOKIE_RANGE == key) {
-			parseCookies(req, value);
-			addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
-		}
-		else if (CONTENT_TYPE_RANGE == key) {
-			addHeader(req, key, value.trim());
-		}
-		else if (key.startsWith(HEADER_RANGE)) {
-			addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
-		}
-		else {
-			req->vars_[key.toString()] = value.toString();
-		}
+		req->addEnv(key, value);
 	}
 }
 
 void
-Parser::parseCookies(RequestImpl *req, const Range &range) {
+Parser::addVariable(const RequestImpl *req, const Range &key, const Range &value) {
+	if (COOKIE_RANGE == key) {
+		parseCookies(req, value);
+		addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
+	}
+	else if (CONTENT_TYPE_RANGE == key) {
+		addHeader(req, key, value.trim());
+	}
+	else if (key.startsWith(HEADER_RANGE)) {
+		addHeader(req, key.trimn(HEADER_RANGE.size(), 0), value.trim());
+	}
+	else {
+		req->setVar(key.toString(), value.toString());
+	}
+}
+
+void
+Parser::parseCookies(const RequestImpl *req, const Range &range) {
 	Range tmp = range.trim(), delim = Range::fromChars("; ");
 	while (!tmp.empty()) {
 		Range head, tail;
@@ -215,35 +223,44 @@ Parser::parsePart(RequestImpl *req, DataBuffer part) {
 
 void
 Parser::parseMultipart(RequestImpl *req, DataBuffer data, const std::string &boundary) {
-	DataBuffer head, tail;
-	while (!data.empty()) {
-		if (data.split(boundary, head, tail) && !head.empty()) {
-			if (head.endsWith(RETURN_RN_STRING)) {
-				head = head.trimn(0, 2);
-			}
-			else if (head.endsWith(RETURN_N_STRING)) {
-				head = head.trimn(0, 1);
-			}
-			else {
-				throw std::runtime_error("malformed multipart message");
-			}
-			if (head.size() == 2 && head.startsWith(MINUS_PREFIX_STRING)) {
-				continue;
-			}
-			else if (head.startsWith(RETURN_RN_STRING)) {
-				head = head.trimn(2, 0);
-			}
-			else if (head.startsWith(RETURN_N_STRING)) {
-				head = head.trimn(1, 0);
-			}
-			else {
-				throw std::runtime_error("malformed multipart message");
-			}
+	std::vector<boost::uint64_t> positions;
+	data.findAll(boundary, positions);
+
+	const boost::uint64_t base = data.beginIndex();
+	boost::uint64_t pos = 0;
+	for (std::vector<boost::uint64_t>::const_iterator it = positions.begin(), end = positions.end(); it != end; ++it) {
+		DataBuffer head(data, base + pos, base + *it);
+		pos = *it + boundary.size();
+		if (head.empty()) {
+			continue;
+		}
+		if (head.endsWith(RETURN_RN_STRING)) {
+			head = head.trimn(0, 2);
+		}
+		else if (head.endsWith(RETURN_N_STRING)) {
+			head = head.trimn(0, 1);
+		}
+		else {
+			throw std::runtime_error("malformed multipart message");
+		}
+		if (head.size() == 2 && head.startsWith(MINUS_PREFIX_STRING)) {
+			continue;
+		}
+		else if (head.startsWith(RETURN_RN_STRING)) {
+			head = head.trimn(2, 0);
+		}
+		else if (head.startsWith(RETURN_N_STRING)) {
+			head = head.trimn(1, 0);
+		}
+		else {
+			throw std::runtime_error("malformed multipart message");
 		}
 		if (!head.empty()) {
 			parsePart(req, head);
 		}
-		data = tail;
+	}
+	if (pos < data.size()) {
+		parsePart(req, DataBuffer(data, base + pos, data.endIndex()));
 	}
 }
 
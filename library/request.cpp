@@ -238,6 +238,16 @@ Request::write(const char *buf, std::streamsize size) {
     return impl_->write(buf, size);
 }
 
+void
+Request::write(const DataBuffer &buffer) {
+    impl_->write(buffer);
+}
+
+void
+Request::writeFile(int fd, boost::uint64_t offset, boost::uint64_t length) {
+    impl_->writeFile(fd, offset, length);
+}
+
 std::string
 Request::outputHeader(const std::string &name) const {
     return impl_->outputHeader(name);
@@ -248,6 +258,11 @@ Request::reset() {
     impl_->reset();
 }
 
+void
+Request::saveToCache() {
+    impl_->saveToCache(this);
+}
+
 void
 Request::sendHeaders() {
     impl_->sendHeaders();
@@ -258,6 +273,31 @@ Request::attach(RequestIOStream *stream, char *env[]) {
     impl_->attach(stream, env);
 }
 
+void
+Request::attachHeaders(RequestIOStream *stream, char *env[]) {
+    impl_->attachHeaders(stream, env);
+}
+
+void
+Request::attachBody() {
+    impl_->attachBody();
+}
+
+bool
+Request::isBodyPending() const {
+    return impl_->isBodyPending();
+}
+
+std::streamsize
+Request::readBody(char *buf, std::streamsize size) {
+    return impl_->readBody(buf, size);
+}
+
+void
+Request::readMultipart(MultipartHandler *handler) {
+    impl_->readMultipart(handler);
+}
+
 bool
 Request::isProcessed() const {
     return impl_->isProcessed();
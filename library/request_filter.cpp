@@ -2,6 +2,8 @@
 
 #include "details/request_filter.h"
 
+#include <cctype>
+
 #include <boost/lexical_cast.hpp>
 
 #include "fastcgi2/request.h"
@@ -13,18 +15,101 @@
 namespace fastcgi
 {
 
-RegexFilter::RegexFilter(const std::string &regex) : regex_(regex)
-{}
+static const std::string REGEX_SPECIAL_CHARS = ".[]{}()*+?|^$\\";
+
+static bool
+isEscaped(const std::string &regex, std::string::size_type pos) {
+    std::string::size_type count = 0;
+    while (pos > count && '\\' == regex[pos - count - 1]) {
+        ++count;
+    }
+    return count % 2;
+}
+
+static bool
+parseLiteral(const std::string &regex, std::string::size_type begin, std::string::size_type end,
+    std::string &literal) {
+
+    literal.clear();
+    literal.reserve(end - begin);
+    for (std::string::size_type i = begin; i < end; ++i) {
+        char c = regex[i];
+        if ('\\' == c) {
+            if (i + 1 >= end || isalnum(regex[i + 1])) {
+                return false;
+            }
+            literal.push_back(regex[++i]);
+        }
+        else if (std::string::npos != REGEX_SPECIAL_CHARS.find(c)) {
+            return false;
+        }
+        else {
+            literal.push_back(c);
+        }
+    }
+    return true;
+}
+
+RegexFilter::RegexFilter(const std::string &regex) :
+    type_(MATCH_REGEX), regex_(regex)
+{
+    std::string::size_type begin = 0, end = regex.size();
+    if (begin < end && '^' == regex[begin]) {
+        ++begin;
+    }
+    if (end > begin && '$' == regex[end - 1] && !isEscaped(regex, end - 1)) {
+        --end;
+    }
+
+    if (parseLiteral(regex, begin, end, literal_)) {
+        type_ = MATCH_EXACT;
+    }
+    else if (end - begin >= 2 && '*' == regex[end - 1] && '.' == regex[end - 2] && !isEscaped(regex, end - 2) &&
+        parseLiteral(regex, begin, end - 2, literal_)) {
+        type_ = MATCH_PREFIX;
+    }
+    else {
+        literal_.clear();
+    }
+}
 
 RegexFilter::~RegexFilter()
 {}
 
 bool
 RegexFilter::check(const std::string &value) const {
-    return boost::regex_match(value, regex_);
+    switch (type_) {
+    case MATCH_EXACT:
+        return value == literal_;
+    case MATCH_PREFIX:
+        return 0 == value.compare(0, literal_.size(), literal_);
+    default:
+        return boost::regex_match(value, regex_);
+    }
+}
+
+RegexFilter::MatchType
+RegexFilter::matchType() const {
+    return type_;
+}
+
+const std::string&
+RegexFilter::literal() const {
+    return literal_;
+}
+
+RequestFilter::RequestFilter(const std::string &regex) : regex_(regex)
+{}
+
+RequestFilter::~RequestFilter()
+{}
+
+const RegexFilter&
+RequestFilter::regex() const {
+    return regex_;
 }
 
-UrlFilter::UrlFilter(const std::string &regex) : regex_(regex)
+UrlFilter::UrlFilter(const std::string &regex) : RequestFilter(regex)
 {}
 
 UrlFilter::~UrlFilter()
@@ -35,7 +120,7 @@ UrlFilter::check(const Request *request) const {
     return regex_.check(request->getScriptName());
 }
 
-HostFilter::HostFilter(const std::string &regex) : regex_(regex)
+HostFilter::HostFilter(const std::string &regex) : RequestFilter(regex)
 {}
 
 HostFilter::~HostFilter()
@@ -47,7 +132,7 @@ HostFilter::check(const Request *request) const {
 }
 
 
-PortFilter::PortFilter(const std::string &regex) : regex_(regex)
+PortFilter::PortFilter(const std::string &regex) : RequestFilter(regex)
 {}
 
 PortFilter::~PortFilter()
@@ -60,7 +145,7 @@ PortFilter::check(const Request *request) const {
 }
 
 
-AddressFilter::AddressFilter(const std::string &regex) : regex_(regex)
+AddressFilter::AddressFilter(const std::string &regex) : RequestFilter(regex)
 {}
 
 AddressFilter::~AddressFilter()
@@ -73,7 +158,7 @@ AddressFilter::check(const Request *request) const {
 
 
 ParamFilter::ParamFilter(const std::string &name, const std::string &regex) :
-        name_(name), regex_(regex)
+        RequestFilter(regex), name_(name)
 {}
 
 ParamFilter::~ParamFilter()
@@ -0,0 +1,209 @@
+#include "settings.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/crc.hpp>
+
+#include "details/request_format.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const char MAGIC[8] = { 'F', 'C', 'G', 'I', 'R', 'E', 'Q', '\n' };
+
+const boost::uint32_t RequestFormat::FORMAT_VERSION;
+const boost::uint64_t RequestFormat::HEADER_SIZE;
+
+static boost::uint32_t
+checksum(const char *data, std::size_t size) {
+	boost::crc_32_type crc;
+	crc.process_bytes(data, size);
+	return crc.checksum();
+}
+
+static void
+putInt(unsigned char *buf, boost::uint64_t value, std::size_t size) {
+	for (std::size_t i = 0; i < size; ++i) {
+		buf[i] = static_cast<unsigned char>(value >> (8 * i));
+	}
+}
+
+static boost::uint64_t
+getInt(const unsigned char *buf, std::size_t size) {
+	boost::uint64_t value = 0;
+	for (std::size_t i = 0; i < size; ++i) {
+		value |= static_cast<boost::uint64_t>(buf[i]) << (8 * i);
+	}
+	return value;
+}
+
+RequestFormat::RequestFormat() {
+	memset(sections_, 0, sizeof(sections_));
+}
+
+boost::uint64_t
+RequestFormat::offset(Section section) const {
+	return sections_[section].offset;
+}
+
+boost::uint64_t
+RequestFormat::length(Section section) const {
+	return sections_[section].length;
+}
+
+void
+RequestFormat::setSection(Section section, boost::uint64_t offset, const std::string &data) {
+	sections_[section].checksum = checksum(data.data(), data.size());
+	sections_[section].offset = offset;
+	sections_[section].length = data.size();
+}
+
+void
+RequestFormat::setBody(boost::uint64_t offset, boost::uint64_t length) {
+	sections_[BODY_SECTION].checksum = 0;
+	sections_[BODY_SECTION].offset = offset;
+	sections_[BODY_SECTION].length = length;
+}
+
+void
+RequestFormat::write(std::string &result) const {
+	unsigned char header[HEADER_SIZE];
+	memset(header, 0, sizeof(header));
+	memcpy(header, MAGIC, sizeof(MAGIC));
+	putInt(header + 8, FORMAT_VERSION, 4);
+	putInt(header + 12, SECTIONS_COUNT, 4);
+	unsigned char *entry = header + 16;
+	for (int i = 0; i < SECTIONS_COUNT; ++i, entry += 24) {
+		putInt(entry, sections_[i].checksum, 4);
+		putInt(entry + 8, sections_[i].offset, 8);
+		putInt(entry + 16, sections_[i].length, 8);
+	}
+	putInt(entry, checksum(reinterpret_cast<char*>(header), entry - header), 4);
+	result.assign(reinterpret_cast<char*>(header), sizeof(header));
+}
+
+void
+RequestFormat::write(DataBuffer &buffer) const {
+	std::string header;
+	write(header);
+	buffer.write(0, header.data(), header.size());
+}
+
+void
+RequestFormat::read(DataBuffer buffer) {
+	unsigned char header[HEADER_SIZE];
+	if (buffer.size() < HEADER_SIZE ||
+		buffer.read(0, reinterpret_cast<char*>(header), sizeof(header)) != sizeof(header)) {
+		throw std::runtime_error("truncated request header");
+	}
+	if (0 != memcmp(header, MAGIC, sizeof(MAGIC)) || FORMAT_VERSION != getInt(header + 8, 4)) {
+		throw std::runtime_error("unsupported request format");
+	}
+	if (SECTIONS_COUNT != getInt(header + 12, 4)) {
+		throw std::runtime_error("malformed request header");
+	}
+	const unsigned char *entry = header + 16;
+	for (int i = 0; i < SECTIONS_COUNT; ++i, entry += 24) {
+		sections_[i].checksum = static_cast<boost::uint32_t>(getInt(entry, 4));
+		sections_[i].offset = getInt(entry + 8, 8);
+		sections_[i].length = getInt(entry + 16, 8);
+		if (sections_[i].offset > buffer.size() || sections_[i].length > buffer.size() - sections_[i].offset) {
+			throw std::runtime_error("truncated request");
+		}
+	}
+	if (getInt(entry, 4) != checksum(reinterpret_cast<const char*>(header), entry - header)) {
+		throw std::runtime_error("request header checksum mismatch");
+	}
+}
+
+void
+RequestFormat::readSection(DataBuffer buffer, Section section, std::string &data) const {
+	const Entry &entry = sections_[section];
+	data.resize(entry.length);
+	if (entry.length > 0) {
+		buffer.read(entry.offset, &data[0], entry.length);
+	}
+	if (BODY_SECTION != section && entry.checksum != checksum(data.data(), data.size())) {
+		throw std::runtime_error("request section checksum mismatch");
+	}
+}
+
+bool
+RequestFormat::lookup(DataBuffer buffer, Section section, const std::string &name, std::string &value) {
+	RequestFormat format;
+	format.read(buffer);
+	std::string data;
+	format.readSection(buffer, section, data);
+	return find(data, name, value);
+}
+
+bool
+RequestFormat::find(const std::string &data, const std::string &name, std::string &value) {
+	std::size_t pos = 0;
+	while (pos < data.size()) {
+		boost::uint64_t size = nextNumber(data, pos);
+		if (size > data.size() - pos) {
+			throw std::runtime_error("malformed request section");
+		}
+		bool found = size == name.size() && 0 == data.compare(pos, size, name);
+		pos += size;
+		if (found) {
+			nextString(data, pos, value);
+			return true;
+		}
+		size = nextNumber(data, pos);
+		if (size > data.size() - pos) {
+			throw std::runtime_error("malformed request section");
+		}
+		pos += size;
+	}
+	return false;
+}
+
+void
+RequestFormat::addNumber(std::string &data, boost::uint64_t value) {
+	while (value >= 0x80) {
+		data.push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	data.push_back(static_cast<char>(value));
+}
+
+void
+RequestFormat::addString(std::string &data, const std::string &value) {
+	addNumber(data, value.size());
+	data.append(value);
+}
+
+boost::uint64_t
+RequestFormat::nextNumber(const std::string &data, std::size_t &pos) {
+	boost::uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (pos >= data.size()) {
+			break;
+		}
+		unsigned char byte = static_cast<unsigned char>(data[pos++]);
+		value |= static_cast<boost::uint64_t>(byte & 0x7f) << shift;
+		if (0 == (byte & 0x80)) {
+			return value;
+		}
+	}
+	throw std::runtime_error("malformed request section");
+}
+
+void
+RequestFormat::nextString(const std::string &data, std::size_t &pos, std::string &value) {
+	boost::uint64_t size = nextNumber(data, pos);
+	if (size > data.size() - pos) {
+		throw std::runtime_error("malformed request section");
+	}
+	value.assign(data, pos, size);
+	pos += size;
+}
+
+} // namespace fastcgi
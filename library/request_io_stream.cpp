@@ -0,0 +1,49 @@
+#include "settings.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "fastcgi2/request_io_stream.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const std::size_t COPY_CHUNK_SIZE = 65536;
+
+RequestIOStream::~RequestIOStream() {
+}
+
+int
+RequestIOStream::writev(const struct iovec *iov, int count) {
+	int size = 0;
+	for (int i = 0; i < count; ++i) {
+		size += write(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+	}
+	return size;
+}
+
+void
+RequestIOStream::writeFile(int fd, boost::uint64_t offset, boost::uint64_t length) {
+	char buffer[COPY_CHUNK_SIZE];
+	while (length > 0) {
+		ssize_t size = pread(fd, buffer, std::min(length, static_cast<boost::uint64_t>(sizeof(buffer))), offset);
+		if (-1 == size && EINTR == errno) {
+			continue;
+		}
+		if (size <= 0) {
+			throw std::runtime_error("Cannot read file to write to request stream");
+		}
+		write(buffer, size);
+		offset += size;
+		length -= size;
+	}
+}
+
+} // namespace fastcgi
@@ -17,8 +17,9 @@ namespace fastcgi
 {
 
 RequestsThreadPool::RequestsThreadPool(
-	const unsigned threadsNumber, const unsigned queueLength, fastcgi::Logger *logger) :
-		ThreadPool<RequestTask>(threadsNumber, queueLength), logger_(logger)
+	const unsigned threadsNumber, const unsigned queueLength,
+	ThreadPoolScheduler scheduler, fastcgi::Logger *logger) :
+		ThreadPool<RequestTask>(threadsNumber, queueLength, scheduler), logger_(logger)
 {}
 
 RequestsThreadPool::~RequestsThreadPool()
@@ -28,14 +29,15 @@ void
 RequestsThreadPool::handleTask(RequestTask task) {
 	try {
 		try {
-			std::auto_ptr<HandlerContext> context(new HandlerContextImpl);
+			ScopedArena arena;
+			HandlerContextImpl context(arena.get());
 			for (std::vector<Handler*>::iterator i = task.handlers.begin();
 				 i != task.handlers.end();
 				 ++i) {
 				if (task.request->isProcessed()) {
 					break;
 				}
-				(*i)->handleRequest(task.request.get(), context.get());
+				(*i)->handleRequest(task.request.get(), &context);
 			}
 
 			task.request->sendHeaders();
@@ -2,7 +2,10 @@
 
 #include <pthread.h>
 
+#include <sys/uio.h>
+
 #include <cctype>
+#include <memory>
 #include <iterator>
 #include <algorithm>
 #include <stdexcept>
@@ -10,10 +13,15 @@
 #include <boost/current_function.hpp>
 
 #include "fastcgi2/logger.h"
+#include "fastcgi2/multipart_handler.h"
 #include "fastcgi2/request_io_stream.h"
 
+#include "details/atomic.h"
+#include "details/data_buffer_impl.h"
+#include "details/multipart_parser.h"
 #include "details/parser.h"
 #include "details/request_cache.h"
+#include "details/request_format.h"
 #include "details/range.h"
 #include "details/requestimpl.h"
 
@@ -25,26 +33,55 @@ namespace fastcgi
 {
 
 static const std::string HEAD("HEAD");
-static const std::string HOST_KEY("host");
-static const std::string CONTENT_TYPE_KEY("content-type");
-static const std::string CONTENT_LENGTH_KEY("content-length");
-
-static const std::string HTTPS_KEY("HTTPS");
-static const std::string SERVER_ADDR_KEY("SERVER_ADDR");
-static const std::string SERVER_PORT_KEY("SERVER_PORT");
-
-static const std::string PATH_INFO_KEY("PATH_INFO");
-static const std::string PATH_TRANSLATED_KEY("PATH_TRANSLATED");
-
-static const std::string SCRIPT_NAME_KEY("SCRIPT_NAME");
-static const std::string SCRIPT_FILENAME_KEY("SCRIPT_FILENAME");
-static const std::string DOCUMENT_ROOT_KEY("DOCUMENT_ROOT");
-
-static const std::string REMOTE_USER_KEY("REMOTE_USER");
-static const std::string REMOTE_ADDR_KEY("REMOTE_ADDR");
-
-static const std::string QUERY_STRING_KEY("QUERY_STRING");
-static const std::string REQUEST_METHOD_KEY("REQUEST_METHOD");
+static const std::string KNOWN_VARIABLE_NAMES[] = {
+	"HTTPS",
+	"SERVER_ADDR",
+	"SERVER_PORT",
+	"PATH_INFO",
+	"PATH_TRANSLATED",
+	"SCRIPT_NAME",
+	"SCRIPT_FILENAME",
+	"DOCUMENT_ROOT",
+	"REMOTE_USER",
+	"REMOTE_ADDR",
+	"QUERY_STRING",
+	"REQUEST_METHOD",
+	"host",
+	"content-type",
+	"content-length"
+};
+
+static const Range KNOWN_ENV_NAMES[] = {
+	Range::fromChars("HTTPS"),
+	Range::fromChars("SERVER_ADDR"),
+	Range::fromChars("SERVER_PORT"),
+	Range::fromChars("PATH_INFO"),
+	Range::fromChars("PATH_TRANSLATED"),
+	Range::fromChars("SCRIPT_NAME"),
+	Range::fromChars("SCRIPT_FILENAME"),
+	Range::fromChars("DOCUMENT_ROOT"),
+	Range::fromChars("REMOTE_USER"),
+	Range::fromChars("REMOTE_ADDR"),
+	Range::fromChars("QUERY_STRING"),
+	Range::fromChars("REQUEST_METHOD"),
+	Range::fromChars("HTTP_HOST"),
+	Range::fromChars("CONTENT_TYPE"),
+	Range::fromChars("HTTP_CONTENT_LENGTH")
+};
+
+static const Range HTTP_CONTENT_TYPE_RANGE = Range::fromChars("HTTP_CONTENT_TYPE");
+
+static const std::size_t BODY_CHUNK_SIZE = 65536;
+
+/* headers are sent outside of handler context, so iovec list is not
+ * taken from request arena but from vector reserved up front */
+static inline void
+addChunk(std::vector<struct iovec> &chunks, const char *data, std::size_t size) {
+	struct iovec chunk;
+	chunk.iov_base = const_cast<char*>(data);
+	chunk.iov_len = size;
+	chunks.push_back(chunk);
+}
 
 File::File(DataBuffer filename, DataBuffer type, DataBuffer content) :
 	data_(content)
@@ -84,6 +121,59 @@ File::data() const {
 	return data_;
 }
 
+/**
+ * Collects multipart fields while body is being read: file parts become views
+ * into body buffer, other fields are copied to args as their data arrives.
+ */
+
+class MultipartCollector : public MultipartHandler {
+public:
+	MultipartCollector(DataBuffer body, std::map<std::string, File> &files,
+		std::vector<StringUtils::NamedValue> &args) :
+		body_(body), files_(files), args_(args), parser_(NULL), begin_(0), size_(0)
+	{}
+
+	void attach(const MultipartParser *parser) {
+		parser_ = parser;
+	}
+
+	virtual void onPartBegin(const std::string &name, const std::string &filename, const std::string &type) {
+		name_ = name;
+		filename_ = filename;
+		type_ = type;
+		value_.clear();
+		begin_ = parser_->offset();
+		size_ = 0;
+	}
+
+	virtual void onPartData(const char *data, std::size_t size) {
+		if (!name_.empty() && filename_.empty()) {
+			value_.append(data, size);
+		}
+		size_ += size;
+	}
+
+	virtual void onPartEnd() {
+		if (name_.empty()) {
+			return;
+		}
+		if (filename_.empty()) {
+			args_.push_back(std::make_pair(name_, value_));
+			return;
+		}
+		boost::uint64_t begin = body_.beginIndex() + begin_;
+		files_.insert(std::make_pair(name_, File(filename_, type_, DataBuffer(body_, begin, begin + size_))));
+	}
+
+private:
+	DataBuffer body_;
+	std::map<std::string, File> &files_;
+	std::vector<StringUtils::NamedValue> &args_;
+	const MultipartParser *parser_;
+	std::string name_, filename_, type_, value_;
+	boost::uint64_t begin_, size_;
+};
+
 RequestImpl::RequestImpl(Logger *logger, RequestCache *cache) :
 	processed_(false), delay_(0), logger_(logger), cache_(cache)
 {
@@ -95,74 +185,74 @@ RequestImpl::~RequestImpl() {
 
 unsigned short
 RequestImpl::getServerPort() const {
-	const std::string &res = Parser::get(vars_, SERVER_PORT_KEY);
+	const std::string &res = knownVariable(SERVER_PORT_VAR);
 	return (!res.empty()) ? boost::lexical_cast<unsigned short>(res) : 80;
 }
 
 const std::string&
 RequestImpl::getHost() const {
-	return Parser::get(headers_, HOST_KEY);
+	return knownVariable(HOST_HEADER);
 }
 
 const std::string&
 RequestImpl::getServerAddr() const {
-	return Parser::get(vars_, SERVER_ADDR_KEY);
+	return knownVariable(SERVER_ADDR_VAR);
 }
 
 const std::string&
 RequestImpl::getPathInfo() const {
-	return Parser::get(vars_, PATH_INFO_KEY);
+	return knownVariable(PATH_INFO_VAR);
 }
 
 const std::string&
 RequestImpl::getPathTranslated() const {
-		return Parser::get(vars_, PATH_TRANSLATED_KEY);
+		return knownVariable(PATH_TRANSLATED_VAR);
 }
 
 const std::string&
 RequestImpl::getScriptName() const {
-	return Parser::get(vars_, SCRIPT_NAME_KEY);
+	return knownVariable(SCRIPT_NAME_VAR);
 }
 
 const std::string&
 RequestImpl::getScriptFilename() const {
-	return Parser::get(vars_, SCRIPT_FILENAME_KEY);
+	return knownVariable(SCRIPT_FILENAME_VAR);
 }
 
 const std::string&
 RequestImpl::getDocumentRoot() const {
-	return Parser::get(vars_, DOCUMENT_ROOT_KEY);
+	return knownVariable(DOCUMENT_ROOT_VAR);
 }
 
 const std::string&
 RequestImpl::getRemoteUser() const {
-	return Parser::get(vars_, REMOTE_USER_KEY);
+	return knownVariable(REMOTE_USER_VAR);
 }
 
 const std::string&
 RequestImpl::getRemoteAddr() const {
-	return Parser::get(vars_, REMOTE_ADDR_KEY);
+	return knownVariable(REMOTE_ADDR_VAR);
 }
 
 const std::string&
 RequestImpl::getQueryString() const {
-	return Parser::get(vars_, QUERY_STRING_KEY);
+	return knownVariable(QUERY_STRING_VAR);
 }
 
 const std::string&
 RequestImpl::getRequestMethod() const {
-	return Parser::get(vars_, REQUEST_METHOD_KEY);
+	return knownVariable(REQUEST_METHOD_VAR);
 }
 
 std::streamsize
 RequestImpl::getContentLength() const {
 	return boost::lexical_cast<std::streamsize>(
-		Parser::get(headers_, CONTENT_LENGTH_KEY));
+		knownVariable(CONTENT_LENGTH_HEADER));
 }
 
 const std::string&
 RequestImpl::getContentType() const {
-	return Parser::get(headers_, CONTENT_TYPE_KEY);
+	return knownVariable(CONTENT_TYPE_HEADER);
 }
 
 unsigned int
@@ -217,41 +307,49 @@ RequestImpl::argNames(std::vector<std::string> &v) const {
 
 unsigned int
 RequestImpl::countHeaders() const {
+	parseEnv();
 	return headers_.size();
 }
 
 bool
 RequestImpl::hasHeader(const std::string &name) const {
+	parseEnv();
 	return Parser::has(headers_, name);
 }
 
 const std::string&
 RequestImpl::getHeader(const std::string &name) const {
+	parseEnv();
 	return Parser::get(headers_, name);
 }
 
 void
 RequestImpl::headerNames(std::vector<std::string> &v) const {
+	parseEnv();
 	Parser::keys(headers_, v);
 }
 
 unsigned int
 RequestImpl::countCookie() const {
+	parseEnv();
 	return cookies_.size();
 }
 
 bool
 RequestImpl::hasCookie(const std::string &name) const {
+	parseEnv();
 	return Parser::has(cookies_, name);
 }
 
 const std::string&
 RequestImpl::getCookie(const std::string &name) const {
+	parseEnv();
 	return Parser::get(cookies_, name);
 }
 
 void
 RequestImpl::cookieNames(std::vector<std::string> &v) const {
+	parseEnv();
 	Parser::keys(cookies_, v);
 }
 
@@ -299,7 +397,7 @@ RequestImpl::remoteFile(const std::string &name) const {
 
 bool
 RequestImpl::isSecure() const {
-	const std::string &val = Parser::get(vars_, HTTPS_KEY);
+	const std::string &val = knownVariable(HTTPS_VAR);
 	return !val.empty() && ("on" == val);
 }
 
@@ -345,13 +443,16 @@ RequestImpl::sendError(unsigned short status) {
 	out_headers_.insert(std::pair<std::string, std::string>("Content-type", "text/html"));
 	sendHeadersInternal();
 	if (stream_) {
-		stream_->write("<html><body><h1>", sizeof("<html><body><h1>") - 1);
 		std::string status_str = boost::lexical_cast<std::string>(status);
-		stream_->write(status_str.c_str(), status_str.size());
-		stream_->write(" ", 1);
 		const char* stat = Parser::statusToString(status);
-		stream_->write(stat, strlen(stat));
-		stream_->write("</h1></body></html>", sizeof("</h1></body></html>") - 1);
+		std::vector<struct iovec> chunks;
+		chunks.reserve(5);
+		addChunk(chunks, "<html><body><h1>", sizeof("<html><body><h1>") - 1);
+		addChunk(chunks, status_str.c_str(), status_str.size());
+		addChunk(chunks, " ", 1);
+		addChunk(chunks, stat, strlen(stat));
+		addChunk(chunks, "</h1></body></html>", sizeof("</h1></body></html>") - 1);
+		stream_->writev(&chunks[0], chunks.size());
 	}
 }
 
@@ -382,6 +483,32 @@ RequestImpl::write(const char *buf, std::streamsize size) {
 	return size;
 }
 
+void
+RequestImpl::write(const DataBuffer &buffer) {
+	sendHeaders();
+	if (!stream_ || HEAD == getRequestMethod() || buffer.isNil() || buffer.empty()) {
+		return;
+	}
+	int fd = buffer.impl()->fileDescriptor();
+	if (-1 != fd) {
+		stream_->writeFile(fd, buffer.beginIndex(), buffer.size());
+		return;
+	}
+	std::vector<struct iovec> chunks;
+	for (DataBuffer::SegmentIterator it = buffer.begin(), end = buffer.end(); it != end; ++it) {
+		addChunk(chunks, it->first, it->second);
+	}
+	stream_->writev(&chunks[0], chunks.size());
+}
+
+void
+RequestImpl::writeFile(int fd, boost::uint64_t offset, boost::uint64_t length) {
+	sendHeaders();
+	if (stream_ && HEAD != getRequestMethod() && length > 0) {
+		stream_->writeFile(fd, offset, length);
+	}
+}
+
 std::string
 RequestImpl::outputHeader(const std::string &name) const {
 	return Parser::get(out_headers_, name);
@@ -392,7 +519,11 @@ RequestImpl::reset() {
 	
 	status_ = 200;
 	stream_ = NULL;
+	processed_ = false;
+	delay_ = 0;
 	headers_sent_ = false;
+	body_pending_ = false;
+	body_remaining_ = 0;
 
 	args_.clear();
 	vars_.clear();
@@ -402,6 +533,88 @@ RequestImpl::reset() {
 	headers_.clear();
 	out_cookies_.clear();
 	out_headers_.clear();
+	std::fill(known_, known_ + KNOWN_VARIABLES_COUNT, 0);
+
+	env_.clear();
+	env_parsed_ = true;
+	for (int var = 0; var < KNOWN_VARIABLES_COUNT; ++var) {
+		known_values_[var].clear();
+	}
+}
+
+void
+RequestImpl::setVar(const std::string &name, const std::string &value) const {
+	std::pair<VarMap::iterator, bool> res = vars_.insert(std::make_pair(name, value));
+	if (!res.second) {
+		res.first->second = value;
+		return;
+	}
+	for (int var = 0; var < HOST_HEADER; ++var) {
+		if (KNOWN_VARIABLE_NAMES[var] == name) {
+			known_[var] = vars_.size();
+			break;
+		}
+	}
+}
+
+void
+RequestImpl::setInputHeader(const std::string &name, const std::string &value) const {
+	std::pair<HeaderMap::iterator, bool> res = headers_.insert(std::make_pair(name, value));
+	if (!res.second) {
+		res.first->second = value;
+		return;
+	}
+	for (int var = HOST_HEADER; var < KNOWN_VARIABLES_COUNT; ++var) {
+		if (StringCIEqual()(KNOWN_VARIABLE_NAMES[var], name)) {
+			known_[var] = headers_.size();
+			break;
+		}
+	}
+}
+
+const std::string&
+RequestImpl::knownVariable(KnownVariable var) const {
+	if (!atomicLoad(&env_parsed_)) {
+		return known_values_[var];
+	}
+	std::size_t pos = known_[var];
+	if (pos) {
+		return var < HOST_HEADER ? vars_.at(pos - 1).second : headers_.at(pos - 1).second;
+	}
+	return known_values_[var];
+}
+
+void
+RequestImpl::addEnv(const Range &key, const Range &value) {
+	env_.push_back(std::make_pair(key, value));
+	env_parsed_ = false;
+	for (int var = 0; var < KNOWN_VARIABLES_COUNT; ++var) {
+		if (KNOWN_ENV_NAMES[var] == key) {
+			Range known = var < HOST_HEADER ? value : value.trim();
+			known_values_[var].assign(known.begin(), known.end());
+			return;
+		}
+	}
+	if (HTTP_CONTENT_TYPE_RANGE == key) {
+		Range known = value.trim();
+		known_values_[CONTENT_TYPE_HEADER].assign(known.begin(), known.end());
+	}
+}
+
+void
+RequestImpl::parseEnv() const {
+	if (atomicLoad(&env_parsed_)) {
+		return;
+	}
+	boost::mutex::scoped_lock lock(env_mutex_);
+	if (env_parsed_) {
+		return;
+	}
+	for (std::vector<std::pair<Range, Range> >::const_iterator i = env_.begin(), end = env_.end(); i != end; ++i) {
+		Parser::addVariable(this, i->first, i->second);
+	}
+	env_.clear();
+	atomicStore(&env_parsed_, true);
 }
 
 void
@@ -411,6 +624,12 @@ RequestImpl::sendHeaders() {
 
 void
 RequestImpl::attach(RequestIOStream *stream, char *env[]) {
+	attachHeaders(stream, env);
+	attachBody();
+}
+
+void
+RequestImpl::attachHeaders(RequestIOStream *stream, char *env[]) {
 	if (NULL == stream) {
 		throw std::runtime_error("Stream is NULL");
 	}
@@ -419,46 +638,95 @@ RequestImpl::attach(RequestIOStream *stream, char *env[]) {
 	}
 	stream_ = stream;
 	Parser::parse(this, env, logger_);
-	const std::string& query = getQueryString();
-	if ("POST" != getRequestMethod() && "PUT" != getRequestMethod()) {
-		StringUtils::parse(query, args_);
+	StringUtils::parse(getQueryString(), args_);
+	if ("POST" == getRequestMethod() || "PUT" == getRequestMethod()) {
+		body_pending_ = true;
+		body_remaining_ = getContentLength();
+	}
+}
+
+void
+RequestImpl::attachBody() {
+	if (!body_pending_) {
 		return;
 	}
+	body_pending_ = false;
 
 	DataBuffer post_buffer;
+	RequestFormat format;
 	boost::uint64_t size = getContentLength();
 	if (cache_ && size >= cache_->minPostSize()) {
+		/* body is read in place, files and args sections and header are written after parsing */
 		post_buffer = cache_->create();
-		boost::uint64_t shift = serializeEnv(post_buffer, size + sizeof(boost::uint64_t));
-		shift = serializeInt(post_buffer, shift, size);
+		parseEnv();
+		std::string env;
+		serializeEnv(format, env);
+		boost::uint64_t shift = RequestFormat::HEADER_SIZE + env.size();
+		format.setBody(shift, size);
+		post_buffer.resize(shift + size);
+		post_buffer.write(RequestFormat::HEADER_SIZE, env.data(), env.size());
 		body_ = DataBuffer(post_buffer, post_buffer.beginIndex() + shift, post_buffer.endIndex());
 	}
 	else {
 		body_ = DataBuffer::create(StringUtils::EMPTY_STRING.c_str(), 0);
 		body_.resize(size);
 	}
+
+	const std::string &type = getContentType();
+	bool multipart = strncasecmp("multipart/form-data", type.c_str(), sizeof("multipart/form-data") - 1) == 0;
+	std::string boundary;
+	if (multipart) {
+		boundary = Parser::getBoundary(Range::fromString(type));
+	}
+
+	/* multipart body is parsed by chunks while it is read, not rescanned afterwards */
+	std::size_t args_count = args_.size();
+	MultipartCollector collector(body_, files_, args_);
+	std::auto_ptr<MultipartParser> parser;
+	if (!boundary.empty()) {
+		parser.reset(new MultipartParser(boundary, &collector));
+		collector.attach(parser.get());
+	}
+
 	boost::uint64_t rsz = 0;
 	for (DataBuffer::SegmentIterator it = body_.begin(), end;
 		 it != end;
 		 ++it) {
-		rsz += stream_->read(it->first, it->second);
+		char *data = it->first;
+		boost::uint64_t left = it->second;
+		while (left > 0) {
+			int res = stream_->read(data, static_cast<int>(std::min(left, static_cast<boost::uint64_t>(BODY_CHUNK_SIZE))));
+			if (res <= 0) {
+				break;
+			}
+			if (parser.get()) {
+				parser->feed(data, res);
+			}
+			data += res;
+			left -= res;
+			rsz += res;
+		}
+		if (left > 0) {
+			break;
+		}
 	}
+	body_remaining_ = 0;
 	if (rsz != size) {
 		throw std::runtime_error("failed to read request entity");
 	}
+	// streaming handler chosen after body arguments reads attached body
+	body_remaining_ = size;
 
-	if (!query.empty()) {
-		StringUtils::parse(query, args_);
-	}
-
-	const std::string &type = getContentType();
-	if (strncasecmp("multipart/form-data", type.c_str(), sizeof("multipart/form-data") - 1) == 0) {
-		std::string boundary = Parser::getBoundary(Range::fromString(type));
-		if (!boundary.empty()) {
-		    Parser::parseMultipart(this, body_, boundary);
+	if (parser.get()) {
+		if (!parser->finished()) {
+			/* no closing boundary, fall back to tolerant parser over whole body */
+			files_.clear();
+			args_.resize(args_count);
+			Parser::parseMultipart(this, body_, boundary);
 		}
 	}
-	else if (strncasecmp("text/plain", type.c_str(), sizeof("text/plain") - 1) &&
+	else if (!multipart &&
+			strncasecmp("text/plain", type.c_str(), sizeof("text/plain") - 1) &&
 			strncasecmp("application/octet-stream", type.c_str(), sizeof("application/octet-stream") - 1))
 	{
 		StringUtils::parse(body_, args_);
@@ -466,13 +734,60 @@ RequestImpl::attach(RequestIOStream *stream, char *env[]) {
 
 	if (!post_buffer.isNil()) {
 		boost::uint64_t pos = post_buffer.size();
-		post_buffer.resize(pos + 2 * sizeof(boost::uint64_t) +
-			filesSerializedSize() + argsSerializedSize());
-		pos = serializeFiles(post_buffer, pos);
-		pos = serializeArgs(post_buffer, pos);
+		std::string tail;
+		serializeTail(format, pos, tail);
+		post_buffer.resize(pos + tail.size());
+		post_buffer.write(pos, tail.data(), tail.size());
+		format.write(post_buffer);
 	}
 }
 
+bool
+RequestImpl::isBodyPending() const {
+	return body_pending_;
+}
+
+std::streamsize
+RequestImpl::readBody(char *buf, std::streamsize size) {
+	if (!body_pending_) {
+		boost::uint64_t len = std::min(static_cast<boost::uint64_t>(size), body_remaining_);
+		if (len > 0) {
+			body_.read(body_.size() - body_remaining_, buf, len);
+			body_remaining_ -= len;
+		}
+		return len;
+	}
+	std::streamsize total = 0;
+	while (total < size && body_remaining_ > 0) {
+		int len = static_cast<int>(std::min(static_cast<boost::uint64_t>(size - total), body_remaining_));
+		int res = stream_->read(buf + total, len);
+		if (res <= 0) {
+			throw std::runtime_error("failed to read request entity");
+		}
+		total += res;
+		body_remaining_ -= res;
+	}
+	return total;
+}
+
+void
+RequestImpl::readMultipart(MultipartHandler *handler) {
+	std::string boundary = Parser::getBoundary(Range::fromString(getContentType()));
+	if (boundary.empty()) {
+		throw std::runtime_error("request is not multipart");
+	}
+	MultipartParser parser(boundary, handler);
+	std::vector<char> chunk(BODY_CHUNK_SIZE);
+	while (true) {
+		std::streamsize size = readBody(&chunk[0], chunk.size());
+		if (0 == size) {
+			break;
+		}
+		parser.feed(&chunk[0], size);
+	}
+	parser.finish();
+}
+
 void
 RequestImpl::sendHeadersInternal() {
 	if (!headers_sent_) {
@@ -480,19 +795,27 @@ RequestImpl::sendHeadersInternal() {
 		stream << status_ << " " << Parser::statusToString(status_);
 		out_headers_["Status"] = stream.str();
 		if (stream_) {
+			std::vector<std::string> cookies;
+			cookies.reserve(out_cookies_.size());
+			for (std::set<Cookie>::const_iterator i = out_cookies_.begin(), end = out_cookies_.end(); i != end; ++i) {
+				cookies.push_back(i->toString());
+			}
+
+			std::vector<struct iovec> chunks;
+			chunks.reserve(4 * (out_headers_.size() + cookies.size()) + 1);
 			for (HeaderMap::iterator i = out_headers_.begin(), end = out_headers_.end(); i != end; ++i) {
-				stream_->write(i->first.c_str(), i->first.size());
-				stream_->write(": ", 2);
-				stream_->write(i->second.c_str(), i->second.size());
-				stream_->write("\r\n", 2);
+				addChunk(chunks, i->first.c_str(), i->first.size());
+				addChunk(chunks, ": ", 2);
+				addChunk(chunks, i->second.c_str(), i->second.size());
+				addChunk(chunks, "\r\n", 2);
 			}
-			for (std::set<Cookie>::const_iterator i = out_cookies_.begin(), end = out_cookies_.end(); i != end; ++i) {
-				stream_->write("Set-Cookie: ", sizeof("Set-Cookie: ") - 1);
-				std::string cookie = i->toString();
-				stream_->write(cookie.c_str(), cookie.size());
-				stream_->write("\r\n", 2);
+			for (std::vector<std::string>::const_iterator i = cookies.begin(), end = cookies.end(); i != end; ++i) {
+				addChunk(chunks, "Set-Cookie: ", sizeof("Set-Cookie: ") - 1);
+				addChunk(chunks, i->c_str(), i->size());
+				addChunk(chunks, "\r\n", 2);
 			}
-			stream_->write("\r\n", 2);
+			addChunk(chunks, "\r\n", 2);
+			stream_->writev(&chunks[0], chunks.size());
 		}
 		headers_sent_ = true;
 	}
@@ -510,299 +833,153 @@ RequestImpl::markAsProcessed () {
 void
 RequestImpl::tryAgain(time_t delay) {
 	delay_ = delay;
-}
-
-boost::uint64_t
-RequestImpl::serializeEnv(DataBuffer &buffer, boost::uint64_t add_size) {
-	boost::uint64_t header_size = 0;
-	for (HeaderMap::iterator it = headers_.begin(), end = headers_.end();
-		 it != end;
-		 ++it) {
-		header_size += it->first.size();
-		header_size += it->second.size();
-		header_size += 2*sizeof(boost::uint64_t);
-	}
-	boost::uint64_t cookie_size = 0;
-	for (VarMap::iterator it = cookies_.begin(), end = cookies_.end();
-		 it != end;
-		 ++it) {
-		cookie_size += it->first.size();
-		cookie_size += it->second.size();
-		cookie_size += 2*sizeof(boost::uint64_t);
-	}
-	boost::uint64_t var_size = 0;
-	for (VarMap::iterator it = vars_.begin(), end = vars_.end();
-		 it != end;
-		 ++it) {
-		var_size += it->first.size();
-		var_size += it->second.size();
-		var_size += 2*sizeof(boost::uint64_t);
+	if (delay > 0) {
+		// request is saved to cache after endpoint releases env block
+		parseEnv();
 	}
-	buffer.resize(add_size + header_size + cookie_size +
-		var_size + 3*sizeof(boost::uint64_t));
-
-	boost::uint64_t pos = 0;
-	pos = serializeInt(buffer, pos, header_size);
-	for (HeaderMap::iterator it = headers_.begin(), end = headers_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
-	}
-	pos = serializeInt(buffer, pos, cookie_size);
-	for (VarMap::iterator it = cookies_.begin(), end = cookies_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
-	}
-	pos = serializeInt(buffer, pos, var_size);
-	for (VarMap::iterator it = vars_.begin(), end = vars_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
-	}
-
-	return pos;
 }
 
-boost::uint64_t
-RequestImpl::serializeInt(DataBuffer &buffer, boost::uint64_t pos,
-	boost::uint64_t val) {
-	pos += buffer.write(pos, (char*)&val, sizeof(val));
-	return pos;
+template<typename Map> static void
+serializePairs(const Map &m, std::string &data) {
+	for (typename Map::const_iterator it = m.begin(), end = m.end(); it != end; ++it) {
+		RequestFormat::addString(data, it->first);
+		RequestFormat::addString(data, it->second);
+	}
 }
 
-boost::uint64_t
-RequestImpl::serializeString(DataBuffer &buffer, boost::uint64_t pos,
-	const std::string &val) {
-	boost::uint64_t size = val.size();
-	pos = serializeInt(buffer, pos, size);
-	pos += buffer.write(pos, val.c_str(), size);
-	return pos;
+static void
+appendSection(RequestFormat &format, RequestFormat::Section section, boost::uint64_t base,
+	const std::string &section_data, std::string &data) {
+	format.setSection(section, base + data.size(), section_data);
+	data.append(section_data);
 }
 
-boost::uint64_t
-RequestImpl::serializeBuffer(DataBuffer &buffer, boost::uint64_t pos,
-	const DataBuffer &src) {
-	pos = serializeInt(buffer, pos, src.size());
-	for (DataBuffer::SegmentIterator it = src.begin(), end;
-		 it != end;
-		 ++it) {
-		std::pair<char*, boost::uint64_t> chunk = *it;
-		pos += buffer.write(pos, chunk.first, chunk.second);
-	}
-	return pos;
+void
+RequestImpl::serializeEnv(RequestFormat &format, std::string &data) {
+	std::string section;
+	serializePairs(headers_, section);
+	appendSection(format, RequestFormat::HEADERS_SECTION, RequestFormat::HEADER_SIZE, section, data);
+	section.clear();
+	serializePairs(cookies_, section);
+	appendSection(format, RequestFormat::COOKIES_SECTION, RequestFormat::HEADER_SIZE, section, data);
+	section.clear();
+	serializePairs(vars_, section);
+	appendSection(format, RequestFormat::VARS_SECTION, RequestFormat::HEADER_SIZE, section, data);
 }
 
-boost::uint64_t
-RequestImpl::filesSerializedSize() {
-	boost::uint64_t file_size = 0;
+void
+RequestImpl::serializeTail(RequestFormat &format, boost::uint64_t base, std::string &data) {
+	std::string section;
 	for (std::map<std::string, File>::iterator it = files_.begin(), end = files_.end();
 		 it != end;
 		 ++it) {
-		file_size += sizeof(boost::uint64_t);
-		file_size += it->first.size();
-		file_size += sizeof(boost::uint64_t);
-		file_size += it->second.remoteName().size();
-		file_size += sizeof(boost::uint64_t);
-		file_size += it->second.type().size();
-		file_size += 2 * sizeof(boost::uint64_t);
-	}
-	return file_size;
-}
-
-boost::uint64_t
-RequestImpl::argsSerializedSize() {
-	boost::uint64_t arg_size = 0;
-	for (std::vector<StringUtils::NamedValue>::iterator it = args_.begin(),
-			end = args_.end();
-		 it != end;
-		 ++it) {
-		arg_size += it->first.size();
-		arg_size += it->second.size();
-		arg_size += 2 * sizeof(boost::uint64_t);
+		RequestFormat::addString(section, it->first);
+		RequestFormat::addString(section, it->second.remoteName());
+		RequestFormat::addString(section, it->second.type());
+		DataBuffer file = it->second.data();
+		RequestFormat::addNumber(section, file.beginIndex() - body_.beginIndex());
+		RequestFormat::addNumber(section, file.size());
 	}
-	return arg_size;
+	appendSection(format, RequestFormat::FILES_SECTION, base, section, data);
+	section.clear();
+	serializePairs(args_, section);
+	appendSection(format, RequestFormat::ARGS_SECTION, base, section, data);
 }
 
 void
 RequestImpl::serialize(DataBuffer &buffer) {
-	boost::uint64_t add_size = 0;
-	add_size += sizeof(boost::uint64_t);
-	add_size += body_.size();
-	add_size += sizeof(boost::uint64_t);
-	boost::uint64_t file_size = filesSerializedSize();
-	add_size += file_size;
-	add_size += sizeof(boost::uint64_t);
-	boost::uint64_t arg_size = argsSerializedSize();
-	add_size += arg_size;
-	boost::uint64_t pos = serializeEnv(buffer, add_size);
-	pos = serializeBuffer(buffer, pos, body_);
-	pos = serializeFiles(buffer, pos);
-	pos = serializeArgs(buffer, pos);
-}
-
-boost::uint64_t
-RequestImpl::serializeFiles(DataBuffer &buffer, boost::uint64_t pos) {
-	boost::uint64_t file_size = filesSerializedSize();
-	pos = serializeInt(buffer, pos, file_size);
-	for (std::map<std::string, File>::iterator it = files_.begin(), end = files_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second.remoteName());
-		pos = serializeString(buffer, pos, it->second.type());
-		DataBuffer file = it->second.data();
-		pos = serializeInt(buffer, pos, file.beginIndex() - body_.beginIndex());
-		pos = serializeInt(buffer, pos, file.endIndex() - file.beginIndex());
+	parseEnv();
+	RequestFormat format;
+	std::string env;
+	serializeEnv(format, env);
+
+	boost::uint64_t pos = RequestFormat::HEADER_SIZE + env.size();
+	format.setBody(pos, body_.size());
+
+	std::string tail;
+	serializeTail(format, pos + body_.size(), tail);
+
+	std::string header;
+	format.write(header);
+	buffer.resize(pos + body_.size() + tail.size());
+
+	/* whole request is committed with one writev unless body chunks move under iterator */
+	std::vector<struct iovec> chunks;
+	addChunk(chunks, header.data(), header.size());
+	addChunk(chunks, env.data(), env.size());
+	if (body_.empty() || body_.impl()->stableChunks()) {
+		for (DataBuffer::SegmentIterator it = body_.begin(), end; it != end; ++it) {
+			addChunk(chunks, it->first, it->second);
+		}
+		addChunk(chunks, tail.data(), tail.size());
+		buffer.writev(0, &chunks[0], chunks.size());
+		return;
+	}
+	buffer.writev(0, &chunks[0], chunks.size());
+	for (DataBuffer::SegmentIterator it = body_.begin(), end; it != end; ++it) {
+		std::pair<char*, boost::uint64_t> chunk = *it;
+		pos += buffer.write(pos, chunk.first, chunk.second);
 	}
-	return pos;
+	buffer.write(pos, tail.data(), tail.size());
 }
 
-boost::uint64_t
-RequestImpl::serializeArgs(DataBuffer &buffer, boost::uint64_t pos) {
-	boost::uint64_t arg_size = argsSerializedSize();
-	pos = serializeInt(buffer, pos, arg_size);
-	for (std::vector<StringUtils::NamedValue>::iterator it = args_.begin(),
-			end = args_.end();
-		 it != end;
-		 ++it) {
-		pos = serializeString(buffer, pos, it->first);
-		pos = serializeString(buffer, pos, it->second);
-	}
-	return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseInt(DataBuffer buffer, boost::uint64_t pos,
-	boost::uint64_t &val) {
-	pos += buffer.read(pos, (char*)&val, sizeof(val));
-	return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseString(DataBuffer buffer, boost::uint64_t pos, std::string &val) {
-	boost::uint64_t len = 0;
-	pos = parseInt(buffer, pos, len);
-	val.resize(len);
-	pos += buffer.read(pos, (char*)&(val[0]), len);
-	return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseHeaders(DataBuffer buffer, boost::uint64_t pos) {
-    boost::uint64_t field_size = 0;
-    pos = parseInt(buffer, pos, field_size);
-    boost::uint64_t pos_end = pos + field_size;
-    if (pos_end > buffer.size()) {
-    	throw std::runtime_error("Cannot parse request headers");
-    }
-    while (pos < pos_end) {
-		std::string name, value;
-		pos = parseString(buffer, pos, name);
-		pos = parseString(buffer, pos, value);
-		headers_.insert(std::make_pair(name, value));
-    }
-    return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseCookies(DataBuffer buffer, boost::uint64_t pos) {
-    boost::uint64_t field_size = 0;
-    pos = parseInt(buffer, pos, field_size);
-    boost::uint64_t pos_end = pos + field_size;
-    if (pos_end > buffer.size()) {
-    	throw std::runtime_error("Cannot parse request cookies");
-    }
-    while (pos < pos_end) {
-		std::string name, value;
-		pos = parseString(buffer, pos, name);
-		pos = parseString(buffer, pos, value);
-		cookies_.insert(std::make_pair(name, value));
-    }
-    return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseVars(DataBuffer buffer, boost::uint64_t pos) {
-    boost::uint64_t field_size = 0;
-    pos = parseInt(buffer, pos, field_size);
-    boost::uint64_t pos_end = pos + field_size;
-    if (pos_end > buffer.size()) {
-    	throw std::runtime_error("Cannot parse request vars");
-    }
-    while (pos < pos_end) {
-		std::string name, value;
-		pos = parseString(buffer, pos, name);
-		pos = parseString(buffer, pos, value);
-		vars_.insert(std::make_pair(name, value));
-    }
-    return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseBody(DataBuffer buffer, boost::uint64_t pos) {
-    boost::uint64_t field_size = 0;
-	pos = parseInt(buffer, pos, field_size);
-	boost::uint64_t pos_end = pos + field_size;
-	if (pos_end > buffer.size()) {
-		throw std::runtime_error("Cannot parse request body");
-	}
-	body_ = DataBuffer(buffer, pos + buffer.beginIndex(), pos_end + buffer.beginIndex());
-	return pos_end;
-}
-
-boost::uint64_t
-RequestImpl::parseFiles(DataBuffer buffer, boost::uint64_t pos) {
-    boost::uint64_t field_size = 0;
-	pos = parseInt(buffer, pos, field_size);
-	boost::uint64_t pos_end = pos + field_size;
-    if (pos_end > buffer.size()) {
-    	throw std::runtime_error("Cannot parse request files");
-    }
-    while (pos < pos_end) {
+void
+RequestImpl::parseFiles(const std::string &data) {
+	std::size_t pos = 0;
+	while (pos < data.size()) {
 		std::string name, remote_name, type;
-		pos = parseString(buffer, pos, name);
-		pos = parseString(buffer, pos, remote_name);
-		pos = parseString(buffer, pos, type);
-		boost::uint64_t offset = 0;
-		boost::uint64_t length = 0;
-		pos = parseInt(buffer, pos, offset);
-		pos = parseInt(buffer, pos, length);
+		RequestFormat::nextString(data, pos, name);
+		RequestFormat::nextString(data, pos, remote_name);
+		RequestFormat::nextString(data, pos, type);
+		boost::uint64_t offset = RequestFormat::nextNumber(data, pos);
+		boost::uint64_t length = RequestFormat::nextNumber(data, pos);
+		if (offset > body_.size() || length > body_.size() - offset) {
+			throw std::runtime_error("Cannot parse request files");
+		}
 		DataBuffer file_buffer = DataBuffer(body_, offset + body_.beginIndex(),
 			offset + length + body_.beginIndex());
 		files_.insert(std::make_pair(name, File(remote_name, type, file_buffer)));
-    }
-    return pos;
-}
-
-boost::uint64_t
-RequestImpl::parseArgs(DataBuffer buffer, boost::uint64_t pos) {
-    boost::uint64_t field_size = 0;
-	pos = parseInt(buffer, pos, field_size);
-	boost::uint64_t pos_end = pos + field_size;
-    if (pos_end > buffer.size()) {
-    	throw std::runtime_error("Cannot parse request args");
-    }
-    while (pos < pos_end) {
-		std::string name, value;
-		pos = parseString(buffer, pos, name);
-		pos = parseString(buffer, pos, value);
-		args_.push_back(std::make_pair(name, value));
-    }
-    return pos;
+	}
 }
 
 void
 RequestImpl::parse(DataBuffer buffer) {
-    boost::uint64_t pos = parseHeaders(buffer, 0);
-    pos = parseCookies(buffer, pos);
-    pos = parseVars(buffer, pos);
-    pos = parseBody(buffer, pos);
-    pos = parseFiles(buffer, pos);
-    pos = parseArgs(buffer, pos);
+	RequestFormat format;
+	format.read(buffer);
+
+	std::string data, name, value;
+	std::size_t pos = 0;
+	format.readSection(buffer, RequestFormat::HEADERS_SECTION, data);
+	for (pos = 0; pos < data.size();) {
+		RequestFormat::nextString(data, pos, name);
+		RequestFormat::nextString(data, pos, value);
+		setInputHeader(name, value);
+	}
+	format.readSection(buffer, RequestFormat::COOKIES_SECTION, data);
+	for (pos = 0; pos < data.size();) {
+		RequestFormat::nextString(data, pos, name);
+		RequestFormat::nextString(data, pos, value);
+		cookies_.insert(std::make_pair(name, value));
+	}
+	format.readSection(buffer, RequestFormat::VARS_SECTION, data);
+	for (pos = 0; pos < data.size();) {
+		RequestFormat::nextString(data, pos, name);
+		RequestFormat::nextString(data, pos, value);
+		setVar(name, value);
+	}
+
+	boost::uint64_t body = buffer.beginIndex() + format.offset(RequestFormat::BODY_SECTION);
+	body_ = DataBuffer(buffer, body, body + format.length(RequestFormat::BODY_SECTION));
+	body_remaining_ = body_.size();
+
+	format.readSection(buffer, RequestFormat::FILES_SECTION, data);
+	parseFiles(data);
+	format.readSection(buffer, RequestFormat::ARGS_SECTION, data);
+	for (pos = 0; pos < data.size();) {
+		RequestFormat::nextString(data, pos, name);
+		RequestFormat::nextString(data, pos, value);
+		args_.push_back(std::make_pair(name, value));
+	}
 }
 
 void
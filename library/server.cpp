@@ -21,7 +21,36 @@ Server::~Server()
 
 void
 Server::handleRequest(RequestTask task) {
-	handleRequestInternal(getHandler(task), task);
+	const HandlerSet::HandlerDescription* handler = NULL;
+	if (prepareRequest(task, handler)) {
+		handleRequestInternal(handler, task);
+	}
+}
+
+bool
+Server::prepareRequest(RequestTask task, const HandlerSet::HandlerDescription *&handler) {
+	if (!task.request->isBodyPending()) {
+		handler = getHandler(task);
+		return true;
+	}
+	// body is left unread only for streaming handler which body arguments cannot override
+	const HandlerSet *handlers = globals()->handlers();
+	if (handlers->hasStreamingBody()) {
+		handler = getHandler(task);
+		if (handlers->isStreamingBody(handler)) {
+			return true;
+		}
+	}
+	try {
+		task.request->attachBody();
+	}
+	catch (const std::exception &e) {
+		logger()->error("caught exception while attach request body: %s", e.what());
+		task.request->sendError(400);
+		return false;
+	}
+	handler = getHandler(task);
+	return true;
 }
 
 void
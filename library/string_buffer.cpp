@@ -2,6 +2,7 @@
 
 #include <stdexcept>
 
+#include "details/char_search.h"
 #include "details/range.h"
 #include "details/string_buffer.h"
 
@@ -43,10 +44,13 @@ StringBuffer::find(boost::uint64_t begin, boost::uint64_t end, const char* buf,
 	if (len > end - begin) {
 		return end;
 	}
-	char* first = &((*data_)[0]);
-	Range base(first + begin, first + end);
-	Range substr(buf, buf + len);
-	return base.find(substr) - first;
+	const char* first = &((*data_)[0]);
+	return CharSearch::findString(first + begin, first + end, buf, len) - first;
+}
+
+int
+StringBuffer::memcmpAt(boost::uint64_t pos, const char *data, boost::uint64_t len) {
+	return memcmp(&((*data_)[0]) + pos, data, len);
 }
 
 std::pair<boost::uint64_t, boost::uint64_t>
@@ -88,4 +92,9 @@ StringBuffer::getCopy() const {
 	return new StringBuffer(*this);
 }
 
+bool
+StringBuffer::stableChunks() const {
+	return true;
+}
+
 } // namespace fastcgi
@@ -1,12 +1,15 @@
 #include "settings.h"
 
 #include <cstdlib>
+#include <cstring>
+#include <iterator>
 #include <stdexcept>
 
 #include <openssl/md5.h>
 
 #include "fastcgi2/util.h"
 #include "fastcgi2/logger.h"
+#include "details/char_search.h"
 #include "details/range.h"
 
 #ifdef HAVE_DMALLOC_H
@@ -25,62 +28,84 @@ StringUtils::StringUtils()
 StringUtils::~StringUtils() {
 }
 
+static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+static inline bool
+isUrlSafe(char symbol) {
+	if (('a' <= symbol && symbol <= 'z') || ('A' <= symbol && symbol <= 'Z') || ('0' <= symbol && symbol <= '9')) {
+		return true;
+	}
+	switch (symbol) {
+		case '-': case '_': case '.': case '!': case '~':
+		case '*': case '(': case ')': case '\'':
+			return true;
+		default:
+			return false;
+	}
+}
+
+static inline int
+hexValue(char symbol) {
+	return (symbol >= 'A') ? ((symbol & 0xDF) - 'A') + 10 : (symbol - '0');
+}
+
 std::string
 StringUtils::urlencode(const Range &range) {
 	
 	std::string result;
-	result.reserve(3 * range.size());
+	if (range.empty()) {
+		return result;
+	}
+	result.resize(3 * range.size());
+	char *begin = &result[0], *out = begin;
 	
 	for (const char* i = range.begin(), *end = range.end(); i != end; ++i) {
 		char symbol = (*i);
-		if (isalnum(symbol)) {
-			result.append(1, symbol);
-			continue;
+		if (isUrlSafe(symbol)) {
+			*out++ = symbol;
 		}
-		switch (symbol) {
-			case '-': case '_': case '.': case '!': case '~': 
-			case '*': case '(': case ')': case '\'': 
-				result.append(1, symbol);
-				break;
-			default:
-				result.append(1, '%');
-				char bytes[3] = { 0, 0, 0 };
-				bytes[0] = (symbol & 0xF0) / 16 ;
-				bytes[0] += (bytes[0] > 9) ? 'A' - 10 : '0';
-				bytes[1] = symbol & 0x0F;
-				bytes[1] += (bytes[1] > 9) ? 'A' - 10 : '0';
-				result.append(bytes, sizeof(bytes) - 1);
-				break;
+		else {
+			*out++ = '%';
+			*out++ = HEX_DIGITS[(symbol >> 4) & 0x0F];
+			*out++ = HEX_DIGITS[symbol & 0x0F];
 		}
 	}
+	result.resize(out - begin);
 	return result;
 }
 
 void
 StringUtils::urldecode(const Range &range, std::string &result) {
-	for (const char *i = range.begin(), *end = range.end(); i != end; ++i) {
-		switch (*i) {
-			case '+':
-				result.append(1, ' ');
-				break;
-			case '%':
-				if (std::distance(i, end) > 2) {
-					int digit;
-					char f = *(i + 1), s = *(i + 2);
-					digit = (f >= 'A' ? ((f & 0xDF) - 'A') + 10 : (f - '0')) * 16;
-					digit += (s >= 'A') ? ((s & 0xDF) - 'A') + 10 : (s - '0');
-					result.append(1, static_cast<char>(digit));
-					i += 2;
-				}
-				else {
-					result.append(1, '%');
-				}
-				break;
-			default:
-				result.append(1, (*i));
-				break;
+	if (range.empty()) {
+		return;
+	}
+	std::size_t size = result.size();
+	result.resize(size + range.size());
+	char *begin = &result[0], *out = begin + size;
+
+	const char *i = range.begin(), *end = range.end();
+	while (i != end) {
+		const char *special = CharSearch::findFirstOf(i, end, '%', '+');
+		memcpy(out, i, special - i);
+		out += special - i;
+		i = special;
+		if (i == end) {
+			break;
+		}
+		if ('+' == *i) {
+			*out++ = ' ';
+			++i;
+		}
+		else if (std::distance(i, end) > 2) {
+			*out++ = static_cast<char>(hexValue(*(i + 1)) * 16 + hexValue(*(i + 2)));
+			i += 3;
+		}
+		else {
+			*out++ = '%';
+			++i;
 		}
 	}
+	result.resize(out - begin);
 }
 
 std::string
@@ -112,14 +137,12 @@ StringUtils::parse(const Range &range, std::vector<NamedValue> &v) {
 		tmp.split('&', head, tail);
 		head.split('=', key, value);
 		if (!key.empty()) {
-			try {
-				v.push_back(std::pair<std::string, std::string>(urldecode(key), urldecode(value)));
-			}
-			catch (const std::exception &e) {
-				throw;
-				// do we really want to swallow this exception here ???
-				// log()->error("%s, caught exception: %s", e.what());
-			}
+			v.push_back(NamedValue());
+			NamedValue &named = v.back();
+			named.first.reserve(key.size());
+			urldecode(key, named.first);
+			named.second.reserve(value.size());
+			urldecode(value, named.second);
 		}
 		tmp = tail;
 	}
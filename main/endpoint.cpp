@@ -1,9 +1,18 @@
 #include "settings.h"
 
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 #include <cassert>
 #include <cerrno>
+#include <cstring>
 #include <sstream>
+#include <stdexcept>
+
+#include <boost/lexical_cast.hpp>
 
 #include <fcgiapp.h>
 
@@ -41,12 +50,17 @@ Endpoint::ScopedBusyCounter::decrement() {
 	}
 }
 
-Endpoint::Endpoint(const std::string &path, const std::string &port, unsigned short threads) :
-	socket_(-1), busy_count_(0), threads_(threads), socket_path_(path), socket_port_(port)
+Endpoint::Endpoint(const std::string &path, const std::string &port, unsigned short threads,
+	Mode mode, unsigned short shard, bool reusePort) :
+	socket_(-1), busy_count_(0), threads_(threads), mode_(mode), shard_(shard), reuse_port_(reusePort),
+	socket_path_(path), socket_port_(port)
 {
 	if (socket_path_.empty() && socket_port_.empty()) {
 		throw std::runtime_error("Both /socket and /port param for endpoint is empty");
 	}
+	if (reuse_port_ && !socket_path_.empty()) {
+		throw std::runtime_error("reuseport can be used with /port endpoints only");
+	}
 }
 
 Endpoint::~Endpoint() {
@@ -63,6 +77,39 @@ Endpoint::threads() const {
 	return threads_;
 }
 
+Endpoint::Mode
+Endpoint::mode() const {
+	return mode_;
+}
+
+unsigned short
+Endpoint::shard() const {
+	return shard_;
+}
+
+void
+Endpoint::setCpus(const std::vector<int> &cpus) {
+	cpus_ = cpus;
+}
+
+void
+Endpoint::bindCurrentThread() const {
+	if (cpus_.empty()) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (std::vector<int>::const_iterator i = cpus_.begin(), end = cpus_.end(); i != end; ++i) {
+		CPU_SET(*i, &set);
+	}
+	int res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (0 != res) {
+		std::stringstream stream;
+		stream << "can not bind thread of fastcgi socket " << toString() << " to cpus [" << res << "]";
+		throw std::runtime_error(stream.str());
+	}
+}
+
 std::string
 Endpoint::toString() const {
 	return socket_path_.empty() ? (std::string(":") + socket_port_) : socket_path_;
@@ -77,6 +124,10 @@ Endpoint::getBusyCounter() const {
 void
 Endpoint::openSocket(const int backlog) {
 	boost::mutex::scoped_lock sl(mutex_);
+	if (reuse_port_) {
+		openReusePortSocket(backlog);
+		return;
+	}
 	socket_ = FCGX_OpenSocket(toString().c_str(), backlog);
 	if (-1 == socket_) {
 		std::stringstream stream;
@@ -88,6 +139,47 @@ Endpoint::openSocket(const int backlog) {
 	}
 }
 
+void
+Endpoint::openReusePortSocket(const int backlog) {
+#ifdef SO_REUSEPORT
+	unsigned short port = 0;
+	try {
+		port = boost::lexical_cast<unsigned short>(socket_port_);
+	}
+	catch (const boost::bad_lexical_cast &) {
+		throw std::runtime_error("bad fastcgi port: " + socket_port_);
+	}
+
+	int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	if (-1 != fd) {
+		int on = 1;
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(port);
+		if (-1 == setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+			-1 == setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) ||
+			-1 == bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ||
+			-1 == listen(fd, backlog)) {
+			int error = errno;
+			close(fd);
+			fd = -1;
+			errno = error;
+		}
+	}
+	if (-1 == fd) {
+		std::stringstream stream;
+		stream << "can not open fastcgi socket: " << toString() << " shard " << shard_ << "[" << errno << "]";
+		throw std::runtime_error(stream.str());
+	}
+	socket_ = fd;
+#else
+	(void)backlog;
+	throw std::runtime_error("SO_REUSEPORT is not supported on this platform");
+#endif
+}
+
 void
 Endpoint::incrementBusyCounter() {
 	boost::mutex::scoped_lock sl(mutex_);
@@ -1,6 +1,9 @@
 #ifndef _FASTCGI_FASTCGI_ENDPOINT_H_
 #define _FASTCGI_FASTCGI_ENDPOINT_H_
 
+#include <string>
+#include <vector>
+
 #include <boost/thread/mutex.hpp>
 
 namespace fastcgi
@@ -19,13 +22,24 @@ public:
 		Endpoint &endpoint_;
 	};
 
+	enum Mode {
+		BLOCKING,
+		EPOLL
+	};
+
 public:
-	Endpoint(const std::string &path, const std::string &port, unsigned short threads);
+	Endpoint(const std::string &path, const std::string &port, unsigned short threads,
+		Mode mode = BLOCKING, unsigned short shard = 0, bool reusePort = false);
 	virtual ~Endpoint();
 
 	int socket() const;
 
 	unsigned short threads() const;
+	Mode mode() const;
+	unsigned short shard() const;
+
+	void setCpus(const std::vector<int> &cpus);
+	void bindCurrentThread() const;
 
 	std::string toString() const;
 	unsigned short getBusyCounter() const;
@@ -35,10 +49,17 @@ public:
 	void incrementBusyCounter();
 	void decrementBusyCounter();
 
+private:
+	void openReusePortSocket(const int backlog);
+
 private:
 	int socket_;
 	int busy_count_;
 	unsigned short threads_;
+	Mode mode_;
+	unsigned short shard_;
+	bool reuse_port_;
+	std::vector<int> cpus_;
 	mutable boost::mutex mutex_;
 	std::string socket_path_, socket_port_;
 };
@@ -0,0 +1,167 @@
+#include "settings.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "endpoint.h"
+#include "fcgi_async_request.h"
+#include "fcgi_connection.h"
+
+#include "fastcgi2/logger.h"
+#include "fastcgi2/request.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const std::size_t OUTPUT_BUFFER_SIZE = 8192;
+
+AsyncFastcgiRequest::AsyncFastcgiRequest(boost::shared_ptr<Request> request,
+		boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data,
+		Endpoint *endpoint, Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes) :
+	FastcgiRequestBase(request, logger, statistics, logTimes),
+	connection_(connection), data_(data), endpoint_(endpoint), read_pos_(0)
+{
+	markAccepted();
+	output_.reserve(OUTPUT_BUFFER_SIZE);
+	endpoint_->incrementBusyCounter();
+}
+
+AsyncFastcgiRequest::~AsyncFastcgiRequest() {
+}
+
+void
+AsyncFastcgiRequest::finish() {
+	updateStatistics();
+	try {
+		if (data_->aborted || output_.empty()) {
+			connection_->endRequest(data_->id);
+		}
+		else {
+			connection_->endRequest(data_->id, &output_[0], output_.size());
+		}
+	}
+	catch (const std::exception &e) {
+		logger_->error("caught exception while finishing request: %s", e.what());
+	}
+	if (!data_->keepConnection) {
+		connection_->close();
+	}
+	endpoint_->decrementBusyCounter();
+}
+
+void
+AsyncFastcgiRequest::release(AsyncFastcgiRequest *request) {
+	request->finish();
+	delete request;
+}
+
+void
+AsyncFastcgiRequest::attach() {
+	const char *pos = data_->params.empty() ? NULL : &data_->params[0];
+	const char *end = pos + data_->params.size();
+	Range name, value;
+	while (pos < end) {
+		if (!FastcgiProtocol::readNameValue(pos, end, name, value)) {
+			throw std::runtime_error("malformed fastcgi params");
+		}
+		std::string var;
+		var.reserve(name.size() + value.size() + 1);
+		var.append(name.begin(), name.end()).append(1, '=').append(value.begin(), value.end());
+		env_.push_back(var);
+		if (Range::fromChars("REQUEST_URI") == name) {
+			url_ = value.toString();
+		}
+	}
+	envp_.reserve(env_.size() + 1);
+	for (std::vector<std::string>::iterator it = env_.begin(), end = env_.end(); it != end; ++it) {
+		envp_.push_back(&(*it)[0]);
+	}
+	envp_.push_back(NULL);
+	request_->attachHeaders(this, &envp_[0]);
+}
+
+int
+AsyncFastcgiRequest::read(char *buf, int size) {
+	if (!data_->bodyFile.isNil()) {
+		boost::uint64_t available = data_->bodyFile.size() - read_pos_;
+		std::size_t len = std::min(available, static_cast<boost::uint64_t>(size));
+		if (len > 0) {
+			data_->bodyFile.read(read_pos_, buf, len);
+			read_pos_ += len;
+		}
+		return len;
+	}
+	std::size_t available = data_->body.size() - read_pos_;
+	std::size_t len = std::min(available, static_cast<std::size_t>(size));
+	if (len > 0) {
+		memcpy(buf, &data_->body[read_pos_], len);
+		read_pos_ += len;
+	}
+	return len;
+}
+
+int
+AsyncFastcgiRequest::write(const char *buf, int size) {
+	struct iovec chunk;
+	chunk.iov_base = const_cast<char*>(buf);
+	chunk.iov_len = size;
+	return writev(&chunk, 1);
+}
+
+int
+AsyncFastcgiRequest::writev(const struct iovec *iov, int count) {
+	std::size_t size = FastcgiConnection::totalSize(iov, count);
+	if (data_->aborted) {
+		return size;
+	}
+	if (output_.size() + size <= OUTPUT_BUFFER_SIZE) {
+		for (int i = 0; i < count; ++i) {
+			const char *base = static_cast<const char*>(iov[i].iov_base);
+			output_.insert(output_.end(), base, base + iov[i].iov_len);
+		}
+		return size;
+	}
+
+	std::vector<struct iovec> chunks;
+	chunks.reserve(count + 1);
+	if (!output_.empty()) {
+		struct iovec chunk;
+		chunk.iov_base = &output_[0];
+		chunk.iov_len = output_.size();
+		chunks.push_back(chunk);
+	}
+	chunks.insert(chunks.end(), iov, iov + count);
+	connection_->writeRecords(FastcgiProtocol::STDOUT, data_->id, &chunks[0], chunks.size());
+	output_.clear();
+	return size;
+}
+
+void
+AsyncFastcgiRequest::writeFile(int fd, boost::uint64_t offset, boost::uint64_t length) {
+	if (data_->aborted) {
+		return;
+	}
+	if (!output_.empty()) {
+		connection_->writeRecord(FastcgiProtocol::STDOUT, data_->id, &output_[0], output_.size());
+		output_.clear();
+	}
+	connection_->writeFile(data_->id, fd, offset, length);
+}
+
+void
+AsyncFastcgiRequest::write(std::streambuf *buf) {
+	char chunk[OUTPUT_BUFFER_SIZE];
+	while (true) {
+		std::streamsize size = buf->sgetn(chunk, sizeof(chunk));
+		if (size <= 0) {
+			break;
+		}
+		write(chunk, size);
+	}
+}
+
+} // namespace fastcgi
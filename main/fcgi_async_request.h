@@ -0,0 +1,55 @@
+#ifndef _FASTCGI_FASTCGI_ASYNC_REQUEST_H_
+#define _FASTCGI_FASTCGI_ASYNC_REQUEST_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "fcgi_request.h"
+
+namespace fastcgi
+{
+
+class FastcgiConnection;
+struct FastcgiRequestData;
+
+/**
+ * Request received by reactor on epoll endpoint.
+ * Params and stdin are already buffered in memory or request cache file,
+ * output goes to connection as STDOUT records.
+ * Request is finished by release, deleter of its shared pointer, in prepare or handler pool
+ * thread which drops last reference to it: reactor thread never holds requests.
+ */
+
+class AsyncFastcgiRequest : public FastcgiRequestBase {
+public:
+	AsyncFastcgiRequest(boost::shared_ptr<Request> request, boost::shared_ptr<FastcgiConnection> connection,
+		boost::shared_ptr<FastcgiRequestData> data, Endpoint *endpoint,
+		Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes);
+	virtual ~AsyncFastcgiRequest();
+
+	void attach();
+	void finish();
+
+	static void release(AsyncFastcgiRequest *request);
+
+	int read(char *buf, int size);
+	int write(const char *buf, int size);
+	void write(std::streambuf *buf);
+	int writev(const struct iovec *iov, int count);
+	void writeFile(int fd, boost::uint64_t offset, boost::uint64_t length);
+
+private:
+	boost::shared_ptr<FastcgiConnection> connection_;
+	boost::shared_ptr<FastcgiRequestData> data_;
+	Endpoint *endpoint_;
+	std::vector<std::string> env_;
+	std::vector<char*> envp_;
+	boost::uint64_t read_pos_;
+	std::vector<char> output_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_FASTCGI_ASYNC_REQUEST_H_
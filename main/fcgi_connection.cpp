@@ -0,0 +1,611 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "fcgi_connection.h"
+#include "fcgi_io.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const std::size_t READ_CHUNK_SIZE = 16384;
+static const std::size_t READ_CHUNKS_PER_EVENT = 16;
+static const std::size_t MAX_RECORD_CONTENT = 65528;
+static const std::size_t OUTPUT_LIMIT = 4 * MAX_RECORD_CONTENT;
+static const int FLUSH_IOV_COUNT = 64;
+
+static inline void
+addChunk(std::vector<struct iovec> &chunks, const void *data, std::size_t size) {
+	struct iovec chunk;
+	chunk.iov_base = const_cast<void*>(data);
+	chunk.iov_len = size;
+	chunks.push_back(chunk);
+}
+
+static void
+closeFile(int *fd) {
+	::close(*fd);
+	delete fd;
+}
+
+FastcgiConnection::FastcgiConnection(int fd, int epoll) :
+	fd_(fd), epoll_(epoll), events_(EPOLLIN),
+	eof_(false), closing_(false), broken_(false), shutdown_(false)
+{}
+
+FastcgiConnection::~FastcgiConnection() {
+	::close(fd_);
+}
+
+int
+FastcgiConnection::fd() const {
+	return fd_;
+}
+
+bool
+FastcgiConnection::read(RequestList &ready) {
+	/* input is read by limited chunks, rest of it is reported by epoll again */
+	std::size_t chunks = 0;
+	while (chunks < READ_CHUNKS_PER_EVENT) {
+		std::size_t size = input_.size();
+		input_.resize(size + READ_CHUNK_SIZE);
+		ssize_t res = ::read(fd_, &input_[size], READ_CHUNK_SIZE);
+		input_.resize(size + (res > 0 ? res : 0));
+		if (res > 0) {
+			if (!processInput(ready)) {
+				abort();
+				return false;
+			}
+			++chunks;
+			continue;
+		}
+		if (-1 == res && EINTR == errno) {
+			continue;
+		}
+		return -1 == res && (EAGAIN == errno || EWOULDBLOCK == errno);
+	}
+	return true;
+}
+
+bool
+FastcgiConnection::processInput(RequestList &ready) {
+	std::size_t pos = 0;
+	while (input_.size() - pos >= FastcgiProtocol::HEADER_LENGTH) {
+		FastcgiProtocol::Header header = FastcgiProtocol::readHeader(
+			reinterpret_cast<const unsigned char*>(&input_[pos]));
+		std::size_t length = FastcgiProtocol::HEADER_LENGTH + header.contentLength + header.paddingLength;
+		if (input_.size() - pos < length) {
+			break;
+		}
+		if (!processRecord(header, &input_[pos] + FastcgiProtocol::HEADER_LENGTH, ready)) {
+			return false;
+		}
+		pos += length;
+	}
+	input_.erase(input_.begin(), input_.begin() + pos);
+	return true;
+}
+
+bool
+FastcgiConnection::processRecord(const FastcgiProtocol::Header &header, const char *content,
+	RequestList &ready) {
+
+	if (FastcgiProtocol::NULL_REQUEST_ID == header.requestId) {
+		if (FastcgiProtocol::GET_VALUES == header.type) {
+			getValues(content, header.contentLength);
+		}
+		else {
+			unsigned char body[8];
+			memset(body, 0, sizeof(body));
+			body[0] = header.type;
+			writeControl(FastcgiProtocol::UNKNOWN_TYPE, FastcgiProtocol::NULL_REQUEST_ID,
+				reinterpret_cast<const char*>(body), sizeof(body));
+		}
+		return true;
+	}
+
+	if (FastcgiProtocol::BEGIN_REQUEST == header.type) {
+		if (header.contentLength < 8) {
+			return false;
+		}
+		return beginRequest(header.requestId, reinterpret_cast<const unsigned char*>(content));
+	}
+	if (FastcgiProtocol::ABORT_REQUEST == header.type) {
+		abortRequest(header.requestId);
+		return true;
+	}
+
+	RequestMap::iterator it = requests_.find(header.requestId);
+	if (requests_.end() == it) {
+		return true;
+	}
+	FastcgiRequestData *data = it->second.get();
+
+	switch (header.type) {
+	case FastcgiProtocol::PARAMS:
+		if (0 == header.contentLength) {
+			data->paramsComplete = true;
+		}
+		else {
+			data->params.insert(data->params.end(), content, content + header.contentLength);
+		}
+		break;
+	case FastcgiProtocol::STDIN:
+		if (0 == header.contentLength) {
+			if (!data->paramsComplete) {
+				return false;
+			}
+			ready.push_back(it->second);
+			requests_.erase(it);
+		}
+		else {
+			data->body.insert(data->body.end(), content, content + header.contentLength);
+		}
+		break;
+	default:
+		break;
+	}
+	return true;
+}
+
+bool
+FastcgiConnection::beginRequest(unsigned short requestId, const unsigned char *body) {
+	unsigned short role = (body[0] << 8) | body[1];
+	bool keep = body[2] & FastcgiProtocol::KEEP_CONN;
+	if (FastcgiProtocol::RESPONDER != role) {
+		writeEndRequest(requestId, FastcgiProtocol::UNKNOWN_ROLE);
+		return true;
+	}
+	boost::shared_ptr<FastcgiRequestData> data(new FastcgiRequestData(requestId, keep));
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!active_.insert(std::make_pair(requestId, data)).second) {
+			return false;
+		}
+	}
+	requests_[requestId] = data;
+	return true;
+}
+
+void
+FastcgiConnection::abortRequest(unsigned short requestId) {
+	RequestMap::iterator it = requests_.find(requestId);
+	if (requests_.end() != it) {
+		requests_.erase(it);
+		queueEndRequest(requestId, NULL, 0, false);
+		return;
+	}
+
+	/* request already passed to handler is completed by it, output is dropped */
+	boost::mutex::scoped_lock lock(mutex_);
+	it = active_.find(requestId);
+	if (active_.end() != it) {
+		it->second->aborted = true;
+	}
+}
+
+void
+FastcgiConnection::getValues(const char *content, std::size_t size) {
+	std::vector<char> result;
+	const char *pos = content, *end = content + size;
+	Range name, value;
+	while (FastcgiProtocol::readNameValue(pos, end, name, value)) {
+		std::string answer;
+		if (Range::fromChars("FCGI_MPXS_CONNS") == name) {
+			answer = "1";
+		}
+		else {
+			continue;
+		}
+		unsigned char lengths[8];
+		std::size_t count = FastcgiProtocol::writeLength(lengths, name.size());
+		count += FastcgiProtocol::writeLength(lengths + count, answer.size());
+		result.insert(result.end(), lengths, lengths + count);
+		result.insert(result.end(), name.begin(), name.end());
+		result.insert(result.end(), answer.begin(), answer.end());
+	}
+	writeControl(FastcgiProtocol::GET_VALUES_RESULT, FastcgiProtocol::NULL_REQUEST_ID,
+		result.empty() ? NULL : &result[0], result.size());
+}
+
+void
+FastcgiConnection::writeControl(unsigned char type, unsigned short requestId,
+	const char *data, std::size_t size) {
+
+	struct iovec iov;
+	iov.iov_base = const_cast<char*>(data);
+	iov.iov_len = size;
+
+	std::vector<unsigned char> headers(recordsCount(size) * FastcgiProtocol::HEADER_LENGTH);
+	std::vector<struct iovec> out;
+	appendRecords(out, &headers[0], type, requestId, &iov, 1, size);
+	send(requestId, out, false, false);
+}
+
+void
+FastcgiConnection::writeRecord(unsigned char type, unsigned short requestId,
+	const char *data, std::size_t size) {
+
+	struct iovec iov;
+	iov.iov_base = const_cast<char*>(data);
+	iov.iov_len = size;
+	writeRecords(type, requestId, &iov, 1);
+}
+
+void
+FastcgiConnection::writeRecords(unsigned char type, unsigned short requestId,
+	const struct iovec *iov, int count) {
+
+	/* output is queued by parts, each part waits until previous ones of this request are sent */
+	std::size_t total = totalSize(iov, count);
+	std::size_t offset = 0;
+	std::vector<struct iovec> part;
+	do {
+		std::size_t size = std::min(total, OUTPUT_LIMIT);
+		part.clear();
+		for (std::size_t left = size; left > 0; ) {
+			std::size_t length = std::min(iov->iov_len - offset, left);
+			if (length > 0) {
+				addChunk(part, static_cast<const char*>(iov->iov_base) + offset, length);
+			}
+			left -= length;
+			offset += length;
+			if (offset == iov->iov_len) {
+				++iov;
+				offset = 0;
+			}
+		}
+
+		std::size_t records = recordsCount(size);
+		std::vector<unsigned char> headers(records * FastcgiProtocol::HEADER_LENGTH);
+		std::vector<struct iovec> out;
+		out.reserve(part.size() + 2 * records);
+		appendRecords(out, &headers[0], type, requestId, part.empty() ? NULL : &part[0], part.size(), size);
+		send(requestId, out, true, false);
+		total -= size;
+	} while (total > 0);
+}
+
+void
+FastcgiConnection::endRequest(unsigned short requestId, const char *data, std::size_t size) {
+	queueEndRequest(requestId, data, size, true);
+}
+
+void
+FastcgiConnection::rejectRequest(const FastcgiRequestData &data, const char *output, std::size_t size) {
+	/* request has no output queued yet, so it is answered from reactor thread without waiting */
+	queueEndRequest(data.id, output, size, false);
+	if (!data.keepConnection) {
+		close();
+	}
+}
+
+void
+FastcgiConnection::queueEndRequest(unsigned short requestId, const char *data, std::size_t size, bool wait) {
+	struct iovec iov;
+	iov.iov_base = const_cast<char*>(data);
+	iov.iov_len = size;
+	std::size_t records = size > 0 ? recordsCount(size) : 0;
+
+	std::vector<unsigned char> headers((records + 2) * FastcgiProtocol::HEADER_LENGTH + 8);
+	std::vector<struct iovec> out;
+	out.reserve(2 * records + 3);
+	unsigned char *header = &headers[0];
+	if (records > 0) {
+		appendRecords(out, header, FastcgiProtocol::STDOUT, requestId, &iov, 1, size);
+		header += records * FastcgiProtocol::HEADER_LENGTH;
+	}
+
+	FastcgiProtocol::writeHeader(header, FastcgiProtocol::STDOUT, requestId, 0, 0);
+	FastcgiProtocol::writeHeader(header + FastcgiProtocol::HEADER_LENGTH, FastcgiProtocol::END_REQUEST, requestId, 8, 0);
+	FastcgiProtocol::writeEndRequest(header + 2 * FastcgiProtocol::HEADER_LENGTH, 0, FastcgiProtocol::REQUEST_COMPLETE);
+	addChunk(out, header, 2 * FastcgiProtocol::HEADER_LENGTH + 8);
+
+	send(requestId, out, wait, true);
+}
+
+void
+FastcgiConnection::send(unsigned short requestId, std::vector<struct iovec> &out, bool wait, bool last) {
+	boost::mutex::scoped_lock lock(mutex_);
+	if (wait) {
+		waitOutput(lock, requestId);
+	}
+	if (last) {
+		active_.erase(requestId);
+	}
+	if (broken_) {
+		throw std::runtime_error("fastcgi connection is closed");
+	}
+
+	std::size_t written = 0;
+	if (output_.empty()) {
+		try {
+			written = FastcgiIO::writeSome(fd_, &out[0], out.size());
+		}
+		catch (...) {
+			abortOutput();
+			throw;
+		}
+	}
+	queueData(requestId, &out[0], out.size(), written);
+	updateEvents();
+}
+
+void
+FastcgiConnection::waitOutput(boost::mutex::scoped_lock &lock, unsigned short requestId) {
+	while (!broken_) {
+		std::map<unsigned short, boost::uint64_t>::iterator it = pending_.find(requestId);
+		if (pending_.end() == it || it->second < OUTPUT_LIMIT) {
+			return;
+		}
+		written_.wait(lock);
+	}
+}
+
+void
+FastcgiConnection::queueData(unsigned short requestId, const struct iovec *iov, int count, std::size_t skip) {
+	std::size_t total = totalSize(iov, count);
+	if (skip >= total) {
+		return;
+	}
+	output_.push_back(OutputChunk());
+	OutputChunk &chunk = output_.back();
+	chunk.requestId = requestId;
+	chunk.data.reserve(total - skip);
+	for (int i = 0; i < count; ++i) {
+		const char *base = static_cast<const char*>(iov[i].iov_base);
+		std::size_t part = std::min(skip, iov[i].iov_len);
+		chunk.data.insert(chunk.data.end(), base + part, base + iov[i].iov_len);
+		skip -= part;
+	}
+	chunk.offset = 0;
+	chunk.length = chunk.data.size();
+	pending_[requestId] += chunk.length;
+}
+
+void
+FastcgiConnection::flushOutput() {
+	struct iovec iov[FLUSH_IOV_COUNT];
+	while (!output_.empty()) {
+		std::size_t written = 0;
+		if (output_.front().file) {
+			const OutputChunk &chunk = output_.front();
+			written = FastcgiIO::sendSome(fd_, *chunk.file, chunk.offset, chunk.length);
+		}
+		else {
+			int count = 0;
+			for (std::deque<OutputChunk>::iterator it = output_.begin();
+				 it != output_.end() && count < FLUSH_IOV_COUNT && !it->file;
+				 ++it, ++count) {
+				iov[count].iov_base = &it->data[it->offset];
+				iov[count].iov_len = it->length;
+			}
+			written = FastcgiIO::writeSome(fd_, iov, count);
+		}
+		if (0 == written) {
+			break;
+		}
+
+		while (written > 0) {
+			OutputChunk &chunk = output_.front();
+			std::size_t part = std::min(static_cast<boost::uint64_t>(written), chunk.length);
+			chunk.offset += part;
+			chunk.length -= part;
+			written -= part;
+			std::map<unsigned short, boost::uint64_t>::iterator it = pending_.find(chunk.requestId);
+			if (pending_.end() != it && 0 == (it->second -= part)) {
+				pending_.erase(it);
+			}
+			if (0 == chunk.length) {
+				output_.pop_front();
+			}
+		}
+	}
+	written_.notify_all();
+}
+
+void
+FastcgiConnection::updateEvents() {
+	if (broken_) {
+		return;
+	}
+	if (output_.empty() && !shutdown_ && (closing_ || (eof_ && active_.empty()))) {
+		shutdown(fd_, SHUT_RDWR);
+		shutdown_ = true;
+	}
+
+	unsigned int events = 0;
+	if (!eof_) {
+		events |= EPOLLIN;
+	}
+	if (!output_.empty()) {
+		events |= EPOLLOUT;
+	}
+	if (events != events_) {
+		/* fails when reactor has already dropped connection, which is closed then */
+		struct epoll_event event;
+		event.events = events;
+		event.data.fd = fd_;
+		epoll_ctl(epoll_, EPOLL_CTL_MOD, fd_, &event);
+		events_ = events;
+	}
+}
+
+void
+FastcgiConnection::abortOutput() {
+	broken_ = true;
+	output_.clear();
+	pending_.clear();
+	written_.notify_all();
+	if (!shutdown_) {
+		shutdown(fd_, SHUT_RDWR);
+		shutdown_ = true;
+	}
+}
+
+void
+FastcgiConnection::flush() {
+	boost::mutex::scoped_lock lock(mutex_);
+	try {
+		flushOutput();
+	}
+	catch (...) {
+		abortOutput();
+		throw;
+	}
+	updateEvents();
+}
+
+bool
+FastcgiConnection::finish() {
+	boost::mutex::scoped_lock lock(mutex_);
+	eof_ = true;
+	for (RequestMap::iterator it = requests_.begin(); it != requests_.end(); ++it) {
+		active_.erase(it->first);
+	}
+	requests_.clear();
+	if (broken_ || (active_.empty() && output_.empty())) {
+		return true;
+	}
+	updateEvents();
+	return false;
+}
+
+void
+FastcgiConnection::abort() {
+	boost::mutex::scoped_lock lock(mutex_);
+	abortOutput();
+}
+
+std::size_t
+FastcgiConnection::totalSize(const struct iovec *iov, int count) {
+	std::size_t total = 0;
+	for (int i = 0; i < count; ++i) {
+		total += iov[i].iov_len;
+	}
+	return total;
+}
+
+std::size_t
+FastcgiConnection::recordsCount(std::size_t size) {
+	return std::max((size + MAX_RECORD_CONTENT - 1) / MAX_RECORD_CONTENT, static_cast<std::size_t>(1));
+}
+
+void
+FastcgiConnection::appendRecords(std::vector<struct iovec> &out, unsigned char *headers,
+	unsigned char type, unsigned short requestId, const struct iovec *iov, int count, std::size_t total) {
+
+	static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	std::size_t offset = 0;
+	std::size_t records = recordsCount(total);
+	for (std::size_t r = 0; r < records; ++r) {
+		std::size_t length = std::min(total, MAX_RECORD_CONTENT);
+		unsigned char pad = static_cast<unsigned char>((8 - length % 8) % 8);
+		unsigned char *header = headers + r * FastcgiProtocol::HEADER_LENGTH;
+		FastcgiProtocol::writeHeader(header, type, requestId, length, pad);
+		addChunk(out, header, FastcgiProtocol::HEADER_LENGTH);
+
+		std::size_t left = length;
+		while (left > 0 && count > 0) {
+			std::size_t part = std::min(iov->iov_len - offset, left);
+			if (part > 0) {
+				addChunk(out, static_cast<const char*>(iov->iov_base) + offset, part);
+			}
+			left -= part;
+			offset += part;
+			if (offset == iov->iov_len) {
+				++iov;
+				--count;
+				offset = 0;
+			}
+		}
+		if (pad > 0) {
+			addChunk(out, padding, pad);
+		}
+		total -= length;
+	}
+}
+
+void
+FastcgiConnection::writeEndRequest(unsigned short requestId, unsigned char protocolStatus) {
+	unsigned char body[8];
+	FastcgiProtocol::writeEndRequest(body, 0, protocolStatus);
+	writeControl(FastcgiProtocol::END_REQUEST, requestId, reinterpret_cast<const char*>(body), sizeof(body));
+}
+
+void
+FastcgiConnection::writeFile(unsigned short requestId, int fd, boost::uint64_t offset, boost::uint64_t length) {
+	static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	/* file is sent by reactor after caller returns, so it keeps its own descriptor */
+	int copy = dup(fd);
+	if (-1 == copy) {
+		throw std::runtime_error("Cannot duplicate descriptor of file to send");
+	}
+	boost::shared_ptr<int> file(new int(copy), closeFile);
+
+	while (length > 0) {
+		std::size_t size = std::min(length, static_cast<boost::uint64_t>(MAX_RECORD_CONTENT));
+		unsigned char pad = static_cast<unsigned char>((8 - size % 8) % 8);
+		unsigned char header[FastcgiProtocol::HEADER_LENGTH];
+		FastcgiProtocol::writeHeader(header, FastcgiProtocol::STDOUT, requestId, size, pad);
+
+		boost::mutex::scoped_lock lock(mutex_);
+		waitOutput(lock, requestId);
+		if (broken_) {
+			throw std::runtime_error("fastcgi connection is closed");
+		}
+
+		struct iovec iov;
+		iov.iov_base = header;
+		iov.iov_len = sizeof(header);
+		queueData(requestId, &iov, 1, 0);
+
+		output_.push_back(OutputChunk());
+		OutputChunk &chunk = output_.back();
+		chunk.requestId = requestId;
+		chunk.file = file;
+		chunk.offset = offset;
+		chunk.length = size;
+		pending_[requestId] += size;
+
+		if (pad > 0) {
+			iov.iov_base = const_cast<char*>(padding);
+			iov.iov_len = pad;
+			queueData(requestId, &iov, 1, 0);
+		}
+
+		try {
+			flushOutput();
+		}
+		catch (...) {
+			abortOutput();
+			throw;
+		}
+		updateEvents();
+
+		offset += size;
+		length -= size;
+	}
+}
+
+void
+FastcgiConnection::close() {
+	boost::mutex::scoped_lock lock(mutex_);
+	closing_ = true;
+	updateEvents();
+}
+
+} // namespace fastcgi
@@ -0,0 +1,121 @@
+#ifndef _FASTCGI_FASTCGI_CONNECTION_H_
+#define _FASTCGI_FASTCGI_CONNECTION_H_
+
+#include <sys/uio.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+#include "fastcgi2/data_buffer.h"
+
+#include "fcgi_protocol.h"
+
+namespace fastcgi
+{
+
+struct FastcgiRequestData {
+	FastcgiRequestData(unsigned short requestId, bool keep) :
+		id(requestId), keepConnection(keep), paramsComplete(false), aborted(false)
+	{}
+	unsigned short id;
+	bool keepConnection;
+	bool paramsComplete;
+	volatile bool aborted;
+	std::vector<char> params;
+	std::vector<char> body;
+	DataBuffer bodyFile;
+};
+
+/**
+ * Non-blocking FastCGI connection owned by reactor.
+ * Reactor thread feeds incoming records and collects requests with complete params and stdin
+ * in memory, it never touches disk: large stdin is moved to request cache by prepare threads.
+ * Response records are written by pool threads without waiting for socket, output which
+ * does not fit into it is queued and sent by reactor when socket becomes writable.
+ * Each request may have limited amount of queued output, so large response waits
+ * for the socket in its own thread and does not hold back other requests.
+ * Several requests may be multiplexed over one connection, which is kept open
+ * while web server asks for FCGI_KEEP_CONN.
+ */
+
+class FastcgiConnection : private boost::noncopyable {
+public:
+	typedef std::vector<boost::shared_ptr<FastcgiRequestData> > RequestList;
+
+	FastcgiConnection(int fd, int epoll);
+	virtual ~FastcgiConnection();
+
+	int fd() const;
+
+	bool read(RequestList &ready);
+	void flush();
+	bool finish();
+	void abort();
+
+	void writeRecord(unsigned char type, unsigned short requestId, const char *data, std::size_t size);
+	void writeRecords(unsigned char type, unsigned short requestId, const struct iovec *iov, int count);
+	void writeFile(unsigned short requestId, int fd, boost::uint64_t offset, boost::uint64_t length);
+	void endRequest(unsigned short requestId, const char *data = NULL, std::size_t size = 0);
+	void rejectRequest(const FastcgiRequestData &data, const char *output, std::size_t size);
+	void close();
+
+	static std::size_t totalSize(const struct iovec *iov, int count);
+
+private:
+	struct OutputChunk {
+		unsigned short requestId;
+		std::vector<char> data;
+		boost::shared_ptr<int> file;
+		boost::uint64_t offset;
+		boost::uint64_t length;
+	};
+
+	void writeControl(unsigned char type, unsigned short requestId, const char *data, std::size_t size);
+	void writeEndRequest(unsigned short requestId, unsigned char protocolStatus);
+	void queueEndRequest(unsigned short requestId, const char *data, std::size_t size, bool wait);
+	void send(unsigned short requestId, std::vector<struct iovec> &out, bool wait, bool last);
+	void waitOutput(boost::mutex::scoped_lock &lock, unsigned short requestId);
+	void queueData(unsigned short requestId, const struct iovec *iov, int count, std::size_t skip);
+	void flushOutput();
+	void updateEvents();
+	void abortOutput();
+
+	bool processInput(RequestList &ready);
+	bool processRecord(const FastcgiProtocol::Header &header, const char *content, RequestList &ready);
+	bool beginRequest(unsigned short requestId, const unsigned char *body);
+	void abortRequest(unsigned short requestId);
+	void getValues(const char *content, std::size_t size);
+
+	static std::size_t recordsCount(std::size_t size);
+	static void appendRecords(std::vector<struct iovec> &out, unsigned char *headers, unsigned char type,
+		unsigned short requestId, const struct iovec *iov, int count, std::size_t total);
+
+private:
+	int fd_;
+	int epoll_;
+	std::vector<char> input_;
+	typedef std::map<unsigned short, boost::shared_ptr<FastcgiRequestData> > RequestMap;
+	RequestMap requests_;
+	RequestMap active_;
+
+	std::deque<OutputChunk> output_;
+	std::map<unsigned short, boost::uint64_t> pending_;
+	boost::condition written_;
+	unsigned int events_;
+	bool eof_;
+	bool closing_;
+	bool broken_;
+	bool shutdown_;
+	boost::mutex mutex_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_FASTCGI_CONNECTION_H_
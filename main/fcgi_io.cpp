@@ -0,0 +1,211 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include "fcgi_io.h"
+#include "fcgi_protocol.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const boost::uint64_t MAX_RECORD_CONTENT = 65528;
+static const std::size_t COPY_CHUNK_SIZE = 65536;
+
+void
+FastcgiIO::writeAll(int socket, struct iovec *iov, int count, int flags) {
+	while (count > 0) {
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = std::min(count, IOV_MAX);
+
+		ssize_t res = sendmsg(socket, &msg, flags | MSG_NOSIGNAL);
+		if (-1 == res) {
+			if (EINTR == errno) {
+				continue;
+			}
+			if (EAGAIN == errno || EWOULDBLOCK == errno) {
+				waitWritable(socket);
+				continue;
+			}
+			throwError("Cannot write data to fastcgi socket: ", errno);
+		}
+
+		std::size_t written = res;
+		while (count > 0 && written >= iov->iov_len) {
+			written -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count > 0) {
+			iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+			iov->iov_len -= written;
+		}
+	}
+}
+
+void
+FastcgiIO::sendFile(int socket, int fd, boost::uint64_t offset, boost::uint64_t length) {
+	off_t pos = offset;
+	while (length > 0) {
+		ssize_t res = sendfile(socket, fd, &pos, std::min(length, static_cast<boost::uint64_t>(INT_MAX)));
+		if (res > 0) {
+			length -= res;
+			continue;
+		}
+		if (0 == res) {
+			throw std::runtime_error("Cannot send file to fastcgi socket: unexpected end of file");
+		}
+		if (EINTR == errno) {
+			continue;
+		}
+		if (EAGAIN == errno || EWOULDBLOCK == errno) {
+			waitWritable(socket);
+			continue;
+		}
+		if (EINVAL != errno && ENOSYS != errno) {
+			throwError("Cannot send file to fastcgi socket: ", errno);
+		}
+
+		/* sendfile is not supported for this pair of descriptors */
+		char buffer[COPY_CHUNK_SIZE];
+		while (length > 0) {
+			ssize_t size = pread(fd, buffer, std::min(length, static_cast<boost::uint64_t>(sizeof(buffer))), pos);
+			if (-1 == size && EINTR == errno) {
+				continue;
+			}
+			if (size <= 0) {
+				throwError("Cannot read file to send: ", size < 0 ? errno : EIO);
+			}
+			struct iovec iov;
+			iov.iov_base = buffer;
+			iov.iov_len = size;
+			writeAll(socket, &iov, 1);
+			pos += size;
+			length -= size;
+		}
+	}
+}
+
+void
+FastcgiIO::writeFileRecords(int socket, unsigned short requestId,
+	int fd, boost::uint64_t offset, boost::uint64_t length) {
+
+	static const char padding[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	while (length > 0) {
+		boost::uint64_t size = std::min(length, MAX_RECORD_CONTENT);
+		unsigned char pad = static_cast<unsigned char>((8 - size % 8) % 8);
+
+		unsigned char header[FastcgiProtocol::HEADER_LENGTH];
+		FastcgiProtocol::writeHeader(header, FastcgiProtocol::STDOUT, requestId, size, pad);
+		struct iovec iov;
+		iov.iov_base = header;
+		iov.iov_len = sizeof(header);
+		writeAll(socket, &iov, 1, MSG_MORE);
+
+		sendFile(socket, fd, offset, size);
+
+		if (pad > 0) {
+			iov.iov_base = const_cast<char*>(padding);
+			iov.iov_len = pad;
+			writeAll(socket, &iov, 1, MSG_MORE);
+		}
+		offset += size;
+		length -= size;
+	}
+}
+
+std::size_t
+FastcgiIO::writeSome(int socket, const struct iovec *iov, int count) {
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = const_cast<struct iovec*>(iov);
+	msg.msg_iovlen = std::min(count, IOV_MAX);
+	while (true) {
+		ssize_t res = sendmsg(socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (res >= 0) {
+			return res;
+		}
+		if (EINTR == errno) {
+			continue;
+		}
+		if (EAGAIN == errno || EWOULDBLOCK == errno) {
+			return 0;
+		}
+		throwError("Cannot write data to fastcgi socket: ", errno);
+	}
+}
+
+std::size_t
+FastcgiIO::sendSome(int socket, int fd, boost::uint64_t offset, boost::uint64_t length) {
+	off_t pos = offset;
+	while (true) {
+		ssize_t res = sendfile(socket, fd, &pos, std::min(length, static_cast<boost::uint64_t>(INT_MAX)));
+		if (res > 0) {
+			return res;
+		}
+		if (0 == res) {
+			throw std::runtime_error("Cannot send file to fastcgi socket: unexpected end of file");
+		}
+		if (EINTR == errno) {
+			continue;
+		}
+		if (EAGAIN == errno || EWOULDBLOCK == errno) {
+			return 0;
+		}
+		if (EINVAL != errno && ENOSYS != errno) {
+			throwError("Cannot send file to fastcgi socket: ", errno);
+		}
+		break;
+	}
+
+	/* sendfile is not supported for this pair of descriptors, part which is read but not written is read again */
+	char buffer[COPY_CHUNK_SIZE];
+	ssize_t size = -1;
+	do {
+		size = pread(fd, buffer, std::min(length, static_cast<boost::uint64_t>(sizeof(buffer))), offset);
+	} while (-1 == size && EINTR == errno);
+	if (size <= 0) {
+		throwError("Cannot read file to send: ", size < 0 ? errno : EIO);
+	}
+	struct iovec iov;
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+	return writeSome(socket, &iov, 1);
+}
+
+void
+FastcgiIO::waitWritable(int socket) {
+	struct pollfd pfd;
+	pfd.fd = socket;
+	pfd.events = POLLOUT;
+	pfd.revents = 0;
+	if (-1 == poll(&pfd, 1, -1) && EINTR != errno) {
+		throwError("Cannot wait for fastcgi socket: ", errno);
+	}
+}
+
+void
+FastcgiIO::throwError(const char *message, int error) {
+	char buffer[256];
+	std::stringstream str;
+	str << message << strerror_r(error, buffer, sizeof(buffer));
+	throw std::runtime_error(str.str());
+}
+
+} // namespace fastcgi
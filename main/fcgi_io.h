@@ -0,0 +1,36 @@
+#ifndef _FASTCGI_FASTCGI_IO_H_
+#define _FASTCGI_FASTCGI_IO_H_
+
+#include <sys/uio.h>
+
+#include <cstddef>
+
+#include <boost/cstdint.hpp>
+
+namespace fastcgi
+{
+
+/**
+ * Raw socket output shared by libfcgi and epoll endpoints.
+ * File payload is moved to the socket by sendfile without copying it to user space.
+ * writeSome and sendSome never wait for socket and return number of bytes written.
+ */
+
+class FastcgiIO {
+public:
+	static void writeAll(int socket, struct iovec *iov, int count, int flags = 0);
+	static void sendFile(int socket, int fd, boost::uint64_t offset, boost::uint64_t length);
+	static void writeFileRecords(int socket, unsigned short requestId,
+		int fd, boost::uint64_t offset, boost::uint64_t length);
+
+	static std::size_t writeSome(int socket, const struct iovec *iov, int count);
+	static std::size_t sendSome(int socket, int fd, boost::uint64_t offset, boost::uint64_t length);
+
+private:
+	static void waitWritable(int socket);
+	static void throwError(const char *message, int error);
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_FASTCGI_IO_H_
@@ -0,0 +1,131 @@
+#ifndef _FASTCGI_FASTCGI_PROTOCOL_H_
+#define _FASTCGI_FASTCGI_PROTOCOL_H_
+
+#include <cstddef>
+
+#include "details/range.h"
+
+namespace fastcgi
+{
+
+/**
+ * FastCGI wire protocol definitions used by native (non libfcgi) endpoints
+ */
+
+struct FastcgiProtocol {
+	enum RecordType {
+		BEGIN_REQUEST = 1,
+		ABORT_REQUEST = 2,
+		END_REQUEST = 3,
+		PARAMS = 4,
+		STDIN = 5,
+		STDOUT = 6,
+		STDERR = 7,
+		DATA = 8,
+		GET_VALUES = 9,
+		GET_VALUES_RESULT = 10,
+		UNKNOWN_TYPE = 11
+	};
+
+	enum ProtocolStatus {
+		REQUEST_COMPLETE = 0,
+		CANT_MPX_CONN = 1,
+		OVERLOADED = 2,
+		UNKNOWN_ROLE = 3
+	};
+
+	enum {
+		VERSION_1 = 1,
+		HEADER_LENGTH = 8,
+		MAX_CONTENT_LENGTH = 65535,
+		NULL_REQUEST_ID = 0,
+		RESPONDER = 1,
+		KEEP_CONN = 1
+	};
+
+	struct Header {
+		unsigned char type;
+		unsigned short requestId;
+		unsigned short contentLength;
+		unsigned char paddingLength;
+	};
+
+	static void writeHeader(unsigned char *buf, unsigned char type, unsigned short requestId,
+		unsigned short contentLength, unsigned char paddingLength) {
+		buf[0] = VERSION_1;
+		buf[1] = type;
+		buf[2] = static_cast<unsigned char>(requestId >> 8);
+		buf[3] = static_cast<unsigned char>(requestId);
+		buf[4] = static_cast<unsigned char>(contentLength >> 8);
+		buf[5] = static_cast<unsigned char>(contentLength);
+		buf[6] = paddingLength;
+		buf[7] = 0;
+	}
+
+	static Header readHeader(const unsigned char *buf) {
+		Header header;
+		header.type = buf[1];
+		header.requestId = (buf[2] << 8) | buf[3];
+		header.contentLength = (buf[4] << 8) | buf[5];
+		header.paddingLength = buf[6];
+		return header;
+	}
+
+	static void writeEndRequest(unsigned char *buf, unsigned int appStatus, unsigned char protocolStatus) {
+		buf[0] = static_cast<unsigned char>(appStatus >> 24);
+		buf[1] = static_cast<unsigned char>(appStatus >> 16);
+		buf[2] = static_cast<unsigned char>(appStatus >> 8);
+		buf[3] = static_cast<unsigned char>(appStatus);
+		buf[4] = protocolStatus;
+		buf[5] = buf[6] = buf[7] = 0;
+	}
+
+	static bool readLength(const unsigned char *&pos, const unsigned char *end, std::size_t &length) {
+		if (pos >= end) {
+			return false;
+		}
+		if (0 == (*pos & 0x80)) {
+			length = *pos++;
+			return true;
+		}
+		if (end - pos < 4) {
+			return false;
+		}
+		length = ((pos[0] & 0x7f) << 24) | (pos[1] << 16) | (pos[2] << 8) | pos[3];
+		pos += 4;
+		return true;
+	}
+
+	static bool readNameValue(const char *&pos, const char *end, Range &name, Range &value) {
+		const unsigned char *p = reinterpret_cast<const unsigned char*>(pos);
+		const unsigned char *e = reinterpret_cast<const unsigned char*>(end);
+		std::size_t nameLength = 0, valueLength = 0;
+		if (!readLength(p, e, nameLength) || !readLength(p, e, valueLength)) {
+			return false;
+		}
+		const char *data = reinterpret_cast<const char*>(p);
+		if (static_cast<std::size_t>(end - data) < nameLength + valueLength) {
+			return false;
+		}
+		name = Range(data, data + nameLength);
+		value = Range(data + nameLength, data + nameLength + valueLength);
+		pos = data + nameLength + valueLength;
+		return true;
+	}
+
+	static std::size_t writeLength(unsigned char *buf, std::size_t length) {
+		if (length < 0x80) {
+			buf[0] = static_cast<unsigned char>(length);
+			return 1;
+		}
+		buf[0] = static_cast<unsigned char>((length >> 24) | 0x80);
+		buf[1] = static_cast<unsigned char>(length >> 16);
+		buf[2] = static_cast<unsigned char>(length >> 8);
+		buf[3] = static_cast<unsigned char>(length);
+		return 4;
+	}
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_FASTCGI_PROTOCOL_H_
@@ -5,6 +5,7 @@
 #include <boost/lexical_cast.hpp>
 
 #include "endpoint.h"
+#include "fcgi_io.h"
 #include "fcgi_request.h"
 
 #include "fastcgi2/logger.h"
@@ -20,18 +21,26 @@ namespace fastcgi
 {
 
 static const std::string DAEMON_STRING = "fastcgi-daemon";
+static const std::size_t OUTPUT_CHUNK_SIZE = 4096;
 
-FastcgiRequest::FastcgiRequest(boost::shared_ptr<Request> request, Endpoint *endpoint,
-        Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes) :
-    request_(request), logger_(logger), endpoint_(endpoint),
-    statistics_(statistics), logTimes_(logTimes), handler_(NULL)
-{
-    if (0 != FCGX_InitRequest(&fcgiRequest_, endpoint_->socket(), 0)) {
-        throw std::runtime_error("can not init fastcgi request");
+FastcgiRequestBase::FastcgiRequestBase(boost::shared_ptr<Request> request, Logger *logger,
+        ResponseTimeStatistics *statistics, const bool logTimes) :
+    request_(request), logger_(logger), statistics_(statistics),
+    logTimes_(logTimes), handler_(NULL)
+{}
+
+FastcgiRequestBase::~FastcgiRequestBase() {
+}
+
+void
+FastcgiRequestBase::markAccepted() {
+    if (logTimes_ || statistics_) {
+        gettimeofday(&accept_time_, NULL);
     }
 }
 
-FastcgiRequest::~FastcgiRequest() {
+void
+FastcgiRequestBase::updateStatistics() {
     boost::uint64_t microsec = 0;
     if (logTimes_ || statistics_) {
         gettimeofday(&finish_time_, NULL);
@@ -56,13 +65,43 @@ FastcgiRequest::~FastcgiRequest() {
             logger_->error("Unknown exception caught while update statistics");
         }
     }
+}
 
+void
+FastcgiRequestBase::setHandlerDesc(const HandlerSet::HandlerDescription *handler) {
+    handler_ = handler;
+}
+
+Request*
+FastcgiRequestBase::request() const {
+    return request_.get();
+}
+
+FastcgiRequest::FastcgiRequest(boost::shared_ptr<Request> request, Endpoint *endpoint,
+        Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes) :
+    FastcgiRequestBase(request, logger, statistics, logTimes), endpoint_(endpoint)
+{
+    if (0 != FCGX_InitRequest(&fcgiRequest_, endpoint_->socket(), 0)) {
+        throw std::runtime_error("can not init fastcgi request");
+    }
+}
+
+FastcgiRequest::~FastcgiRequest() {
+}
+
+void
+FastcgiRequest::finish() {
+    updateStatistics();
     FCGX_Finish_r(&fcgiRequest_);
+    handler_ = NULL;
+    url_.clear();
+    request_->saveToCache();
+    request_->reset();
 }
 
 void
 FastcgiRequest::attach() {
-    request_->attach(this, fcgiRequest_.envp);
+    request_->attachHeaders(this, fcgiRequest_.envp);
     char **envp = fcgiRequest_.envp;
     for (std::size_t i = 0; envp[i]; ++i) {
         if (0 == strncasecmp(envp[i], "REQUEST_URI=", sizeof("REQUEST_URI=") - 1)) {
@@ -75,8 +114,8 @@ FastcgiRequest::attach() {
 int
 FastcgiRequest::accept() {
     int status = FCGX_Accept_r(&fcgiRequest_);
-    if (status >= 0 && (logTimes_|| statistics_)) {
-        gettimeofday(&accept_time_, NULL);
+    if (status >= 0) {
+        markAccepted();
     }
     return status;
 }
@@ -119,37 +158,56 @@ generateRequestInfo(const Request *request, std::stringstream &str) {
     str << ". Args: " << result;
 }
 
+static void
+throwWriteError(const Request *request, int error) {
+    std::stringstream str;
+    if (error > 0) {
+        char buffer[256];
+        str << "Cannot write data to fastcgi socket: " <<
+            strerror_r(error, buffer, sizeof(buffer)) << ". ";
+    }
+    else {
+        str << "FastCGI error. ";
+    }
+    generateRequestInfo(request, str);
+    throw std::runtime_error(str.str());
+}
+
 int
 FastcgiRequest::write(const char *buf, int size) {
     int num = FCGX_PutStr(buf, size, fcgiRequest_.out);
     if (-1 == num) {
-        std::stringstream str;
-        int error = FCGX_GetError(fcgiRequest_.out);
-        if (error > 0) {
-            char buffer[256];
-            str << "Cannot write data to fastcgi socket: " <<
-                strerror_r(error, buffer, sizeof(buffer)) << ". ";
-        }
-        else {
-            str << "FastCGI error. ";
-        }
-        generateRequestInfo(request_.get(), str);
-        throw std::runtime_error(str.str());
+        throwWriteError(request_.get(), FCGX_GetError(fcgiRequest_.out));
     }
     return num;
 }
 
 void
 FastcgiRequest::write(std::streambuf *buf) {
-    std::vector<char> outv(4096);
-    fcgi_streambuf outbuf(fcgiRequest_.out, &outv[0], outv.size());
-    std::ostream os(&outbuf);
-    os << buf;
+    char chunk[OUTPUT_CHUNK_SIZE];
+    while (true) {
+        std::streamsize size = buf->sgetn(chunk, sizeof(chunk));
+        if (size <= 0) {
+            break;
+        }
+        write(chunk, size);
+    }
 }
 
 void
-FastcgiRequest::setHandlerDesc(const HandlerSet::HandlerDescription *handler) {
-    handler_ = handler;
+FastcgiRequest::writeFile(int fd, boost::uint64_t offset, boost::uint64_t length) {
+    if (-1 == FCGX_FFlush(fcgiRequest_.out)) {
+        throwWriteError(request_.get(), FCGX_GetError(fcgiRequest_.out));
+    }
+    try {
+        FastcgiIO::writeFileRecords(fcgiRequest_.ipcFd, fcgiRequest_.requestId, fd, offset, length);
+    }
+    catch (const std::exception &e) {
+        std::stringstream str;
+        str << e.what() << ". ";
+        generateRequestInfo(request_.get(), str);
+        throw std::runtime_error(str.str());
+    }
 }
 
 } // namespace fastcgi
@@ -22,29 +22,46 @@ class Logger;
 class Request;
 class ResponseTimeStatistics;
 
-class FastcgiRequest : public RequestIOStream {
+class FastcgiRequestBase : public RequestIOStream {
+public:
+    FastcgiRequestBase(boost::shared_ptr<Request> request, Logger *logger,
+        ResponseTimeStatistics *statistics, const bool logTimes);
+    virtual ~FastcgiRequestBase();
+
+    void setHandlerDesc(const HandlerSet::HandlerDescription *handler);
+    Request* request() const;
+
+protected:
+    void markAccepted();
+    void updateStatistics();
+
+protected:
+    boost::shared_ptr<Request> request_;
+    Logger *logger_;
+    std::string url_;
+    ResponseTimeStatistics *statistics_;
+    const bool logTimes_;
+    timeval accept_time_, finish_time_;
+    const HandlerSet::HandlerDescription* handler_;
+};
+
+class FastcgiRequest : public FastcgiRequestBase {
 public:
     FastcgiRequest(boost::shared_ptr<Request> request, Endpoint *endpoint,
     	Logger *logger, ResponseTimeStatistics *statistics, const bool logTimes);
     virtual ~FastcgiRequest();
     void attach();
 	int accept();
+	void finish();
 
 	int read(char *buf, int size);
 	int write(const char *buf, int size);
 	void write(std::streambuf *buf);
+	void writeFile(int fd, boost::uint64_t offset, boost::uint64_t length);
 
-	void setHandlerDesc(const HandlerSet::HandlerDescription *handler);
 private:
-	boost::shared_ptr<Request> request_;
-    Logger *logger_;
-    std::string url_;
     Endpoint *endpoint_;
     FCGX_Request fcgiRequest_;
-    ResponseTimeStatistics *statistics_;
-	const bool logTimes_;
-    timeval accept_time_, finish_time_;
-    const HandlerSet::HandlerDescription* handler_;
 };
 
 } // namespace fastcgi
@@ -0,0 +1,83 @@
+#include "settings.h"
+
+#include <stdexcept>
+
+#include "fcgi_request.h"
+#include "fcgi_request_pool.h"
+
+#include "fastcgi2/logger.h"
+#include "fastcgi2/request.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const std::size_t MAX_FREE_REQUESTS = 64;
+
+FastcgiRequestPool::Recycler::Recycler(boost::shared_ptr<FastcgiRequestPool> pool) :
+	pool_(pool)
+{}
+
+void
+FastcgiRequestPool::Recycler::operator () (FastcgiRequest *request) const {
+	pool_->release(request);
+}
+
+FastcgiRequestPool::FastcgiRequestPool(Endpoint *endpoint, Logger *logger, RequestCache *cache,
+	ResponseTimeStatistics *statistics, bool logTimes) :
+	endpoint_(endpoint), logger_(logger), cache_(cache), statistics_(statistics), logTimes_(logTimes)
+{}
+
+FastcgiRequestPool::~FastcgiRequestPool() {
+	for (std::vector<FastcgiRequest*>::iterator i = free_.begin(), end = free_.end(); i != end; ++i) {
+		delete *i;
+	}
+}
+
+boost::shared_ptr<FastcgiRequest>
+FastcgiRequestPool::acquire() {
+	FastcgiRequest *request = NULL;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!free_.empty()) {
+			request = free_.back();
+			free_.pop_back();
+		}
+	}
+	if (NULL == request) {
+		boost::shared_ptr<Request> req(new Request(logger_, cache_));
+		request = new FastcgiRequest(req, endpoint_, logger_, statistics_, logTimes_);
+	}
+	return boost::shared_ptr<FastcgiRequest>(request, Recycler(shared_from_this()));
+}
+
+void
+FastcgiRequestPool::release(FastcgiRequest *request) {
+	try {
+		request->finish();
+	}
+	catch (const std::exception &e) {
+		logger_->error("caught exception while finishing request: %s", e.what());
+		delete request;
+		return;
+	}
+	catch (...) {
+		logger_->error("caught unknown exception while finishing request");
+		delete request;
+		return;
+	}
+
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (free_.size() < MAX_FREE_REQUESTS) {
+			free_.push_back(request);
+			return;
+		}
+	}
+	delete request;
+}
+
+} // namespace fastcgi
@@ -0,0 +1,60 @@
+#ifndef _FASTCGI_FASTCGI_REQUEST_POOL_H_
+#define _FASTCGI_FASTCGI_REQUEST_POOL_H_
+
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/enable_shared_from_this.hpp>
+
+namespace fastcgi
+{
+
+class Endpoint;
+class FastcgiRequest;
+class Logger;
+class RequestCache;
+class ResponseTimeStatistics;
+
+/**
+ * Free list of FastcgiRequest objects (with their Request) owned by endpoint thread.
+ * Request is finished and returned to the list when last reference to it is dropped,
+ * which may happen in any thread.
+ */
+
+class FastcgiRequestPool : public boost::enable_shared_from_this<FastcgiRequestPool>,
+	private boost::noncopyable {
+public:
+	FastcgiRequestPool(Endpoint *endpoint, Logger *logger, RequestCache *cache,
+		ResponseTimeStatistics *statistics, bool logTimes);
+	virtual ~FastcgiRequestPool();
+
+	boost::shared_ptr<FastcgiRequest> acquire();
+
+private:
+	class Recycler {
+	public:
+		Recycler(boost::shared_ptr<FastcgiRequestPool> pool);
+		void operator () (FastcgiRequest *request) const;
+
+	private:
+		boost::shared_ptr<FastcgiRequestPool> pool_;
+	};
+
+	void release(FastcgiRequest *request);
+
+private:
+	Endpoint *endpoint_;
+	Logger *logger_;
+	RequestCache *cache_;
+	ResponseTimeStatistics *statistics_;
+	bool logTimes_;
+
+	boost::mutex mutex_;
+	std::vector<FastcgiRequest*> free_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_FASTCGI_REQUEST_POOL_H_
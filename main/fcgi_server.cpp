@@ -21,8 +21,12 @@
 #include <sys/time.h>
 
 #include "endpoint.h"
+#include "fcgi_async_request.h"
+#include "fcgi_connection.h"
 #include "fcgi_request.h"
+#include "fcgi_request_pool.h"
 #include "fcgi_server.h"
+#include "reactor.h"
 
 #include "fastcgi2/util.h"
 #include "fastcgi2/config.h"
@@ -39,6 +43,7 @@
 #include "details/handler_context.h"
 #include "details/handlerset.h"
 #include "details/loader.h"
+#include "details/parser.h"
 #include "details/request_cache.h"
 #include "details/request_thread_pool.h"
 #include "details/thread_pool.h"
@@ -50,6 +55,17 @@
 namespace fastcgi
 {
 
+static const int REACTOR_WAIT_TIMEOUT = 1000;
+static const unsigned PREPARE_QUEUE_LENGTH = 4096;
+
+static const std::string&
+overloadedResponse() {
+	static const std::string response = "Status: 503 " + std::string(Parser::statusToString(503)) +
+		"\r\nContent-type: text/html\r\n\r\n<html><body><h1>503 " + Parser::statusToString(503) +
+		"</h1></body></html>";
+	return response;
+}
+
 FCGIServer::FCGIServer(boost::shared_ptr<Globals> globals) :
 	globals_(globals), stopper_(new ServerStopper()), active_thread_holder_(new char(0)),
 	monitorSocket_(-1), request_cache_(NULL), time_statistics_(NULL), status_(NOT_INITED)
@@ -132,6 +148,11 @@ FCGIServer::join() {
 	if (NOT_INITED == status()) {
 		throw std::runtime_error("Server is not started yet");
 	}
+	for (std::vector<boost::shared_ptr<PrepareThreadPool> >::iterator i = preparePools_.begin();
+		 i != preparePools_.end();
+		 ++i) {
+		(*i)->join();
+	}
 	globals_->joinThreadPools();
 
 	while (!active_thread_holder_.unique()) {
@@ -155,6 +176,11 @@ FCGIServer::stopInternal() {
 	stopper_->stopped(true);
 
 	FCGX_ShutdownPending();
+	for (std::vector<boost::shared_ptr<PrepareThreadPool> >::iterator i = preparePools_.begin();
+		 i != preparePools_.end();
+		 ++i) {
+		(*i)->stop();
+	}
 	globals_->stopThreadPools();
 }
 
@@ -223,6 +249,20 @@ FCGIServer::createWorkThreads() {
 	for (std::vector<boost::shared_ptr<Endpoint> >::iterator i = endpoints_.begin();
 		 i != endpoints_.end();
 		 ++i) {
+		if (Endpoint::EPOLL == (*i)->mode()) {
+			boost::shared_ptr<PrepareThreadPool> pool(new PrepareThreadPool((*i)->threads(), PREPARE_QUEUE_LENGTH,
+				boost::bind(&FCGIServer::prepareAsync, this, _1)));
+			pool->start(boost::bind(&FCGIServer::bindThread, this, i->get()));
+			preparePools_.push_back(pool);
+
+			Reactor::HandlerType handler = boost::bind(&FCGIServer::handleAsync, this, i->get(), pool.get(), _1, _2);
+			for (unsigned short t = 0; t < (*i)->threads(); ++t) {
+				boost::shared_ptr<Reactor> reactor(new Reactor(i->get(), handler, logger()));
+				reactors_.push_back(reactor);
+				globalPool_.create_thread(boost::bind(&FCGIServer::react, this, reactor.get()));
+			}
+			continue;
+		}
 		boost::function<void()> f = boost::bind(&FCGIServer::handle, this, i->get());
 		for (unsigned short t = 0; t < (*i)->threads(); ++t) {
 			globalPool_.create_thread(f);
@@ -239,13 +279,47 @@ FCGIServer::initFastCGISubsystem() {
 	std::vector<std::string> v;
 	globals_->config()->subKeys("/fastcgi/daemon/endpoint", v);
 	for (std::vector<std::string>::iterator i = v.begin(), end = v.end(); i != end; ++i) {
-		boost::shared_ptr<Endpoint> endpoint(new Endpoint(
-			globals_->config()->asString(*i + "/socket", ""),
-			globals_->config()->asString(*i + "/port", ""),
-			boost::lexical_cast<unsigned>(globals_->config()->asString(*i + "/threads"))));
+		const std::string mode = globals_->config()->asString(*i + "/@mode", "blocking");
+		if ("blocking" != mode && "epoll" != mode) {
+			throw std::runtime_error("unknown endpoint mode: " + mode);
+		}
+		const Endpoint::Mode endpointMode = ("epoll" == mode) ? Endpoint::EPOLL : Endpoint::BLOCKING;
+
+		std::string threads = globals_->config()->asString(*i + "/threads", "");
+		if (threads.empty() && Endpoint::EPOLL == endpointMode) {
+			threads = boost::lexical_cast<std::string>(std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L));
+		}
+		else if (threads.empty()) {
+			threads = globals_->config()->asString(*i + "/threads");
+		}
+
+		const int shards = globals_->config()->asInt(*i + "/@shards", 1);
+		const bool reusePort = ("yes" == globals_->config()->asString(*i + "/@reuseport", "no"));
+		if (shards < 1) {
+			throw std::runtime_error("endpoint shards must be positive");
+		}
+		if (shards > 1 && !reusePort) {
+			throw std::runtime_error("sharded endpoint requires reuseport=\"yes\"");
+		}
+
+		const unsigned int shardThreads = std::max(boost::lexical_cast<unsigned>(threads) / shards, 1u);
+		const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
 		const int backlog = globals_->config()->asInt(*i + "/backlog", SOMAXCONN);
-		endpoint->openSocket(backlog);	
-		endpoints_.push_back(endpoint);
+		for (int shard = 0; shard < shards; ++shard) {
+			boost::shared_ptr<Endpoint> endpoint(new Endpoint(
+				globals_->config()->asString(*i + "/socket", ""),
+				globals_->config()->asString(*i + "/port", ""),
+				shardThreads, endpointMode, shard, reusePort));
+			if (shards > 1 && cpus > 1) {
+				std::vector<int> shardCpus;
+				for (long cpu = shard % cpus; cpu < cpus; cpu += shards) {
+					shardCpus.push_back(cpu);
+				}
+				endpoint->setCpus(shardCpus);
+			}
+			endpoint->openSocket(backlog);
+			endpoints_.push_back(endpoint);
+		}
 	}
 
 	if (endpoints_.empty()) {
@@ -257,6 +331,9 @@ void
 FCGIServer::handle(Endpoint *endpoint) {
 	boost::shared_ptr<ServerStopper> stopper = stopper_;
 	Logger* logger = globals_->logger();
+	bindThread(endpoint);
+	boost::shared_ptr<FastcgiRequestPool> requests(
+		new FastcgiRequestPool(endpoint, logger, request_cache_, time_statistics_, logTimes_));
 	while (true) {
 		try {
 			boost::shared_ptr<ThreadHolder> holder = active_thread_holder_;
@@ -265,12 +342,13 @@ FCGIServer::handle(Endpoint *endpoint) {
 			}
 
 			Endpoint::ScopedBusyCounter busyCounter(*endpoint);
-			RequestTask task;
-			task.request = boost::shared_ptr<Request>(new Request(logger, request_cache_));
-			task.request_stream = boost::shared_ptr<RequestIOStream>(
-				new FastcgiRequest(task.request, endpoint, logger, time_statistics_, logTimes_));
+			boost::shared_ptr<FastcgiRequest> pooled = requests->acquire();
+			FastcgiRequest *request = pooled.get();
 
-			FastcgiRequest *request = dynamic_cast<FastcgiRequest*>(task.request_stream.get());
+			RequestTask task;
+			task.request_stream = pooled;
+			task.request = boost::shared_ptr<Request>(pooled, request->request());
+			pooled.reset();
 
 			busyCounter.decrement();
 			holder.reset();
@@ -310,13 +388,124 @@ FCGIServer::handle(Endpoint *endpoint) {
 	}
 }
 
+void
+FCGIServer::bindThread(Endpoint *endpoint) {
+	try {
+		endpoint->bindCurrentThread();
+	}
+	catch (const std::exception &e) {
+		logger()->error("%s", e.what());
+	}
+}
+
+void
+FCGIServer::react(Reactor *reactor) {
+	Logger* logger = globals_->logger();
+	bindThread(reactor->endpoint());
+	while (true) {
+		try {
+			if (stopper_->stopped()) {
+				return;
+			}
+			int count = reactor->wait(REACTOR_WAIT_TIMEOUT);
+			if (stopper_->stopped()) {
+				return;
+			}
+			boost::shared_ptr<ThreadHolder> holder = active_thread_holder_;
+			reactor->process(count);
+		}
+		catch (const std::exception &e) {
+			logger->error("caught exception while handling request: %s", e.what());
+		}
+		catch (...) {
+			logger->error("caught unknown exception while handling request");
+		}
+	}
+}
+
+/* stdin is buffered by reactor in memory, large one is moved to request cache file here */
+void
+FCGIServer::storeBody(FastcgiRequestData *data) {
+	if (NULL == request_cache_ || data->body.empty() || data->body.size() < request_cache_->minPostSize()) {
+		return;
+	}
+	DataBuffer file = request_cache_->create();
+	file.resize(data->body.size());
+	file.write(0, &data->body[0], data->body.size());
+	data->bodyFile = file;
+	std::vector<char>().swap(data->body);
+}
+
+void
+FCGIServer::handleAsync(Endpoint *endpoint, PrepareThreadPool *pool,
+	boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data) {
+
+	AsyncRequestTask task;
+	task.endpoint = endpoint;
+	task.connection = connection;
+	task.data = data;
+
+	try {
+		pool->addTask(task);
+		return;
+	}
+	catch (const std::exception &e) {
+		globals_->logger()->error("cannot add request to prepare pool: %s", e.what());
+	}
+
+	/* request is not built on reactor thread, it gets prepared answer which does not wait for socket */
+	const std::string &response = overloadedResponse();
+	connection->rejectRequest(*data, response.data(), response.size());
+}
+
+void
+FCGIServer::prepareAsync(AsyncRequestTask async) {
+	Logger* logger = globals_->logger();
+	boost::shared_ptr<Request> req(new Request(logger, request_cache_));
+	boost::shared_ptr<AsyncFastcgiRequest> request(new AsyncFastcgiRequest(req,
+		async.connection, async.data, async.endpoint, logger, time_statistics_, logTimes_),
+		&AsyncFastcgiRequest::release);
+
+	RequestTask task;
+	task.request_stream = request;
+	task.request = boost::shared_ptr<Request>(request, request->request());
+
+	try {
+		storeBody(async.data.get());
+	}
+	catch (const std::exception &e) {
+		logger->error("caught exception while storing request body: %s", e.what());
+		task.request->sendError(500);
+		return;
+	}
+
+	try {
+		request->attach();
+	}
+	catch (const std::exception &e) {
+		logger->error("caught exception while attach request: %s", e.what());
+		task.request->sendError(400);
+		return;
+	}
+
+	try {
+		handleRequest(task);
+	}
+	catch (const std::exception &e) {
+		task.request->sendError(500);
+	}
+}
+
 void
 FCGIServer::handleRequest(RequestTask task) {
 	logger()->debug("handling request %s", task.request->getScriptName().c_str());
-	FastcgiRequest *request = dynamic_cast<FastcgiRequest*>(task.request_stream.get());
-	const HandlerSet::HandlerDescription* handler = getHandler(task);
+	FastcgiRequestBase *request = dynamic_cast<FastcgiRequestBase*>(task.request_stream.get());
+	const HandlerSet::HandlerDescription* handler = NULL;
+	bool prepared = prepareRequest(task, handler);
 	request->setHandlerDesc(handler);
-	handleRequestInternal(handler, task);
+	if (prepared) {
+		handleRequestInternal(handler, task);
+	}
 }
 
 void
@@ -420,6 +609,8 @@ FCGIServer::getServerInfo() const {
 			 ++i) {
 			s << "<endpoint"
 				<< " socket=\"" << (*i)->toString() << "\""
+				<< " mode=\"" << (Endpoint::EPOLL == (*i)->mode() ? "epoll" : "blocking") << "\""
+				<< " shard=\"" << (*i)->shard() << "\""
 				<< " threads=\"" << (*i)->threads() << "\"" 
 				<< " busy=\"" << (*i)->getBusyCounter() << "\""
 				<< "/>\n";
@@ -444,6 +635,16 @@ FCGIServer::getServerInfo() const {
 
 		s << "</pools>\n";
 
+		RouteCacheInfo routeCache = globals_->handlers()->getRouteCacheInfo();
+		if (routeCache.capacity > 0) {
+			s << "<route_cache"
+				<< " size=\"" << routeCache.size << "\""
+				<< " capacity=\"" << routeCache.capacity << "\""
+				<< " hits=\"" << routeCache.hits << "\""
+				<< " misses=\"" << routeCache.misses << "\""
+				<< "/>\n";
+		}
+
 		info += s.str();
 	}
 	
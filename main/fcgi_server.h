@@ -10,6 +10,7 @@
 #include <boost/thread.hpp>
 
 #include "details/server.h"
+#include "details/thread_pool.h"
 
 namespace fastcgi
 {
@@ -19,9 +20,12 @@ class Request;
 class Logger;
 class Loader;
 class Endpoint;
+class FastcgiConnection;
+class Reactor;
 class ComponentSet;
 class HandlerSet;
 class RequestsThreadPool;
+struct FastcgiRequestData;
 
 class ServerStopper {
 public:
@@ -64,6 +68,35 @@ private:
 	int count_;
 };
 
+struct AsyncRequestTask {
+	AsyncRequestTask() : endpoint(NULL)
+	{}
+	Endpoint *endpoint;
+	boost::shared_ptr<FastcgiConnection> connection;
+	boost::shared_ptr<FastcgiRequestData> data;
+};
+
+/**
+ * Threads attaching requests received by reactor of epoll endpoint: they build request,
+ * read body, choose handler and pass request to its pool, so reactor thread does not parse it.
+ */
+class PrepareThreadPool : public ThreadPool<AsyncRequestTask> {
+public:
+	typedef boost::function<void (AsyncRequestTask)> HandlerType;
+
+	PrepareThreadPool(const unsigned threadsNumber, const unsigned queueLength, HandlerType handler) :
+		ThreadPool<AsyncRequestTask>(threadsNumber, queueLength), handler_(handler)
+	{}
+
+protected:
+	virtual void handleTask(AsyncRequestTask task) {
+		handler_(task);
+	}
+
+private:
+	HandlerType handler_;
+};
+
 class FCGIServer : public Server {
 protected:
 	enum Status {NOT_INITED, LOADING, RUNNING};
@@ -80,6 +113,12 @@ private:
 	virtual Logger* logger() const;
 	virtual void handleRequest(RequestTask task);
 	void handle(Endpoint *endpoint);
+	void handleAsync(Endpoint *endpoint, PrepareThreadPool *pool,
+		boost::shared_ptr<FastcgiConnection> connection, boost::shared_ptr<FastcgiRequestData> data);
+	void prepareAsync(AsyncRequestTask task);
+	void storeBody(FastcgiRequestData *data);
+	void react(Reactor *reactor);
+	void bindThread(Endpoint *endpoint);
 	void monitor();
 
 	std::string getServerInfo() const;
@@ -107,6 +146,8 @@ private:
 	boost::shared_ptr<ThreadHolder> active_thread_holder_;
 
 	std::vector<boost::shared_ptr<Endpoint> > endpoints_;
+	std::vector<boost::shared_ptr<Reactor> > reactors_;
+	std::vector<boost::shared_ptr<PrepareThreadPool> > preparePools_;
 	int monitorSocket_;
 	
 	RequestCache *request_cache_;
@@ -0,0 +1,195 @@
+#include "settings.h"
+
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "endpoint.h"
+#include "fcgi_connection.h"
+#include "reactor.h"
+
+#include "fastcgi2/logger.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const int MAX_EVENTS = 256;
+
+static void
+setNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (-1 == flags || -1 == fcntl(fd, F_SETFL, flags | O_NONBLOCK)) {
+		std::stringstream stream;
+		stream << "can not set non-blocking mode [" << errno << "]";
+		throw std::runtime_error(stream.str());
+	}
+}
+
+Reactor::Reactor(Endpoint *endpoint, HandlerType handler, Logger *logger) :
+	endpoint_(endpoint), handler_(handler), logger_(logger), epoll_(-1), events_(MAX_EVENTS)
+{
+	epoll_ = epoll_create(MAX_EVENTS);
+	if (-1 == epoll_) {
+		std::stringstream stream;
+		stream << "can not create epoll descriptor [" << errno << "]";
+		throw std::runtime_error(stream.str());
+	}
+
+	int socket = endpoint_->socket();
+	setNonBlocking(socket);
+
+	struct epoll_event event;
+	event.events = EPOLLIN;
+#ifdef EPOLLEXCLUSIVE
+	event.events |= EPOLLEXCLUSIVE;
+#endif
+	event.data.fd = socket;
+	if (-1 == epoll_ctl(epoll_, EPOLL_CTL_ADD, socket, &event)) {
+		close(epoll_);
+		std::stringstream stream;
+		stream << "can not add fastcgi socket " << endpoint_->toString() << " to epoll [" << errno << "]";
+		throw std::runtime_error(stream.str());
+	}
+}
+
+Reactor::~Reactor() {
+	close(epoll_);
+}
+
+Endpoint*
+Reactor::endpoint() const {
+	return endpoint_;
+}
+
+int
+Reactor::wait(int timeout) {
+	int count = epoll_wait(epoll_, &events_[0], events_.size(), timeout);
+	if (-1 == count && EINTR != errno) {
+		std::stringstream stream;
+		stream << "epoll_wait failed [" << errno << "]";
+		throw std::runtime_error(stream.str());
+	}
+	return count > 0 ? count : 0;
+}
+
+void
+Reactor::process(int count) {
+	int socket = endpoint_->socket();
+	for (int i = 0; i < count; ++i) {
+		const struct epoll_event &event = events_[i];
+		if (event.data.fd == socket) {
+			accept();
+			continue;
+		}
+		if (event.events & EPOLLIN) {
+			read(event.data.fd);
+		}
+		if (event.events & EPOLLOUT) {
+			write(event.data.fd);
+		}
+		if (event.events & (EPOLLERR | EPOLLHUP)) {
+			remove(event.data.fd);
+		}
+	}
+}
+
+void
+Reactor::accept() {
+	int socket = endpoint_->socket();
+	for (int i = 0; i < MAX_EVENTS; ++i) {
+		int fd = accept4(socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (-1 == fd) {
+			if (EINTR == errno) {
+				continue;
+			}
+			if (EAGAIN != errno && EWOULDBLOCK != errno) {
+				logger_->error("failed to accept connection on %s, errno = %i",
+					endpoint_->toString().c_str(), errno);
+			}
+			return;
+		}
+
+		boost::shared_ptr<FastcgiConnection> connection(new FastcgiConnection(fd, epoll_));
+
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.fd = fd;
+		if (-1 == epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event)) {
+			logger_->error("failed to add connection to epoll, errno = %i", errno);
+			continue;
+		}
+		connections_[fd] = connection;
+	}
+}
+
+void
+Reactor::read(int fd) {
+	std::map<int, boost::shared_ptr<FastcgiConnection> >::iterator it = connections_.find(fd);
+	if (connections_.end() == it) {
+		return;
+	}
+	boost::shared_ptr<FastcgiConnection> connection = it->second;
+
+	FastcgiConnection::RequestList ready;
+	bool alive = false;
+	try {
+		alive = connection->read(ready);
+	}
+	catch (const std::exception &e) {
+		logger_->error("caught exception while reading fastcgi connection: %s", e.what());
+		connection->abort();
+	}
+
+	for (FastcgiConnection::RequestList::iterator i = ready.begin(); i != ready.end(); ++i) {
+		try {
+			handler_(connection, *i);
+		}
+		catch (const std::exception &e) {
+			logger_->error("caught exception while handling request: %s", e.what());
+		}
+		catch (...) {
+			logger_->error("caught unknown exception while handling request");
+		}
+	}
+
+	/* connection with requests in progress is dropped when it is shut down after their output */
+	if (!alive && connection->finish()) {
+		remove(fd);
+	}
+}
+
+void
+Reactor::write(int fd) {
+	std::map<int, boost::shared_ptr<FastcgiConnection> >::iterator it = connections_.find(fd);
+	if (connections_.end() == it) {
+		return;
+	}
+	try {
+		it->second->flush();
+	}
+	catch (const std::exception &e) {
+		logger_->error("caught exception while writing fastcgi connection: %s", e.what());
+		remove(fd);
+	}
+}
+
+void
+Reactor::remove(int fd) {
+	std::map<int, boost::shared_ptr<FastcgiConnection> >::iterator it = connections_.find(fd);
+	if (connections_.end() == it) {
+		return;
+	}
+	epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, NULL);
+	it->second->abort();
+	connections_.erase(it);
+}
+
+} // namespace fastcgi
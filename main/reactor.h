@@ -0,0 +1,58 @@
+#ifndef _FASTCGI_FASTCGI_REACTOR_H_
+#define _FASTCGI_FASTCGI_REACTOR_H_
+
+#include <map>
+#include <vector>
+
+#include <sys/epoll.h>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace fastcgi
+{
+
+class Endpoint;
+class FastcgiConnection;
+class Logger;
+struct FastcgiRequestData;
+
+/**
+ * Epoll event loop of single reactor thread serving epoll endpoint.
+ * Accepts connections, reads FastCGI records without blocking and passes
+ * requests with complete params and stdin to handler.
+ * Response output which does not fit into socket is sent when it becomes writable.
+ */
+
+class Reactor : private boost::noncopyable {
+public:
+	typedef boost::function<void (boost::shared_ptr<FastcgiConnection>,
+		boost::shared_ptr<FastcgiRequestData>)> HandlerType;
+
+	Reactor(Endpoint *endpoint, HandlerType handler, Logger *logger);
+	virtual ~Reactor();
+
+	Endpoint* endpoint() const;
+
+	int wait(int timeout);
+	void process(int count);
+
+private:
+	void accept();
+	void read(int fd);
+	void write(int fd);
+	void remove(int fd);
+
+private:
+	Endpoint *endpoint_;
+	HandlerType handler_;
+	Logger *logger_;
+	int epoll_;
+	std::vector<struct epoll_event> events_;
+	std::map<int, boost::shared_ptr<FastcgiConnection> > connections_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_FASTCGI_REACTOR_H_
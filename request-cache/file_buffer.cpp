@@ -1,9 +1,14 @@
 #include "settings.h"
 
+#include <cerrno>
+#include <climits>
+#include <cstring>
 #include <stdexcept>
 
+#include <sys/uio.h>
+
+#include "details/char_search.h"
 #include "details/data_buffer_impl.h"
-#include "details/range.h"
 
 #include "fastcgi2/util.h"
 
@@ -75,6 +80,57 @@ FileBuffer::write(boost::uint64_t pos, const char *data, boost::uint64_t len) {
 	return len;
 }
 
+/*
+ * Windowed mapping would be moved for every scattered field, so data is
+ * passed to the kernel in one pwritev instead, page cache keeps mapping coherent.
+ */
+boost::uint64_t
+FileBuffer::writev(boost::uint64_t pos, const struct iovec *iov, int count) {
+	std::vector<struct iovec> chunks(iov, iov + count);
+	boost::uint64_t len = 0;
+	for (int i = 0; i < count; ++i) {
+		len += iov[i].iov_len;
+	}
+	if (pos + len > size()) {
+		throw std::runtime_error("Data is out of range");
+	}
+
+	if (file_->fullWindow()) {
+		boost::mutex::scoped_lock lock(mutex_);
+		for (std::vector<struct iovec>::iterator it = chunks.begin(), end = chunks.end(); it != end; ++it) {
+			const char *data = static_cast<const char*>(it->iov_base);
+			if (it->iov_len > 0) {
+				memcpy(file_->atRange(pos, it->iov_len), data, it->iov_len);
+			}
+			pos += it->iov_len;
+		}
+		return len;
+	}
+
+	std::size_t first = 0;
+	while (first < chunks.size()) {
+		int iov_count = static_cast<int>(std::min(chunks.size() - first, static_cast<std::size_t>(IOV_MAX)));
+		ssize_t res = pwritev(fileDescriptor(), &chunks[first], iov_count, pos);
+		if (-1 == res) {
+			if (EINTR == errno) {
+				continue;
+			}
+			throw std::runtime_error("Cannot write file buffer");
+		}
+		pos += res;
+		std::size_t written = res;
+		while (first < chunks.size() && written >= chunks[first].iov_len) {
+			written -= chunks[first].iov_len;
+			++first;
+		}
+		if (written > 0) {
+			chunks[first].iov_base = static_cast<char*>(chunks[first].iov_base) + written;
+			chunks[first].iov_len -= written;
+		}
+	}
+	return len;
+}
+
 boost::uint64_t
 FileBuffer::find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len) {
 	if (len > end - begin) {
@@ -93,13 +149,10 @@ FileBuffer::find(boost::uint64_t begin, boost::uint64_t end, const char* buf, bo
 			finish = true;
 		}
 
-		char* range = file_->atRange(pos, length);
-		Range base(range, range + length);
-		Range substr(buf, buf + len);
-
-		const char* res = base.find(substr);
-		if (res != base.end()) {
-			return (res - base.begin()) + pos;
+		const char* range = file_->atRange(pos, length);
+		const char* res = CharSearch::findString(range, range + length, buf, len);
+		if (res != range + length) {
+			return (res - range) + pos;
 		}
 
 		if (finish) {
@@ -112,15 +165,33 @@ FileBuffer::find(boost::uint64_t begin, boost::uint64_t end, const char* buf, bo
 	return end;
 }
 
+int
+FileBuffer::memcmpAt(boost::uint64_t pos, const char *data, boost::uint64_t len) {
+	boost::mutex::scoped_lock lock(mutex_);
+	while (len > 0) {
+		std::pair<char*, boost::uint64_t> cur_chunk = chunk(pos);
+		if (NULL == cur_chunk.first || 0 == cur_chunk.second) {
+			throw std::runtime_error("Cannot fetch chunk");
+		}
+		boost::uint64_t cur_len = std::min(cur_chunk.second, len);
+		int res = memcmp(cur_chunk.first, data, cur_len);
+		if (0 != res) {
+			return res;
+		}
+		pos += cur_len;
+		data += cur_len;
+		len -= cur_len;
+	}
+	return 0;
+}
+
 std::pair<boost::uint64_t, boost::uint64_t>
 FileBuffer::trim(boost::uint64_t begin, boost::uint64_t end) const {
-	{
-		boost::mutex::scoped_lock lock(mutex_);
-		while (begin != end && isspace(file_->at(begin))) {
-			++begin;
-		}
+	boost::mutex::scoped_lock lock(mutex_);
+	while (begin != end && isspace(file_->at(begin))) {
+		++begin;
 	}
-	while (begin != end && isspace(end - 1)) {
+	while (begin != end && isspace(file_->at(end - 1))) {
 		--end;
 	}
 	return std::make_pair(begin, end);
@@ -154,6 +225,16 @@ FileBuffer::filename() const {
 	return holder_.get() ? holder_->filename : StringUtils::EMPTY_STRING;
 }
 
+int
+FileBuffer::fileDescriptor() const {
+	return file_->fileDescriptor();
+}
+
+bool
+FileBuffer::stableChunks() const {
+	return file_->fullWindow();
+}
+
 DataBufferImpl*
 FileBuffer::getCopy() const {
 	std::auto_ptr<FileBuffer> buffer(new FileBuffer);
@@ -27,8 +27,10 @@ public:
 	virtual ~FileBuffer();
 	virtual boost::uint64_t read(boost::uint64_t pos, char *data, boost::uint64_t len);
 	virtual boost::uint64_t write(boost::uint64_t pos, const char *data, boost::uint64_t len);
+	virtual boost::uint64_t writev(boost::uint64_t pos, const struct iovec *iov, int count);
 	virtual char at(boost::uint64_t pos);
 	virtual boost::uint64_t find(boost::uint64_t begin, boost::uint64_t end, const char* buf, boost::uint64_t len);
+	virtual int memcmpAt(boost::uint64_t pos, const char *data, boost::uint64_t len);
 	virtual std::pair<boost::uint64_t, boost::uint64_t> trim(boost::uint64_t begin, boost::uint64_t end) const;
 	virtual std::pair<char*, boost::uint64_t> chunk(boost::uint64_t pos) const;
 	virtual std::pair<boost::uint64_t, boost::uint64_t> segment(boost::uint64_t pos) const;
@@ -36,6 +38,8 @@ public:
 	virtual void resize(boost::uint64_t size);
 	virtual const std::string& filename() const;
 	virtual DataBufferImpl* getCopy() const;
+	virtual int fileDescriptor() const;
+	virtual bool stableChunks() const;
 private:
 	FileBuffer();
 private:
@@ -1,7 +1,17 @@
 #include "settings.h"
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cctype>
 #include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <set>
 #include <stdexcept>
 
 #include <boost/thread/tss.hpp>
@@ -51,6 +61,97 @@ struct KeyId {
 
 static boost::thread_specific_ptr<KeyId> key_id_holder;
 
+static const boost::uint64_t IDLE_WAIT = 60 * 1000;
+static const std::string JOURNAL_NAME = "requests.journal";
+
+/* every cache directory is split to subdirectories by first two hex digits of key */
+static const std::size_t SHARD_PREFIX = 2;
+static const unsigned int SHARDS = 256;
+
+static boost::uint64_t
+currentMillis() {
+	boost::xtime t;
+	boost::xtime_get(&t, boost::TIME_UTC);
+	return static_cast<boost::uint64_t>(t.sec) * 1000 + t.nsec / 1000000;
+}
+
+static boost::xtime
+millisToXTime(boost::uint64_t millis) {
+	boost::xtime t;
+	t.sec = millis / 1000;
+	t.nsec = (millis % 1000) * 1000000;
+	return t;
+}
+
+/* cache files are named by hex md5 keys */
+static bool
+isCacheKey(const char *name) {
+	std::size_t size = 0;
+	for (; name[size]; ++size) {
+		if (!isxdigit(static_cast<unsigned char>(name[size])) || isupper(static_cast<unsigned char>(name[size]))) {
+			return false;
+		}
+	}
+	return 32 == size;
+}
+
+/* rename across file systems is done by synced copy, source is removed only when copy is in place */
+static bool
+moveFile(const std::string &from, const std::string &to) {
+	if (0 == rename(from.c_str(), to.c_str())) {
+		return true;
+	}
+	if (EXDEV != errno) {
+		return false;
+	}
+
+	int in = open(from.c_str(), O_RDONLY);
+	if (-1 == in) {
+		return false;
+	}
+	std::string tmp = to + ".tmp";
+	int out = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (-1 == out) {
+		int error = errno;
+		close(in);
+		errno = error;
+		return false;
+	}
+
+	bool copied = true;
+	char buffer[65536];
+	while (copied) {
+		ssize_t size = read(in, buffer, sizeof(buffer));
+		if (0 == size) {
+			break;
+		}
+		if (-1 == size) {
+			copied = EINTR == errno;
+			continue;
+		}
+		for (ssize_t pos = 0; copied && pos < size;) {
+			ssize_t res = write(out, buffer + pos, size - pos);
+			if (-1 == res) {
+				copied = EINTR == errno;
+				continue;
+			}
+			pos += res;
+		}
+	}
+	copied = copied && 0 == fsync(out);
+	int error = errno;
+	close(in);
+	close(out);
+	if (!copied || -1 == rename(tmp.c_str(), to.c_str())) {
+		error = copied ? errno : error;
+		unlink(tmp.c_str());
+		errno = error;
+		return false;
+	}
+	unlink(from.c_str());
+	return true;
+}
+
 std::string
 FileRequestCache::generateUniqueKey() {
 	KeyId* key_id = key_id_holder.get();
@@ -76,8 +177,37 @@ public:
 	}
 };
 
+static void
+startReplayThread() {
+}
+
+class FileRequestCache::ReplayPool : public ThreadPool<DelayTask> {
+public:
+	ReplayPool(FileRequestCache *cache, unsigned threadsNumber) :
+		ThreadPool<DelayTask>(threadsNumber, std::numeric_limits<unsigned>::max() / 2, SCHEDULER_WORK_STEALING),
+		cache_(cache)
+	{}
+
+protected:
+	virtual void handleTask(DelayTask task) {
+		try {
+			cache_->replay(task);
+		}
+		catch (const std::exception &e) {
+			cache_->logger_->error("caught exception while handling request: %s", e.what());
+		}
+		catch (...) {
+			cache_->logger_->error("caught unknown exception while handling request");
+		}
+	}
+
+private:
+	FileRequestCache *cache_;
+};
+
 FileRequestCache::FileRequestCache(ComponentContext *context) :
-	Component(context), globals_(NULL), logger_(NULL), stopped_(false) {
+	Component(context), globals_(NULL), logger_(NULL),
+	replaying_(0), tokens_(0), tokens_time_(0), stopped_(false) {
 
 	ComponentContextImpl* impl = dynamic_cast<ComponentContextImpl*>(context);
 	if (NULL == impl) {
@@ -88,20 +218,39 @@ FileRequestCache::FileRequestCache(ComponentContext *context) :
     const Config *config = context->getConfig();
 	const std::string componentXPath = context->getComponentXPath();
 
-	cache_dir_ = config->asString(
-		componentXPath + "/cache-dir", "/var/cache/fastcgi-daemon/request-cache/");
-
-	if (cache_dir_.empty()) {
-		throw std::runtime_error("Empty cache directory");
+	std::vector<std::string> dirs;
+	config->subKeys(componentXPath + "/cache-dir", dirs);
+	for (std::vector<std::string>::iterator it = dirs.begin(), end = dirs.end(); it != end; ++it) {
+		std::string dir = config->asString(*it, StringUtils::EMPTY_STRING);
+		if (dir.empty()) {
+			throw std::runtime_error("Empty cache directory");
+		}
+		if (*dir.rbegin() != '/') {
+			dir.push_back('/');
+		}
+		cache_dirs_.push_back(dir);
 	}
-
-	if (*cache_dir_.rbegin() != '/') {
-		cache_dir_.push_back('/');
+	if (cache_dirs_.empty()) {
+		cache_dirs_.push_back("/var/cache/fastcgi-daemon/request-cache/");
 	}
 
-	window_ = config->asInt(componentXPath + "/file-window", 1024*1024);
+	if ("full" == config->asString(componentXPath + "/file-window", StringUtils::EMPTY_STRING)) {
+		window_ = MMapFile::FULL_WINDOW;
+	}
+	else {
+		window_ = config->asInt(componentXPath + "/file-window", 1024*1024);
+	}
 	max_retries_ = config->asInt(componentXPath + "/max-retries", 2);
 	min_post_size_ = config->asInt(componentXPath + "/min-post-size", 1024*1024);
+	resolution_ = std::max(config->asInt(componentXPath + "/retry-resolution", 100), 1);
+	max_replays_ = config->asInt(componentXPath + "/max-replays", 0);
+	replay_rate_ = config->asInt(componentXPath + "/replay-rate", 0);
+	replay_threads_ = std::max(config->asInt(componentXPath + "/replay-threads", 1), 1);
+
+	boost::uint64_t now = currentMillis();
+	waiting_.reset(new TimerWheel(now / resolution_));
+	tokens_ = replay_rate_;
+	tokens_time_ = now;
 }
 
 FileRequestCache::~FileRequestCache() {
@@ -115,9 +264,151 @@ FileRequestCache::onLoad() {
 		throw std::runtime_error("cannot get component " + loggerComponentName);
 	}
 
+	createDirectories();
+	journal_.reset(new RequestJournal(cache_dirs_.front() + JOURNAL_NAME, logger_));
+	restore();
+
+	replay_pool_.reset(new ReplayPool(this, replay_threads_));
+	replay_pool_->start(&startReplayThread);
 	thread_.reset(new boost::thread(boost::bind(&FileRequestCache::handle, this)));
 }
 
+void
+FileRequestCache::createDirectories() {
+	for (std::vector<std::string>::iterator it = cache_dirs_.begin(), end = cache_dirs_.end(); it != end; ++it) {
+		for (unsigned int shard = 0; shard < SHARDS; ++shard) {
+			char name[8];
+			snprintf(name, sizeof(name), "%02x", shard);
+			std::string path = *it + name;
+			if (-1 == mkdir(path.c_str(), 0755) && EEXIST != errno) {
+				char buffer[256];
+				throw std::runtime_error("Cannot create cache directory " + path + ": " +
+					strerror_r(errno, buffer, sizeof(buffer)));
+			}
+		}
+	}
+}
+
+std::string
+FileRequestCache::cachePath(const std::string &key) const {
+	std::string shard = key.substr(0, SHARD_PREFIX);
+	const std::string &dir = cache_dirs_[strtoul(shard.c_str(), NULL, 16) % cache_dirs_.size()];
+	return dir + shard + "/" + key;
+}
+
+/*
+ * Requests delayed before restart are scheduled again from journal,
+ * cache files which are not referenced by it are left by interrupted requests and removed.
+ * Files referenced by journal are never removed, if one cannot be moved to its shard
+ * it stays where it is and its entry is kept for next start.
+ */
+void
+FileRequestCache::restore() {
+	std::map<std::string, JournalEntry> live;
+	journal_->load(live);
+	mergeJournals(live);
+
+	std::set<std::string> found, kept;
+	unsigned int orphans = 0;
+	for (std::vector<std::string>::iterator it = cache_dirs_.begin(), end = cache_dirs_.end(); it != end; ++it) {
+		// files of flat layout used before sharding are moved to their shards
+		scanDirectory(*it, live, found, kept, orphans);
+		for (unsigned int shard = 0; shard < SHARDS; ++shard) {
+			char name[8];
+			snprintf(name, sizeof(name), "%02x/", shard);
+			scanDirectory(*it + name, live, found, kept, orphans);
+		}
+	}
+
+	std::vector<DelayTask> due;
+	boost::mutex::scoped_lock lock(mutex_);
+	waiting_->advance(currentMillis() / resolution_, due);
+	ready_.insert(ready_.end(), due.begin(), due.end());
+	for (std::map<std::string, JournalEntry>::iterator it = live.begin(), end = live.end(); it != end; ++it) {
+		if (found.end() == found.find(it->first)) {
+			if (kept.end() == kept.find(it->first)) {
+				journal_->complete(it->first);
+			}
+			continue;
+		}
+		waiting_->insert((it->second.when + resolution_ - 1) / resolution_, DelayTask(it->first, it->second.retries));
+	}
+	logger_->info("Restored %llu delayed requests, removed %u orphaned files",
+		static_cast<unsigned long long>(found.size()), orphans);
+}
+
+/*
+ * Journal is kept in the first cache directory. After cache directories are reordered
+ * or a new one is prepended, journal of previous layout is found in another directory,
+ * its entries are moved to current journal before any file is treated as orphaned.
+ */
+void
+FileRequestCache::mergeJournals(std::map<std::string, JournalEntry> &live) {
+	struct stat current;
+	if (-1 == stat((cache_dirs_.front() + JOURNAL_NAME).c_str(), &current)) {
+		char buffer[256];
+		throw std::runtime_error("Cannot stat request journal in " + cache_dirs_.front() + ": " +
+			strerror_r(errno, buffer, sizeof(buffer)));
+	}
+	for (std::vector<std::string>::iterator it = cache_dirs_.begin() + 1, end = cache_dirs_.end(); it != end; ++it) {
+		std::string path = *it + JOURNAL_NAME;
+		struct stat fs;
+		if (-1 == stat(path.c_str(), &fs) || (fs.st_dev == current.st_dev && fs.st_ino == current.st_ino)) {
+			continue;
+		}
+		std::map<std::string, JournalEntry> entries;
+		{
+			RequestJournal journal(path, logger_);
+			journal.load(entries);
+		}
+		journal_->merge(entries);
+		live.insert(entries.begin(), entries.end());
+		if (-1 == unlink(path.c_str())) {
+			char buffer[256];
+			logger_->error("Cannot remove merged request journal %s: %s",
+				path.c_str(), strerror_r(errno, buffer, sizeof(buffer)));
+		}
+		logger_->info("Merged %llu delayed requests from request journal %s",
+			static_cast<unsigned long long>(entries.size()), path.c_str());
+	}
+}
+
+void
+FileRequestCache::scanDirectory(const std::string &dir, const std::map<std::string, JournalEntry> &live,
+	std::set<std::string> &found, std::set<std::string> &kept, unsigned int &orphans) {
+
+	DIR *handle = opendir(dir.c_str());
+	if (NULL == handle) {
+		char buffer[256];
+		logger_->error("Cannot read cache directory %s: %s",
+			dir.c_str(), strerror_r(errno, buffer, sizeof(buffer)));
+		return;
+	}
+	while (struct dirent *entry = readdir(handle)) {
+		if (!isCacheKey(entry->d_name)) {
+			continue;
+		}
+		std::string key = entry->d_name;
+		std::string path = dir + key;
+		if (live.end() == live.find(key)) {
+			if (0 == unlink(path.c_str())) {
+				++orphans;
+			}
+			continue;
+		}
+		std::string target = cachePath(key);
+		if (path == target || moveFile(path, target)) {
+			found.insert(key);
+			continue;
+		}
+		char buffer[256];
+		logger_->error("Cannot move cache file %s to %s, it is kept until next start: %s",
+			path.c_str(), target.c_str(), strerror_r(errno, buffer, sizeof(buffer)));
+		kept.insert(key);
+	}
+	closedir(handle);
+}
+
 void
 FileRequestCache::onUnload() {
 	stop();
@@ -125,7 +416,7 @@ FileRequestCache::onUnload() {
 
 DataBuffer
 FileRequestCache::createFileBuffer(const std::string &key) {
-	std::string path = cache_dir_ + key;
+	std::string path = cachePath(key);
 	return DataBuffer::create(new FileBuffer(path.c_str(), window_));
 }
 
@@ -145,9 +436,10 @@ FileRequestCache::getStoredKey(Request *request) {
 	DataBuffer request_buffer = request->requestBody();
 	FileBuffer* impl = dynamic_cast<FileBuffer*>(request_buffer.impl());
 	const std::string& filename = impl ? impl->filename() : StringUtils::EMPTY_STRING;
-	if (!filename.empty() &&
-		0 == strncmp(filename.c_str(), cache_dir_.c_str(), cache_dir_.size())) {
-		return filename.substr(cache_dir_.size());
+	std::string::size_type pos = filename.rfind('/');
+	std::string key = filename.substr(std::string::npos == pos ? 0 : pos + 1);
+	if (isCacheKey(key.c_str()) && filename == cachePath(key)) {
+		return key;
 	}
 	return StringUtils::EMPTY_STRING;
 }
@@ -160,9 +452,10 @@ FileRequestCache::getKey(Request *request) {
 
 std::string
 FileRequestCache::createHardLink(const std::string &key) {
-	std::string path = cache_dir_ + key;
-	std::string new_key = generateUniqueKey();
-	std::string new_path = cache_dir_ + new_key;
+	std::string path = cachePath(key);
+	// link stays in shard of original request, so it never crosses file systems
+	std::string new_key = generateUniqueKey().replace(0, SHARD_PREFIX, key, 0, SHARD_PREFIX);
+	std::string new_path = cachePath(new_key);
 	if (-1 == link(path.c_str(), new_path.c_str())) {
 		char buffer[256];
 		logger_->error("Cannot link file %s: %s",
@@ -174,11 +467,8 @@ FileRequestCache::createHardLink(const std::string &key) {
 
 bool
 FileRequestCache::saveRequest(Request *request, const std::string &key, std::string &new_key) {
-	FileBuffer* impl = dynamic_cast<FileBuffer*>(request->requestBody().impl());
-	const std::string& filename = impl ? impl->filename() : StringUtils::EMPTY_STRING;
 	DataBuffer buffer;
-	if (filename.empty() ||
-		0 != strncmp(filename.c_str(), cache_dir_.c_str(), cache_dir_.size())) {
+	if (getStoredKey(request).empty()) {
 		buffer = createFileBuffer(key);
 		if (buffer.isNil()) {
 			return false;
@@ -191,15 +481,32 @@ FileRequestCache::saveRequest(Request *request, const std::string &key, std::str
 
 void
 FileRequestCache::eraseActive(const std::string &key) {
-	boost::mutex::scoped_lock lock(active_mutex_);
-	active_.erase(key);
+	int retries = 0;
+	{
+		boost::mutex::scoped_lock lock(active_mutex_);
+		std::map<std::string, int>::iterator it = active_.find(key);
+		if (active_.end() == it) {
+			return;
+		}
+		retries = it->second;
+		active_.erase(it);
+	}
+	// only replayed requests are registered with retries
+	if (retries > 0) {
+		finishReplay(key);
+	}
 }
 
 void
 FileRequestCache::insertWaiting(time_t delay, const std::string &key, int retries) {
-	boost::mutex::scoped_lock lock(waiting_mutex_);
-	waiting_.insert(std::make_pair(
-		delay + time(NULL), DelayTask(key, retries)));
+	boost::uint64_t when = currentMillis() + static_cast<boost::uint64_t>(delay) * 1000;
+	journal_->enqueue(key, retries, when);
+	std::vector<DelayTask> due;
+	boost::mutex::scoped_lock lock(mutex_);
+	waiting_->advance(currentMillis() / resolution_, due);
+	ready_.insert(ready_.end(), due.begin(), due.end());
+	waiting_->insert((when + resolution_ - 1) / resolution_, DelayTask(key, retries));
+	condition_.notify_all();
 }
 
 void
@@ -249,8 +556,9 @@ FileRequestCache::save(Request *request, time_t delay) {
 		return;
 	}
 
-	eraseActive(key);
+	// new key is journaled before old one is closed, so crash in between cannot lose request
 	insertWaiting(delay, new_key, retries + 1);
+	eraseActive(key);
 }
 
 boost::uint32_t
@@ -260,59 +568,132 @@ FileRequestCache::minPostSize() const {
 
 void
 FileRequestCache::stop() {
-	stopped_ = true;
 	{
 		boost::mutex::scoped_lock l(mutex_);
+		stopped_ = true;
 		condition_.notify_all();
 	}
 	thread_->join();
+	replay_pool_->stop();
+	replay_pool_->join();
+}
+
+void
+FileRequestCache::finishReplay(const std::string &key) {
+	journal_->complete(key);
+	boost::mutex::scoped_lock lock(mutex_);
+	if (replaying_ > 0) {
+		--replaying_;
+	}
+	condition_.notify_all();
+}
+
+std::size_t
+FileRequestCache::replaysAllowed(boost::uint64_t now) {
+	std::size_t count = ready_.size();
+	if (max_replays_ > 0) {
+		count = std::min(count, static_cast<std::size_t>(max_replays_ > replaying_ ? max_replays_ - replaying_ : 0));
+	}
+	if (replay_rate_ > 0) {
+		tokens_ = std::min(tokens_ + (now - tokens_time_) * replay_rate_ / 1000.0, static_cast<double>(replay_rate_));
+		tokens_time_ = now;
+		count = std::min(count, static_cast<std::size_t>(tokens_));
+	}
+	return count;
+}
+
+boost::uint64_t
+FileRequestCache::wakeTime(boost::uint64_t now) const {
+	boost::uint64_t wake = now + IDLE_WAIT;
+	if (!waiting_->empty()) {
+		wake = std::min(wake, waiting_->nextTick() * resolution_);
+	}
+	// replays blocked by concurrency limit are woken by finishReplay
+	bool throttled = max_replays_ > 0 && replaying_ >= max_replays_;
+	if (!ready_.empty() && !throttled && replay_rate_ > 0) {
+		wake = std::min(wake, now + static_cast<boost::uint64_t>((1.0 - tokens_) * 1000 / replay_rate_) + 1);
+	}
+	return std::max(wake, now + 1);
+}
+
+void
+FileRequestCache::replay(const DelayTask &delay_task) {
+	RequestTask task;
+	task.request = boost::shared_ptr<Request>(new Request(logger_, this));
+	task.request_stream = boost::shared_ptr<RequestIOStream>(new RequestCacheStream());
+
+	DataBuffer buffer = createFileBuffer(delay_task.key);
+	if (buffer.isNil()) {
+		logger_->error("Cannot load file %s", delay_task.key.c_str());
+		finishReplay(delay_task.key);
+		return;
+	}
+	try {
+		task.request->parse(buffer);
+	}
+	catch (...) {
+		finishReplay(delay_task.key);
+		throw;
+	}
+	{
+		boost::mutex::scoped_lock lock(active_mutex_);
+		active_.insert(std::make_pair(delay_task.key, delay_task.retries));
+	}
+	handleRequest(task);
 }
 
 void
 FileRequestCache::handle() {
+	std::vector<DelayTask> batch;
 	while (true) {
+		batch.clear();
+		try {
+			journal_->compactIfRequested();
+		}
+		catch (const std::exception &e) {
+			logger_->error("%s", e.what());
+		}
 		try {
-            if (stopped_) {
-            	return;
-            }
-
-			DelayTask delay_task;
-			{
-				boost::mutex::scoped_lock lock(waiting_mutex_);
-				std::multimap<time_t, DelayTask>::iterator task_it = waiting_.begin();
-				if (waiting_.end() == task_it || task_it->first > time(NULL)) {
-					lock.unlock();
-		            boost::xtime t;
-		            boost::xtime_get(&t, boost::TIME_UTC);
-		            t.sec += 1;
-					boost::mutex::scoped_lock l(mutex_);
-		            condition_.timed_wait(l, t);
-					continue;
-				}
-				delay_task = task_it->second;
-				waiting_.erase(task_it);
+			boost::mutex::scoped_lock lock(mutex_);
+			if (stopped_) {
+				return;
 			}
-
-			RequestTask task;
-			task.request = boost::shared_ptr<Request>(new Request(logger_, this));
-			task.request_stream = boost::shared_ptr<RequestIOStream>(new RequestCacheStream());
-
-			DataBuffer buffer = createFileBuffer(delay_task.key);
-			if (buffer.isNil()) {
-				logger_->error("Cannot load file %s", delay_task.key.c_str());
+			boost::uint64_t now = currentMillis();
+			waiting_->advance(now / resolution_, batch);
+			ready_.insert(ready_.end(), batch.begin(), batch.end());
+			batch.clear();
+
+			std::size_t count = replaysAllowed(now);
+			if (0 == count) {
+				condition_.timed_wait(lock, millisToXTime(wakeTime(now)));
+				continue;
 			}
-			else {
-				boost::mutex::scoped_lock lock(active_mutex_);
-				active_.insert(std::make_pair(delay_task.key, delay_task.retries));
+			batch.assign(ready_.begin(), ready_.begin() + count);
+			ready_.erase(ready_.begin(), ready_.begin() + count);
+			replaying_ += count;
+			if (replay_rate_ > 0) {
+				tokens_ -= count;
 			}
-			task.request->parse(buffer);
-			handleRequest(task);
 		}
 		catch (const std::exception &e) {
-			logger_->error("caught exception while handling request: %s", e.what());
+			logger_->error("caught exception while scheduling requests: %s", e.what());
+			continue;
 		}
 		catch (...) {
-			logger_->error("caught unknown exception while handling request");
+			logger_->error("caught unknown exception while scheduling requests");
+			continue;
+		}
+
+		for (std::vector<DelayTask>::iterator it = batch.begin(), end = batch.end(); it != end; ++it) {
+			try {
+				replay_pool_->addTask(*it);
+			}
+			catch (const std::exception &e) {
+				// request stays in journal and is replayed after restart
+				logger_->error("cannot add request %s to replay pool: %s", it->key.c_str(), e.what());
+				boost::mutex::scoped_lock lock(mutex_);
+				--replaying_;
+			}
 		}
 	}
 }
@@ -1,26 +1,23 @@
 #ifndef _FASTCGI_REQUEST_CACHE_FILE_CACHE_H_
 #define _FASTCGI_REQUEST_CACHE_FILE_CACHE_H_
 
+#include <deque>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "fastcgi2/component.h"
 #include "details/request_cache.h"
 #include "details/server.h"
 
+#include "request_journal.h"
+#include "timer_wheel.h"
+
 namespace fastcgi
 {
 
 class Logger;
 
-struct DelayTask {
-	DelayTask() {}
-	DelayTask(const std::string &key_str, int num_retries) :
-		key(key_str), retries(num_retries)
-	{}
-	std::string key;
-	int retries;
-};
-
 class FileRequestCache : virtual public RequestCache, virtual public Component, public Server {
 public:
 	FileRequestCache(ComponentContext *context);
@@ -39,6 +36,16 @@ protected:
 
 private:
 	void handle();
+	void replay(const DelayTask &delay_task);
+	void finishReplay(const std::string &key);
+	void restore();
+	void mergeJournals(std::map<std::string, JournalEntry> &live);
+	void createDirectories();
+	void scanDirectory(const std::string &dir, const std::map<std::string, JournalEntry> &live,
+		std::set<std::string> &found, std::set<std::string> &kept, unsigned int &orphans);
+	std::string cachePath(const std::string &key) const;
+	std::size_t replaysAllowed(boost::uint64_t now);
+	boost::uint64_t wakeTime(boost::uint64_t now) const;
 	bool saveRequest(Request *request, const std::string &key, std::string &new_key);
 	std::string getKey(Request *request);
 	std::string getStoredKey(Request *request);
@@ -50,18 +57,32 @@ private:
 	void stop();
 
 private:
+	class ReplayPool;
+	friend class ReplayPool;
+
 	const Globals *globals_;
 	Logger *logger_;
 
-	std::string cache_dir_;
+	std::vector<std::string> cache_dirs_;
 	boost::uint64_t window_;
 	boost::uint32_t max_retries_;
 	boost::uint32_t min_post_size_;
-	std::multimap<time_t, DelayTask> waiting_;
+	boost::uint32_t resolution_;
+	boost::uint32_t max_replays_;
+	boost::uint32_t replay_rate_;
 	std::map<std::string, int> active_;
-	boost::mutex active_mutex_, waiting_mutex_;
+	boost::mutex active_mutex_;
 	std::auto_ptr<boost::thread> thread_;
+	std::auto_ptr<RequestJournal> journal_;
+	boost::uint32_t replay_threads_;
+	std::auto_ptr<ReplayPool> replay_pool_;
 
+	/* guarded by mutex_ */
+	std::auto_ptr<TimerWheel> waiting_;
+	std::deque<DelayTask> ready_;
+	boost::uint32_t replaying_;
+	double tokens_;
+	boost::uint64_t tokens_time_;
 	bool stopped_;
 	boost::condition condition_;
 	boost::mutex mutex_;
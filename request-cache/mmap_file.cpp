@@ -18,14 +18,16 @@
 namespace fastcgi
 {
 
+const boost::uint64_t MMapFile::FULL_WINDOW;
+
 MMapFile::MMapFile() :
 	pointer_(NULL), size_(0), fdes_(new FileDescriptor(-1)), is_read_only_(false),
-	window_(0), segment_start_(0), segment_len_(0), page_size_(0)
+	window_(0), segment_start_(0), segment_len_(0), page_size_(0), full_(false)
 {}
 
 MMapFile::MMapFile(const char *name, boost::uint64_t window, bool is_read_only) :
 	pointer_(NULL), size_(0), fdes_(new FileDescriptor(-1)), is_read_only_(is_read_only),
-	window_(window), segment_start_(0), segment_len_(0), page_size_(getpagesize())
+	window_(window), segment_start_(0), segment_len_(0), page_size_(getpagesize()), full_(false)
 {
 	if (is_read_only_) {
 		fdes_.reset(new FileDescriptor(open(name, O_RDONLY)));
@@ -45,12 +47,22 @@ MMapFile::MMapFile(const char *name, boost::uint64_t window, bool is_read_only)
 
 	size_ = fs.st_size;
 	checkWindow();
-	map_segment(0);
+	if (full_) {
+		/* existing file is loaded to be read as a whole */
+		map_full(true);
+	}
+	else {
+		map_segment(0);
+	}
 }
 
 void
 MMapFile::checkWindow() {
-	if (0 == window_) {
+	if (window_ >= FULL_WINDOW && sizeof(void*) >= 8) {
+		window_ = FULL_WINDOW;
+		full_ = true;
+	}
+	else if (0 == window_ || window_ >= FULL_WINDOW) {
 		window_ = 10 * page_size_;
 	}
 	else {
@@ -71,7 +83,14 @@ MMapFile::clone() const {
 	file->window_ = window_;
 	file->page_size_ = page_size_;
 	file->checkWindow();
-	file->map_segment(0);
+	if (full_) {
+		file->region_ = region_;
+		file->pointer_ = pointer_;
+		file->segment_len_ = segment_len_;
+	}
+	else {
+		file->map_segment(0);
+	}
 	return file.release();
 }
 
@@ -86,6 +105,11 @@ MMapFile::size() const {
 	return size_;
 }
 
+int
+MMapFile::fileDescriptor() const {
+	return fdes_->value();
+}
+
 bool
 MMapFile::empty() const {
 	return 0 == size_;
@@ -105,7 +129,13 @@ MMapFile::resize(boost::uint64_t newsize) {
 		throw std::runtime_error(error(errno));
 	}
 	size_ = newsize;
-	map_segment(0);
+	if (full_) {
+		/* file is resized before it is filled, pages are faulted in by writes */
+		map_full(false);
+	}
+	else {
+		map_segment(0);
+	}
 }
 
 char
@@ -139,6 +169,13 @@ MMapFile::atSegment(boost::uint64_t index) {
 
 void
 MMapFile::unmap() {
+	if (full_) {
+		region_.reset();
+		pointer_ = NULL;
+		segment_start_ = 0;
+		segment_len_ = 0;
+		return;
+	}
 	if (NULL != pointer_) {
 		if (-1 == munmap(pointer_, segment_len_)) {
 			throw std::runtime_error(error(errno));
@@ -149,6 +186,29 @@ MMapFile::unmap() {
 	}
 }
 
+void
+MMapFile::map_full(bool populate) {
+	unmap();
+	if (0 == size_) {
+		return;
+	}
+	int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+	if (populate) {
+		flags |= MAP_POPULATE;
+	}
+#endif
+	void *pointer = mmap(NULL, size_, is_read_only_ ? PROT_READ : PROT_READ | PROT_WRITE,
+		flags, fdes_->value(), 0);
+	if (MAP_FAILED == pointer) {
+		throw std::runtime_error(error(errno));
+	}
+	region_.reset(new MMapRegion(pointer, size_));
+	madvise(pointer, size_, populate ? MADV_WILLNEED : MADV_SEQUENTIAL);
+	pointer_ = pointer;
+	segment_len_ = size_;
+}
+
 char*
 MMapFile::map_segment(boost::uint64_t segment) {
 	boost::uint64_t pos = segment * window_;
@@ -157,6 +217,9 @@ MMapFile::map_segment(boost::uint64_t segment) {
 
 char*
 MMapFile::map_range(boost::uint64_t begin, boost::uint64_t end) {
+	if (full_) {
+		return (char*)pointer_ + begin;
+	}
 	if (mapped(begin, end)) {
 		return (char*)pointer_ + begin - segment_start_;
 	}
@@ -190,6 +253,11 @@ MMapFile::window() const {
 	return window_;
 }
 
+bool
+MMapFile::fullWindow() const {
+	return full_;
+}
+
 bool
 MMapFile::mapped(boost::uint64_t index) const {
 	return mapped(index, index + 1);
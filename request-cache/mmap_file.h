@@ -1,6 +1,8 @@
 #ifndef _FASTCGI_REQUEST_CACHE_MMAP_FILE_H_
 #define _FASTCGI_REQUEST_CACHE_MMAP_FILE_H_
 
+#include <sys/mman.h>
+
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 
@@ -23,8 +25,25 @@ private:
 	int fdes_;
 };
 
+/**
+ * Whole file mapping shared by clones of MMapFile in full window mode
+ */
+
+struct MMapRegion {
+	MMapRegion(void *ptr, boost::uint64_t len) : pointer(ptr), length(len) {}
+	~MMapRegion() {
+		munmap(pointer, length);
+	}
+
+	void *pointer;
+	boost::uint64_t length;
+};
+
 class MMapFile {
 public:
+	/* window value for mapping whole file at once, used on 64-bit hosts only */
+	static const boost::uint64_t FULL_WINDOW = static_cast<boost::uint64_t>(1) << 62;
+
 	MMapFile(const char *name, boost::uint64_t window, bool is_read_only = false);
 	virtual ~MMapFile();
 
@@ -37,6 +56,8 @@ public:
 	std::pair<char*, boost::uint64_t> atSegment(boost::uint64_t index);
 
 	boost::uint64_t window() const;
+	bool fullWindow() const;
+	int fileDescriptor() const;
 
 	MMapFile* clone() const;
 
@@ -44,6 +65,7 @@ private:
 	MMapFile();
 	void checkWindow();
 	void unmap();
+	void map_full(bool populate);
 	char* map_segment(boost::uint64_t segment);
 	char* map_range(boost::uint64_t begin, boost::uint64_t end);
 	void check_index(boost::uint64_t index) const;
@@ -59,6 +81,8 @@ private:
 	boost::uint64_t window_;
 	boost::uint64_t segment_start_, segment_len_;
 	int page_size_;
+	bool full_;
+	boost::shared_ptr<MMapRegion> region_;
 };
 
 } // namespace fastcgi
@@ -0,0 +1,312 @@
+#include "settings.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include <boost/crc.hpp>
+
+#include "fastcgi2/logger.h"
+
+#include "request_journal.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+static const char ENQUEUE_RECORD = 'E';
+static const char COMPLETE_RECORD = 'C';
+
+/* type, retries, due time and key length precede key, crc32 follows it */
+static const std::size_t RECORD_HEADER = 14;
+static const std::size_t RECORD_CRC = 4;
+static const std::size_t MAX_KEY_SIZE = 255;
+static const boost::uint64_t COMPACT_MIN_RECORDS = 4096;
+
+static boost::uint32_t
+checksum(const char *data, std::size_t size) {
+	boost::crc_32_type crc;
+	crc.process_bytes(data, size);
+	return crc.checksum();
+}
+
+static void
+putInt(char *buf, boost::uint64_t value, std::size_t size) {
+	for (std::size_t i = 0; i < size; ++i) {
+		buf[i] = static_cast<char>(value >> (8 * i));
+	}
+}
+
+static boost::uint64_t
+getInt(const char *buf, std::size_t size) {
+	boost::uint64_t value = 0;
+	for (std::size_t i = 0; i < size; ++i) {
+		value |= static_cast<boost::uint64_t>(static_cast<unsigned char>(buf[i])) << (8 * i);
+	}
+	return value;
+}
+
+static std::size_t
+encode(char *buf, char type, const std::string &key, const JournalEntry &entry) {
+	buf[0] = type;
+	putInt(buf + 1, entry.retries, 4);
+	putInt(buf + 5, entry.when, 8);
+	buf[13] = static_cast<char>(key.size());
+	memcpy(buf + RECORD_HEADER, key.data(), key.size());
+	std::size_t size = RECORD_HEADER + key.size();
+	putInt(buf + size, checksum(buf, size), RECORD_CRC);
+	return size + RECORD_CRC;
+}
+
+static bool
+writeAll(int fd, const char *data, std::size_t size) {
+	while (size > 0) {
+		ssize_t res = ::write(fd, data, size);
+		if (-1 == res) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return false;
+		}
+		data += res;
+		size -= res;
+	}
+	return true;
+}
+
+static std::string
+errorText(int error) {
+	char buffer[256];
+	return strerror_r(error, buffer, sizeof(buffer));
+}
+
+RequestJournal::RequestJournal(const std::string &path, Logger *logger) :
+	path_(path), logger_(logger), fd_(-1), records_(0), appended_records_(0),
+	compact_requested_(false), compacting_(false)
+{}
+
+RequestJournal::~RequestJournal() {
+	if (-1 != fd_) {
+		close(fd_);
+	}
+}
+
+void
+RequestJournal::open() {
+	if (-1 != fd_) {
+		close(fd_);
+	}
+	fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (-1 == fd_) {
+		throw std::runtime_error("cannot open request journal " + path_ + ": " + errorText(errno));
+	}
+}
+
+void
+RequestJournal::load(std::map<std::string, JournalEntry> &live) {
+	boost::mutex::scoped_lock lock(mutex_);
+
+	std::vector<char> data;
+	int fd = ::open(path_.c_str(), O_RDONLY);
+	if (-1 == fd) {
+		if (ENOENT != errno) {
+			throw std::runtime_error("cannot read request journal " + path_ + ": " + errorText(errno));
+		}
+	}
+	else {
+		struct stat fs;
+		if (0 == fstat(fd, &fs)) {
+			data.resize(fs.st_size);
+		}
+		std::size_t size = 0;
+		while (size < data.size()) {
+			ssize_t res = ::read(fd, &data[size], data.size() - size);
+			if (res <= 0 && !(-1 == res && EINTR == errno)) {
+				break;
+			}
+			size += res > 0 ? res : 0;
+		}
+		data.resize(size);
+		close(fd);
+	}
+
+	live_.clear();
+	std::size_t pos = 0;
+	boost::uint64_t damaged = 0;
+	while (data.size() - pos >= RECORD_HEADER + RECORD_CRC) {
+		const char *record = &data[pos];
+		std::size_t key_size = static_cast<unsigned char>(record[13]);
+		std::size_t size = RECORD_HEADER + key_size;
+		if ((ENQUEUE_RECORD != record[0] && COMPLETE_RECORD != record[0]) ||
+			data.size() - pos < size + RECORD_CRC || checksum(record, size) != getInt(record + size, RECORD_CRC)) {
+			/* damaged record is skipped byte by byte until next record with valid crc */
+			++pos;
+			++damaged;
+			continue;
+		}
+		std::string key(record + RECORD_HEADER, key_size);
+		if (ENQUEUE_RECORD == record[0]) {
+			live_[key] = JournalEntry(static_cast<int>(getInt(record + 1, 4)), getInt(record + 5, 8));
+		}
+		else {
+			live_.erase(key);
+		}
+		pos += size + RECORD_CRC;
+	}
+	damaged += data.size() - pos;
+	if (damaged > 0) {
+		logger_->error("request journal %s has %llu damaged bytes, they are dropped",
+			path_.c_str(), static_cast<unsigned long long>(damaged));
+	}
+
+	compact();
+	live = live_;
+}
+
+void
+RequestJournal::merge(const std::map<std::string, JournalEntry> &entries) {
+	boost::mutex::scoped_lock lock(mutex_);
+	live_.insert(entries.begin(), entries.end());
+	compact();
+}
+
+void
+RequestJournal::compact() {
+	std::vector<char> data;
+	encodeLive(data);
+	replace(writeTemporary(data));
+	records_ = live_.size();
+}
+
+void
+RequestJournal::compactIfRequested() {
+	std::vector<char> data;
+	boost::uint64_t records = 0;
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		if (!compact_requested_) {
+			return;
+		}
+		compact_requested_ = false;
+		encodeLive(data);
+		records = live_.size();
+		compacting_ = true;
+	}
+
+	/* live entries are written and synced without lock, records appended meanwhile are copied after them */
+	int fd = -1;
+	try {
+		fd = writeTemporary(data);
+	}
+	catch (...) {
+		boost::mutex::scoped_lock lock(mutex_);
+		compacting_ = false;
+		appended_.clear();
+		appended_records_ = 0;
+		throw;
+	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+	compacting_ = false;
+	std::vector<char> appended;
+	appended.swap(appended_);
+	records += appended_records_;
+	appended_records_ = 0;
+	if (!appended.empty() && !writeAll(fd, &appended[0], appended.size())) {
+		int error = errno;
+		close(fd);
+		unlink((path_ + ".tmp").c_str());
+		throw std::runtime_error("cannot write request journal " + path_ + ": " + errorText(error));
+	}
+	replace(fd);
+	records_ = records;
+}
+
+void
+RequestJournal::encodeLive(std::vector<char> &data) const {
+	data.resize(live_.size() * (RECORD_HEADER + MAX_KEY_SIZE + RECORD_CRC));
+	std::size_t size = 0;
+	for (std::map<std::string, JournalEntry>::const_iterator it = live_.begin(), end = live_.end(); it != end; ++it) {
+		size += encode(&data[size], ENQUEUE_RECORD, it->first, it->second);
+	}
+	data.resize(size);
+}
+
+int
+RequestJournal::writeTemporary(const std::vector<char> &data) {
+	std::string tmp_path = path_ + ".tmp";
+	int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (-1 == fd) {
+		throw std::runtime_error("cannot create request journal " + tmp_path + ": " + errorText(errno));
+	}
+	if (!writeAll(fd, data.empty() ? NULL : &data[0], data.size()) || 0 != fsync(fd)) {
+		int error = errno;
+		close(fd);
+		unlink(tmp_path.c_str());
+		throw std::runtime_error("cannot write request journal " + path_ + ": " + errorText(error));
+	}
+	return fd;
+}
+
+void
+RequestJournal::replace(int fd) {
+	std::string tmp_path = path_ + ".tmp";
+	close(fd);
+	if (-1 == rename(tmp_path.c_str(), path_.c_str())) {
+		int error = errno;
+		unlink(tmp_path.c_str());
+		throw std::runtime_error("cannot write request journal " + path_ + ": " + errorText(error));
+	}
+	open();
+}
+
+void
+RequestJournal::append(char type, const std::string &key, const JournalEntry &entry) {
+	if (key.size() > MAX_KEY_SIZE) {
+		logger_->error("request key %s is too long for journal", key.c_str());
+		return;
+	}
+	char record[RECORD_HEADER + MAX_KEY_SIZE + RECORD_CRC];
+	std::size_t size = encode(record, type, key, entry);
+	if (-1 == fd_ || !writeAll(fd_, record, size)) {
+		logger_->error("cannot write request journal %s: %s", path_.c_str(), errorText(errno).c_str());
+		return;
+	}
+	++records_;
+	if (compacting_) {
+		appended_.insert(appended_.end(), record, record + size);
+		++appended_records_;
+	}
+	else if (records_ >= COMPACT_MIN_RECORDS && records_ > 4 * live_.size()) {
+		compact_requested_ = true;
+	}
+}
+
+void
+RequestJournal::enqueue(const std::string &key, int retries, boost::uint64_t when) {
+	boost::mutex::scoped_lock lock(mutex_);
+	JournalEntry entry(retries, when);
+	live_[key] = entry;
+	append(ENQUEUE_RECORD, key, entry);
+}
+
+void
+RequestJournal::complete(const std::string &key) {
+	boost::mutex::scoped_lock lock(mutex_);
+	if (0 == live_.erase(key)) {
+		return;
+	}
+	append(COMPLETE_RECORD, key, JournalEntry());
+}
+
+} // namespace fastcgi
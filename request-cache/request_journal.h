@@ -0,0 +1,73 @@
+#ifndef _FASTCGI_REQUEST_CACHE_REQUEST_JOURNAL_H_
+#define _FASTCGI_REQUEST_CACHE_REQUEST_JOURNAL_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace fastcgi
+{
+
+class Logger;
+
+struct JournalEntry {
+	JournalEntry() : retries(0), when(0) {}
+	JournalEntry(int num_retries, boost::uint64_t when_millis) :
+		retries(num_retries), when(when_millis)
+	{}
+	int retries;
+	boost::uint64_t when;
+};
+
+/**
+ * Append-only log of delayed requests kept next to cached request files.
+ * Every delayed request is written with its retry number and absolute due time
+ * and is closed when its replay is finished, so schedule survives daemon restart.
+ * Records are appended without fsync: they survive a crash of the daemon process,
+ * but records written shortly before a power loss or kernel crash may be lost.
+ * Records carry crc32, torn tail and damaged records are dropped on load.
+ * Journal is rewritten with live entries on load and when dead records dominate,
+ * rewrite is synced before it replaces the old journal. Appends only request the latter
+ * rewrite, it is done by compactIfRequested from cache thread, so savers never wait for it.
+ */
+
+class RequestJournal : private boost::noncopyable {
+public:
+	RequestJournal(const std::string &path, Logger *logger);
+	~RequestJournal();
+
+	void load(std::map<std::string, JournalEntry> &live);
+	/** adds entries not known yet and rewrites journal synced before return */
+	void merge(const std::map<std::string, JournalEntry> &entries);
+	void enqueue(const std::string &key, int retries, boost::uint64_t when);
+	void complete(const std::string &key);
+	void compactIfRequested();
+
+private:
+	void append(char type, const std::string &key, const JournalEntry &entry);
+	void compact();
+	void encodeLive(std::vector<char> &data) const;
+	int writeTemporary(const std::vector<char> &data);
+	void replace(int fd);
+	void open();
+
+private:
+	std::string path_;
+	Logger *logger_;
+	int fd_;
+	std::map<std::string, JournalEntry> live_;
+	boost::uint64_t records_;
+	std::vector<char> appended_;
+	boost::uint64_t appended_records_;
+	bool compact_requested_;
+	bool compacting_;
+	boost::mutex mutex_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_REQUEST_CACHE_REQUEST_JOURNAL_H_
@@ -0,0 +1,115 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "timer_wheel.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi
+{
+
+const unsigned int TimerWheel::LEVELS;
+const unsigned int TimerWheel::SLOT_BITS;
+const unsigned int TimerWheel::SLOTS;
+
+TimerWheel::TimerWheel(boost::uint64_t now) :
+	current_(now), size_(0)
+{}
+
+void
+TimerWheel::insert(boost::uint64_t when, const DelayTask &task) {
+	place(Entry(when, task));
+	++size_;
+}
+
+void
+TimerWheel::place(const Entry &entry) {
+	boost::uint64_t tick = std::max(entry.tick, current_);
+	unsigned int level = 0;
+	while (level < LEVELS - 1 && tick - current_ >= (static_cast<boost::uint64_t>(1) << (SLOT_BITS * (level + 1)))) {
+		++level;
+	}
+	boost::uint64_t limit = static_cast<boost::uint64_t>(1) << (SLOT_BITS * LEVELS);
+	if (tick - current_ >= limit) {
+		/* farther than wheel covers, entry is parked in the last level and placed again on cascade */
+		tick = current_ + limit - 1;
+	}
+	slots_[level][(tick >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(entry);
+}
+
+void
+TimerWheel::cascade(unsigned int level) {
+	Slot entries;
+	entries.swap(slots_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+	for (Slot::iterator it = entries.begin(), end = entries.end(); it != end; ++it) {
+		place(*it);
+	}
+}
+
+void
+TimerWheel::advance(boost::uint64_t now, std::vector<DelayTask> &due) {
+	while (current_ <= now) {
+		boost::uint64_t next = nextTick();
+		if (0 == size_ || next > now) {
+			current_ = now + 1;
+			return;
+		}
+		current_ = next;
+		unsigned int index = current_ & (SLOTS - 1);
+		if (0 == index) {
+			for (unsigned int level = 1; level < LEVELS; ++level) {
+				cascade(level);
+				if (0 != ((current_ >> (SLOT_BITS * level)) & (SLOTS - 1))) {
+					break;
+				}
+			}
+		}
+		Slot entries;
+		entries.swap(slots_[0][index]);
+		for (Slot::iterator it = entries.begin(), end = entries.end(); it != end; ++it) {
+			if (it->tick <= current_) {
+				due.push_back(it->task);
+				--size_;
+			}
+			else {
+				place(*it);
+			}
+		}
+		++current_;
+	}
+}
+
+boost::uint64_t
+TimerWheel::nextTick() const {
+	/* earliest tick at which some non-empty slot is either due or cascades, idle rotations are skipped */
+	boost::uint64_t next = std::numeric_limits<boost::uint64_t>::max();
+	for (unsigned int level = 0; level < LEVELS; ++level) {
+		unsigned int shift = SLOT_BITS * level;
+		boost::uint64_t span = static_cast<boost::uint64_t>(1) << shift;
+		boost::uint64_t start = ((current_ + span - 1) >> shift) << shift;
+		unsigned int index = (start >> shift) & (SLOTS - 1);
+		for (unsigned int offset = 0; offset < SLOTS; ++offset) {
+			if (!slots_[level][(index + offset) & (SLOTS - 1)].empty()) {
+				next = std::min(next, start + offset * span);
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+bool
+TimerWheel::empty() const {
+	return 0 == size_;
+}
+
+std::size_t
+TimerWheel::size() const {
+	return size_;
+}
+
+} // namespace fastcgi
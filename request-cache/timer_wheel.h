@@ -0,0 +1,71 @@
+#ifndef _FASTCGI_REQUEST_CACHE_TIMER_WHEEL_H_
+#define _FASTCGI_REQUEST_CACHE_TIMER_WHEEL_H_
+
+#include <string>
+#include <vector>
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace fastcgi
+{
+
+struct DelayTask {
+	DelayTask() {}
+	DelayTask(const std::string &key_str, int num_retries) :
+		key(key_str), retries(num_retries)
+	{}
+	std::string key;
+	int retries;
+};
+
+/**
+ * Hierarchical timer wheel for delayed requests.
+ * Time is measured in ticks, tasks due in the next 256 ticks live in the first level,
+ * farther ones are kept in coarser levels and cascade down as the wheel turns.
+ * Insertion is O(1) and every tick costs O(1) plus the tasks it moves.
+ * Not thread safe, owner serializes access.
+ */
+
+class TimerWheel : private boost::noncopyable {
+public:
+	TimerWheel(boost::uint64_t now);
+
+	/**
+	 * Tasks for ticks already passed fire on next advance.
+	 * Wheel should be advanced to current time before insert, otherwise idle ticks are walked later.
+	 */
+	void insert(boost::uint64_t when, const DelayTask &task);
+
+	/** moves tasks due at or before now to due and turns wheel to now */
+	void advance(boost::uint64_t now, std::vector<DelayTask> &due);
+
+	/** tick wheel needs to be advanced at, tasks may not be due yet if it is a cascade tick */
+	boost::uint64_t nextTick() const;
+
+	bool empty() const;
+	std::size_t size() const;
+
+private:
+	struct Entry {
+		Entry(boost::uint64_t when, const DelayTask &delay_task) : tick(when), task(delay_task) {}
+		boost::uint64_t tick;
+		DelayTask task;
+	};
+	typedef std::vector<Entry> Slot;
+
+	void place(const Entry &entry);
+	void cascade(unsigned int level);
+
+	static const unsigned int LEVELS = 4;
+	static const unsigned int SLOT_BITS = 8;
+	static const unsigned int SLOTS = 1 << SLOT_BITS;
+
+	Slot slots_[LEVELS][SLOTS];
+	boost::uint64_t current_;
+	std::size_t size_;
+};
+
+} // namespace fastcgi
+
+#endif // _FASTCGI_REQUEST_CACHE_TIMER_WHEEL_H_
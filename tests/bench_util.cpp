@@ -0,0 +1,142 @@
+#include "settings.h"
+
+#include <sys/time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "fastcgi2/util.h"
+#include "details/char_search.h"
+#include "details/range.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+using namespace fastcgi;
+
+/* previous StringUtils implementation, kept as baseline */
+
+static void
+referenceDecode(const Range &range, std::string &result) {
+	for (const char *i = range.begin(), *end = range.end(); i != end; ++i) {
+		switch (*i) {
+			case '+':
+				result.append(1, ' ');
+				break;
+			case '%':
+				if (std::distance(i, end) > 2) {
+					int digit;
+					char f = *(i + 1), s = *(i + 2);
+					digit = (f >= 'A' ? ((f & 0xDF) - 'A') + 10 : (f - '0')) * 16;
+					digit += (s >= 'A') ? ((s & 0xDF) - 'A') + 10 : (s - '0');
+					result.append(1, static_cast<char>(digit));
+					i += 2;
+				}
+				else {
+					result.append(1, '%');
+				}
+				break;
+			default:
+				result.append(1, (*i));
+				break;
+		}
+	}
+}
+
+static std::string
+referenceDecode(const Range &range) {
+	std::string result;
+	result.reserve(range.size());
+	referenceDecode(range, result);
+	return result;
+}
+
+static void
+referenceParse(const Range &range, std::vector<StringUtils::NamedValue> &v) {
+	Range tmp = range;
+	while (!tmp.empty()) {
+		Range key, value, head, tail;
+		tmp.split('&', head, tail);
+		head.split('=', key, value);
+		if (!key.empty()) {
+			v.push_back(std::pair<std::string, std::string>(referenceDecode(key), referenceDecode(value)));
+		}
+		tmp = tail;
+	}
+}
+
+static double
+now() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static std::string
+makeForm(std::size_t size, bool encoded) {
+	std::string form;
+	form.reserve(size + 64);
+	srand(1);
+	while (form.size() < size) {
+		if (!form.empty()) {
+			form.push_back('&');
+		}
+		form.append("field").append(1, 'a' + rand() % 26).push_back('=');
+		std::size_t length = 16 + rand() % 512;
+		for (std::size_t i = 0; i < length; ++i) {
+			int r = rand() % 64;
+			if (encoded && r == 0) {
+				form.append("%D0");
+			}
+			else if (encoded && r == 1) {
+				form.push_back('+');
+			}
+			else {
+				form.push_back('a' + r % 26);
+			}
+		}
+	}
+	return form;
+}
+
+static void
+run(const char *name, const std::string &form, int iterations) {
+	Range range = Range::fromString(form);
+
+	std::vector<StringUtils::NamedValue> expected, actual;
+	referenceParse(range, expected);
+	StringUtils::parse(range, actual);
+	if (expected != actual) {
+		fprintf(stderr, "%s: result mismatch\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	double start = now();
+	for (int i = 0; i < iterations; ++i) {
+		std::vector<StringUtils::NamedValue> v;
+		referenceParse(range, v);
+	}
+	double reference = now() - start;
+
+	start = now();
+	for (int i = 0; i < iterations; ++i) {
+		std::vector<StringUtils::NamedValue> v;
+		StringUtils::parse(range, v);
+	}
+	double current = now() - start;
+
+	double mb = static_cast<double>(form.size()) * iterations / (1024 * 1024);
+	printf("%-12s reference %8.1f MB/s, current %8.1f MB/s (%s)\n",
+		name, mb / reference, mb / current, CharSearch::implementation());
+}
+
+int
+main(int argc, char *argv[]) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 200;
+	run("plain", makeForm(512 * 1024, false), iterations);
+	run("encoded", makeForm(512 * 1024, true), iterations);
+	return EXIT_SUCCESS;
+}
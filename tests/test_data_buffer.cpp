@@ -0,0 +1,85 @@
+#include "settings.h"
+
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "fastcgi2/component.h"
+#include "fastcgi2/config.h"
+#include "fastcgi2/data_buffer.h"
+
+#include "details/componentset.h"
+#include "details/globals.h"
+#include "details/request_cache.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class DataBufferTest : public CppUnit::TestFixture
+{
+public:
+	void testFileTrim();
+	void testFileCompare();
+
+private:
+	DataBuffer createFileBuffer(Globals *globals, const std::string &data);
+
+private:
+	CPPUNIT_TEST_SUITE(DataBufferTest);
+	CPPUNIT_TEST(testFileTrim);
+	CPPUNIT_TEST(testFileCompare);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(DataBufferTest);
+
+DataBuffer
+DataBufferTest::createFileBuffer(Globals *globals, const std::string &data) {
+	RequestCache *cache = dynamic_cast<RequestCache*>(globals->components()->find("request-cache"));
+	CPPUNIT_ASSERT(NULL != cache);
+	DataBuffer buffer = cache->create();
+	buffer.resize(data.size());
+	buffer.write(0, data.data(), data.size());
+	return buffer;
+}
+
+void
+DataBufferTest::testFileTrim() {
+	std::auto_ptr<Config> config = Config::create("test_cache.conf");
+	boost::shared_ptr<Globals> globals(new Globals(config.get()));
+
+	std::string result;
+	createFileBuffer(globals.get(), " \t value \r\n").trim().toString(result);
+	CPPUNIT_ASSERT_EQUAL(std::string("value"), result);
+
+	createFileBuffer(globals.get(), "value  ").trim().toString(result);
+	CPPUNIT_ASSERT_EQUAL(std::string("value"), result);
+
+	CPPUNIT_ASSERT(createFileBuffer(globals.get(), " \r\n\t ").trim().empty());
+
+	/* whitespace crosses file window boundary on both sides */
+	std::string data = std::string(1030, ' ') + "value" + std::string(1030, '\n');
+	DataBuffer trimmed = createFileBuffer(globals.get(), data).trim();
+	CPPUNIT_ASSERT_EQUAL((boost::uint64_t)5, trimmed.size());
+	trimmed.toString(result);
+	CPPUNIT_ASSERT_EQUAL(std::string("value"), result);
+}
+
+void
+DataBufferTest::testFileCompare() {
+	std::auto_ptr<Config> config = Config::create("test_cache.conf");
+	boost::shared_ptr<Globals> globals(new Globals(config.get()));
+
+	/* compared ranges cross file window boundary */
+	std::string data = std::string(1020, 'a') + "boundary" + std::string(1020, 'b');
+	DataBuffer buffer = createFileBuffer(globals.get(), data);
+	CPPUNIT_ASSERT_EQUAL(0, buffer.compare(1020, "boundary", 8));
+	CPPUNIT_ASSERT(buffer.compare(1020, "boundarz", 8) < 0);
+	CPPUNIT_ASSERT(buffer.startsWith(std::string(1020, 'a') + "bound"));
+	CPPUNIT_ASSERT(buffer.endsWith("ary" + std::string(1020, 'b')));
+	CPPUNIT_ASSERT(!buffer.endsWith("arx" + std::string(1020, 'b')));
+}
+
+} // namespace fastcgi
@@ -0,0 +1,642 @@
+#include "settings.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "fcgi_connection.h"
+#include "fcgi_protocol.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+struct TestRecord {
+	unsigned char type;
+	unsigned short requestId;
+	std::string content;
+};
+
+class FastcgiConnectionTest : public CppUnit::TestFixture
+{
+public:
+	virtual void setUp();
+	virtual void tearDown();
+
+	void testSplitHeader();
+	void testPadding();
+	void testEmptyStdin();
+	void testStdinBeforeParams();
+	void testAbortPending();
+	void testAbortActive();
+	void testUnknownRole();
+	void testGetValues();
+	void testUnknownType();
+	void testPartialWrite();
+	void testMultiplexedOutOfOrder();
+	void testKeepConnReuse();
+	void testDuplicateRequestId();
+	void testCloseWithoutKeepConn();
+	void testPeerEofWithActiveRequest();
+	void testOutputLimit();
+
+private:
+	static std::string record(unsigned char type, unsigned short requestId,
+		const std::string &content, unsigned char padding = 0);
+	static std::string begin(unsigned short requestId, unsigned short role, bool keep);
+	static std::string nameValue(const std::string &name, const std::string &value);
+	static std::string request(unsigned short requestId, const std::string &body, bool keep);
+
+	void send(const std::string &data);
+	bool feed(const std::string &data, FastcgiConnection::RequestList &ready);
+	void receive(std::vector<TestRecord> &records);
+	void receiveAll(std::vector<TestRecord> &records, unsigned short requestId);
+	std::string params(const FastcgiRequestData &data) const;
+	std::string output(const std::vector<TestRecord> &records, unsigned short requestId) const;
+	void writeOutput(unsigned short requestId, const std::string *data, bool *done);
+	void setSendBuffer(int size);
+
+private:
+	int peer_;
+	int epoll_;
+	std::auto_ptr<FastcgiConnection> connection_;
+	std::string input_;
+	boost::mutex mutex_;
+
+	CPPUNIT_TEST_SUITE(FastcgiConnectionTest);
+	CPPUNIT_TEST(testSplitHeader);
+	CPPUNIT_TEST(testPadding);
+	CPPUNIT_TEST(testEmptyStdin);
+	CPPUNIT_TEST(testStdinBeforeParams);
+	CPPUNIT_TEST(testAbortPending);
+	CPPUNIT_TEST(testAbortActive);
+	CPPUNIT_TEST(testUnknownRole);
+	CPPUNIT_TEST(testGetValues);
+	CPPUNIT_TEST(testUnknownType);
+	CPPUNIT_TEST(testPartialWrite);
+	CPPUNIT_TEST(testMultiplexedOutOfOrder);
+	CPPUNIT_TEST(testKeepConnReuse);
+	CPPUNIT_TEST(testDuplicateRequestId);
+	CPPUNIT_TEST(testCloseWithoutKeepConn);
+	CPPUNIT_TEST(testPeerEofWithActiveRequest);
+	CPPUNIT_TEST(testOutputLimit);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(FastcgiConnectionTest);
+
+void
+FastcgiConnectionTest::setUp() {
+	int fds[2];
+	CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL, 0) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL, 0) | O_NONBLOCK);
+	peer_ = fds[1];
+	input_.clear();
+
+	epoll_ = epoll_create(1);
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = fds[0];
+	epoll_ctl(epoll_, EPOLL_CTL_ADD, fds[0], &event);
+	connection_.reset(new FastcgiConnection(fds[0], epoll_));
+}
+
+void
+FastcgiConnectionTest::tearDown() {
+	connection_.reset();
+	close(peer_);
+	close(epoll_);
+}
+
+std::string
+FastcgiConnectionTest::record(unsigned char type, unsigned short requestId,
+	const std::string &content, unsigned char padding) {
+
+	unsigned char header[FastcgiProtocol::HEADER_LENGTH];
+	FastcgiProtocol::writeHeader(header, type, requestId, content.size(), padding);
+	std::string result(reinterpret_cast<const char*>(header), sizeof(header));
+	result.append(content);
+	result.append(padding, 'p');
+	return result;
+}
+
+std::string
+FastcgiConnectionTest::begin(unsigned short requestId, unsigned short role, bool keep) {
+	std::string body(8, '\0');
+	body[0] = static_cast<char>(role >> 8);
+	body[1] = static_cast<char>(role);
+	body[2] = keep ? FastcgiProtocol::KEEP_CONN : 0;
+	return record(FastcgiProtocol::BEGIN_REQUEST, requestId, body);
+}
+
+std::string
+FastcgiConnectionTest::nameValue(const std::string &name, const std::string &value) {
+	unsigned char lengths[8];
+	std::size_t count = FastcgiProtocol::writeLength(lengths, name.size());
+	count += FastcgiProtocol::writeLength(lengths + count, value.size());
+	return std::string(reinterpret_cast<const char*>(lengths), count) + name + value;
+}
+
+std::string
+FastcgiConnectionTest::request(unsigned short requestId, const std::string &body, bool keep) {
+	std::string result = begin(requestId, FastcgiProtocol::RESPONDER, keep);
+	result.append(record(FastcgiProtocol::PARAMS, requestId, nameValue("REQUEST_URI", "/test")));
+	result.append(record(FastcgiProtocol::PARAMS, requestId, std::string()));
+	if (!body.empty()) {
+		result.append(record(FastcgiProtocol::STDIN, requestId, body));
+	}
+	result.append(record(FastcgiProtocol::STDIN, requestId, std::string()));
+	return result;
+}
+
+void
+FastcgiConnectionTest::send(const std::string &data) {
+	CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(data.size()), write(peer_, data.data(), data.size()));
+}
+
+bool
+FastcgiConnectionTest::feed(const std::string &data, FastcgiConnection::RequestList &ready) {
+	send(data);
+	return connection_->read(ready);
+}
+
+void
+FastcgiConnectionTest::receive(std::vector<TestRecord> &records) {
+	char buffer[65536];
+	while (true) {
+		ssize_t res = read(peer_, buffer, sizeof(buffer));
+		if (res <= 0) {
+			CPPUNIT_ASSERT(0 == res || EAGAIN == errno);
+			break;
+		}
+		input_.append(buffer, res);
+	}
+
+	std::size_t pos = 0;
+	while (input_.size() - pos >= FastcgiProtocol::HEADER_LENGTH) {
+		FastcgiProtocol::Header header = FastcgiProtocol::readHeader(
+			reinterpret_cast<const unsigned char*>(input_.data() + pos));
+		std::size_t length = FastcgiProtocol::HEADER_LENGTH + header.contentLength + header.paddingLength;
+		if (input_.size() - pos < length) {
+			break;
+		}
+		CPPUNIT_ASSERT_EQUAL(0, (header.contentLength + header.paddingLength) % 8);
+		TestRecord record;
+		record.type = header.type;
+		record.requestId = header.requestId;
+		record.content = input_.substr(pos + FastcgiProtocol::HEADER_LENGTH, header.contentLength);
+		records.push_back(record);
+		pos += length;
+	}
+	input_.erase(0, pos);
+}
+
+/* acts as reactor: flushes queued output when socket is writable until request ends */
+void
+FastcgiConnectionTest::receiveAll(std::vector<TestRecord> &records, unsigned short requestId) {
+	struct epoll_event event;
+	for (int i = 0; i < 10000; ++i) {
+		receive(records);
+		for (std::vector<TestRecord>::iterator it = records.begin(); it != records.end(); ++it) {
+			if (FastcgiProtocol::END_REQUEST == it->type && requestId == it->requestId) {
+				return;
+			}
+		}
+		if (1 == epoll_wait(epoll_, &event, 1, 100) && (event.events & EPOLLOUT)) {
+			connection_->flush();
+		}
+	}
+	CPPUNIT_FAIL("request is not completed");
+}
+
+std::string
+FastcgiConnectionTest::output(const std::vector<TestRecord> &records, unsigned short requestId) const {
+	std::string result;
+	for (std::vector<TestRecord>::const_iterator it = records.begin(); it != records.end(); ++it) {
+		if (FastcgiProtocol::STDOUT == it->type && requestId == it->requestId) {
+			result.append(it->content);
+		}
+	}
+	return result;
+}
+
+void
+FastcgiConnectionTest::writeOutput(unsigned short requestId, const std::string *data, bool *done) {
+	connection_->writeRecord(FastcgiProtocol::STDOUT, requestId, data->data(), data->size());
+	boost::mutex::scoped_lock lock(mutex_);
+	*done = true;
+}
+
+void
+FastcgiConnectionTest::setSendBuffer(int size) {
+	setsockopt(connection_->fd(), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+}
+
+std::string
+FastcgiConnectionTest::params(const FastcgiRequestData &data) const {
+	return std::string(data.params.begin(), data.params.end());
+}
+
+void
+FastcgiConnectionTest::testSplitHeader() {
+	std::string data = request(1, "body", false);
+	FastcgiConnection::RequestList ready;
+
+	/* every byte arrives separately, record headers are split at each position */
+	for (std::size_t i = 0; i + 1 < data.size(); ++i) {
+		CPPUNIT_ASSERT(feed(data.substr(i, 1), ready));
+		CPPUNIT_ASSERT(ready.empty());
+	}
+	CPPUNIT_ASSERT(feed(data.substr(data.size() - 1), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(1), ready[0]->id);
+	CPPUNIT_ASSERT(!ready[0]->keepConnection);
+	CPPUNIT_ASSERT_EQUAL(nameValue("REQUEST_URI", "/test"), params(*ready[0]));
+	CPPUNIT_ASSERT_EQUAL(std::string("body"), std::string(ready[0]->body.begin(), ready[0]->body.end()));
+}
+
+void
+FastcgiConnectionTest::testPadding() {
+	std::string data = begin(3, FastcgiProtocol::RESPONDER, true);
+	data.append(record(FastcgiProtocol::PARAMS, 3, nameValue("A", "1"), 5));
+	data.append(record(FastcgiProtocol::PARAMS, 3, nameValue("B", "2"), 255));
+	data.append(record(FastcgiProtocol::PARAMS, 3, std::string(), 7));
+	data.append(record(FastcgiProtocol::STDIN, 3, "abc", 5));
+	data.append(record(FastcgiProtocol::STDIN, 3, "defgh", 3));
+	data.append(record(FastcgiProtocol::STDIN, 3, std::string(), 1));
+
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(data, ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+	CPPUNIT_ASSERT(ready[0]->keepConnection);
+	CPPUNIT_ASSERT_EQUAL(nameValue("A", "1") + nameValue("B", "2"), params(*ready[0]));
+	CPPUNIT_ASSERT_EQUAL(std::string("abcdefgh"), std::string(ready[0]->body.begin(), ready[0]->body.end()));
+}
+
+void
+FastcgiConnectionTest::testEmptyStdin() {
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, std::string(), false), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+	CPPUNIT_ASSERT(ready[0]->body.empty());
+	CPPUNIT_ASSERT(ready[0]->bodyFile.isNil());
+
+	/* records of request which is already passed to handler are ignored */
+	ready.clear();
+	CPPUNIT_ASSERT(feed(record(FastcgiProtocol::STDIN, 1, "late"), ready));
+	CPPUNIT_ASSERT(ready.empty());
+}
+
+void
+FastcgiConnectionTest::testStdinBeforeParams() {
+	std::string data = begin(1, FastcgiProtocol::RESPONDER, false);
+	data.append(record(FastcgiProtocol::PARAMS, 1, nameValue("A", "1")));
+	data.append(record(FastcgiProtocol::STDIN, 1, std::string()));
+
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(!feed(data, ready));
+	CPPUNIT_ASSERT(ready.empty());
+
+	/* connection is aborted and shut down */
+	char c;
+	CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(0), read(peer_, &c, 1));
+	CPPUNIT_ASSERT(connection_->finish());
+}
+
+void
+FastcgiConnectionTest::testAbortPending() {
+	std::string data = begin(5, FastcgiProtocol::RESPONDER, true);
+	data.append(record(FastcgiProtocol::PARAMS, 5, nameValue("A", "1")));
+	data.append(record(FastcgiProtocol::ABORT_REQUEST, 5, std::string()));
+	data.append(record(FastcgiProtocol::PARAMS, 5, std::string()));
+	data.append(record(FastcgiProtocol::STDIN, 5, std::string()));
+
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(data, ready));
+	CPPUNIT_ASSERT(ready.empty());
+
+	std::vector<TestRecord> records;
+	receive(records);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(2), records.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::STDOUT), records[0].type);
+	CPPUNIT_ASSERT(records[0].content.empty());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::END_REQUEST), records[1].type);
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(5), records[1].requestId);
+	CPPUNIT_ASSERT_EQUAL(static_cast<char>(FastcgiProtocol::REQUEST_COMPLETE), records[1].content[4]);
+
+	/* aborted request id may be used again */
+	CPPUNIT_ASSERT(feed(request(5, "x", true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+}
+
+void
+FastcgiConnectionTest::testAbortActive() {
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(7, std::string(), true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+	CPPUNIT_ASSERT(!ready[0]->aborted);
+
+	/* request in handler is only marked, it completes itself */
+	FastcgiConnection::RequestList more;
+	CPPUNIT_ASSERT(feed(record(FastcgiProtocol::ABORT_REQUEST, 7, std::string()), more));
+	CPPUNIT_ASSERT(more.empty());
+	CPPUNIT_ASSERT(ready[0]->aborted);
+
+	std::vector<TestRecord> records;
+	receive(records);
+	CPPUNIT_ASSERT(records.empty());
+
+	connection_->endRequest(7);
+	receive(records);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(2), records.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::END_REQUEST), records[1].type);
+}
+
+void
+FastcgiConnectionTest::testUnknownRole() {
+	FastcgiConnection::RequestList ready;
+	std::string data = begin(2, 2, true);
+	data.append(record(FastcgiProtocol::PARAMS, 2, std::string()));
+	data.append(record(FastcgiProtocol::STDIN, 2, std::string()));
+	CPPUNIT_ASSERT(feed(data, ready));
+	CPPUNIT_ASSERT(ready.empty());
+
+	std::vector<TestRecord> records;
+	receive(records);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), records.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::END_REQUEST), records[0].type);
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(2), records[0].requestId);
+	CPPUNIT_ASSERT_EQUAL(static_cast<char>(FastcgiProtocol::UNKNOWN_ROLE), records[0].content[4]);
+}
+
+void
+FastcgiConnectionTest::testGetValues() {
+	std::string query = nameValue("FCGI_MAX_CONNS", "") + nameValue("FCGI_MPXS_CONNS", "") +
+		nameValue(std::string(200, 'n'), "");
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(record(FastcgiProtocol::GET_VALUES, FastcgiProtocol::NULL_REQUEST_ID, query), ready));
+
+	std::vector<TestRecord> records;
+	receive(records);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), records.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::GET_VALUES_RESULT), records[0].type);
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(FastcgiProtocol::NULL_REQUEST_ID), records[0].requestId);
+	CPPUNIT_ASSERT_EQUAL(nameValue("FCGI_MPXS_CONNS", "1"), records[0].content);
+
+	/* nothing known is asked */
+	records.clear();
+	CPPUNIT_ASSERT(feed(record(FastcgiProtocol::GET_VALUES, FastcgiProtocol::NULL_REQUEST_ID, std::string()), ready));
+	receive(records);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), records.size());
+	CPPUNIT_ASSERT(records[0].content.empty());
+}
+
+void
+FastcgiConnectionTest::testUnknownType() {
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(record(42, FastcgiProtocol::NULL_REQUEST_ID, "x"), ready));
+
+	std::vector<TestRecord> records;
+	receive(records);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), records.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::UNKNOWN_TYPE), records[0].type);
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(8), records[0].content.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<char>(42), records[0].content[0]);
+}
+
+void
+FastcgiConnectionTest::testPartialWrite() {
+	setSendBuffer(4096);
+
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, std::string(), false), ready));
+
+	std::string body;
+	for (std::size_t i = 0; i < 150000; ++i) {
+		body.push_back('a' + i % 26);
+	}
+	connection_->writeRecord(FastcgiProtocol::STDOUT, 1, body.data(), body.size());
+	connection_->endRequest(1);
+
+	/* output which did not fit into socket waits for EPOLLOUT and is sent by flush */
+	std::vector<TestRecord> records;
+	receive(records);
+	CPPUNIT_ASSERT(records.empty() || FastcgiProtocol::END_REQUEST != records.back().type);
+
+	struct epoll_event event;
+	bool writable = false;
+	for (int i = 0; i < 10000 && (records.empty() || FastcgiProtocol::END_REQUEST != records.back().type); ++i) {
+		if (1 == epoll_wait(epoll_, &event, 1, 100) && (event.events & EPOLLOUT)) {
+			writable = true;
+			connection_->flush();
+		}
+		receive(records);
+	}
+	CPPUNIT_ASSERT(writable);
+
+	std::string output;
+	for (std::vector<TestRecord>::iterator it = records.begin(); it != records.end(); ++it) {
+		CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(1), it->requestId);
+		if (FastcgiProtocol::STDOUT == it->type) {
+			CPPUNIT_ASSERT(it->content.size() <= 65528);
+			output.append(it->content);
+		}
+	}
+	CPPUNIT_ASSERT(!records.empty());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::END_REQUEST), records.back().type);
+	CPPUNIT_ASSERT(body == output);
+
+	/* all output is sent, only input is watched */
+	CPPUNIT_ASSERT_EQUAL(0, epoll_wait(epoll_, &event, 1, 0));
+}
+
+void
+FastcgiConnectionTest::testMultiplexedOutOfOrder() {
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, "first", true) + request(2, "second", true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(2), ready.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(1), ready[0]->id);
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(2), ready[1]->id);
+
+	/* second request is answered while first one is still in progress */
+	connection_->writeRecord(FastcgiProtocol::STDOUT, 1, "one-", 4);
+	connection_->endRequest(2, "two", 3);
+	connection_->writeRecord(FastcgiProtocol::STDOUT, 1, "one-more", 8);
+
+	std::vector<TestRecord> records;
+	receiveAll(records, 2);
+	CPPUNIT_ASSERT_EQUAL(std::string("two"), output(records, 2));
+	CPPUNIT_ASSERT_EQUAL(std::string("one-one-more"), output(records, 1));
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(1), records.back().requestId);
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::STDOUT), records.back().type);
+
+	/* third request arrives while first one is active */
+	CPPUNIT_ASSERT(feed(request(3, std::string(), true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(3), ready.size());
+	connection_->endRequest(1, "!", 1);
+	connection_->endRequest(3);
+
+	records.clear();
+	receiveAll(records, 3);
+	CPPUNIT_ASSERT_EQUAL(std::string("!"), output(records, 1));
+	CPPUNIT_ASSERT_EQUAL(std::string(), output(records, 3));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(5), records.size());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(1), records[2].requestId);
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned char>(FastcgiProtocol::END_REQUEST), records[2].type);
+
+	/* connection is kept, nothing is left to do after web server closes it */
+	shutdown(peer_, SHUT_WR);
+	CPPUNIT_ASSERT(!connection_->read(ready));
+	CPPUNIT_ASSERT(connection_->finish());
+}
+
+void
+FastcgiConnectionTest::testKeepConnReuse() {
+	for (int i = 0; i < 3; ++i) {
+		FastcgiConnection::RequestList ready;
+		CPPUNIT_ASSERT(feed(request(1, std::string(1, 'a' + i), true), ready));
+		CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+		CPPUNIT_ASSERT(ready[0]->keepConnection);
+		CPPUNIT_ASSERT_EQUAL(std::string(1, 'a' + i), std::string(ready[0]->body.begin(), ready[0]->body.end()));
+
+		connection_->endRequest(1, "done", 4);
+		std::vector<TestRecord> records;
+		receiveAll(records, 1);
+		CPPUNIT_ASSERT_EQUAL(std::string("done"), output(records, 1));
+	}
+
+	/* connection stays open for next request */
+	char c;
+	CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(-1), read(peer_, &c, 1));
+	CPPUNIT_ASSERT_EQUAL(EAGAIN, errno);
+}
+
+void
+FastcgiConnectionTest::testDuplicateRequestId() {
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, std::string(), true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+
+	/* id of request which is not ended yet cannot be reused */
+	CPPUNIT_ASSERT(!feed(begin(1, FastcgiProtocol::RESPONDER, true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+	CPPUNIT_ASSERT_THROW(connection_->endRequest(1), std::runtime_error);
+}
+
+void
+FastcgiConnectionTest::testCloseWithoutKeepConn() {
+	setSendBuffer(4096);
+
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, std::string(), false), ready));
+	CPPUNIT_ASSERT(!ready[0]->keepConnection);
+
+	std::string body(200000, 'x');
+	connection_->endRequest(1, body.data(), body.size());
+	connection_->close();
+
+	/* connection is shut down only after queued output is sent */
+	std::vector<TestRecord> records;
+	receiveAll(records, 1);
+	CPPUNIT_ASSERT(body == output(records, 1));
+
+	char c;
+	CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(0), read(peer_, &c, 1));
+}
+
+void
+FastcgiConnectionTest::testPeerEofWithActiveRequest() {
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, std::string(), true), ready));
+	CPPUNIT_ASSERT(feed(begin(2, FastcgiProtocol::RESPONDER, true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(1), ready.size());
+
+	/* incomplete request is dropped, request in handler keeps connection until it ends */
+	shutdown(peer_, SHUT_WR);
+	CPPUNIT_ASSERT(!connection_->read(ready));
+	CPPUNIT_ASSERT(!connection_->finish());
+
+	connection_->endRequest(1, "late", 4);
+	std::vector<TestRecord> records;
+	receiveAll(records, 1);
+	CPPUNIT_ASSERT_EQUAL(std::string("late"), output(records, 1));
+
+	char c;
+	CPPUNIT_ASSERT_EQUAL(static_cast<ssize_t>(0), read(peer_, &c, 1));
+}
+
+void
+FastcgiConnectionTest::testOutputLimit() {
+	setSendBuffer(4096);
+
+	FastcgiConnection::RequestList ready;
+	CPPUNIT_ASSERT(feed(request(1, std::string(), true) + request(2, std::string(), true), ready));
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(2), ready.size());
+
+	std::string body;
+	for (std::size_t i = 0; i < 1048576; ++i) {
+		body.push_back('a' + i % 26);
+	}
+	bool done = false;
+	boost::thread writer(boost::bind(&FastcgiConnectionTest::writeOutput, this, 1, &body, &done));
+
+	/* large output of first request waits for socket in its own thread */
+	boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+		CPPUNIT_ASSERT(!done);
+	}
+
+	/* second request is not held back by it */
+	connection_->endRequest(2, "small", 5);
+
+	/* reactor write wakes blocked writer as its output is sent */
+	std::vector<TestRecord> records;
+	struct epoll_event event;
+	for (int i = 0; i < 10000; ++i) {
+		receive(records);
+		boost::mutex::scoped_lock lock(mutex_);
+		if (done) {
+			break;
+		}
+		lock.unlock();
+		if (1 == epoll_wait(epoll_, &event, 1, 100) && (event.events & EPOLLOUT)) {
+			connection_->flush();
+		}
+	}
+	writer.join();
+	CPPUNIT_ASSERT(done);
+
+	connection_->endRequest(1);
+	receiveAll(records, 1);
+	CPPUNIT_ASSERT_EQUAL(std::string("small"), output(records, 2));
+	CPPUNIT_ASSERT(body == output(records, 1));
+
+	/* small answer is sent in between parts of large one */
+	std::size_t before = 0;
+	for (std::vector<TestRecord>::iterator it = records.begin(); it != records.end(); ++it) {
+		if (2 == it->requestId && FastcgiProtocol::END_REQUEST == it->type) {
+			break;
+		}
+		if (1 == it->requestId) {
+			before += it->content.size();
+		}
+	}
+	CPPUNIT_ASSERT(before < body.size());
+}
+
+} // namespace fastcgi
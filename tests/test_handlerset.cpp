@@ -0,0 +1,155 @@
+#include "settings.h"
+
+#include <sstream>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "fastcgi2/config.h"
+#include "fastcgi2/logger.h"
+#include "fastcgi2/request.h"
+#include "fastcgi2/request_io_stream.h"
+
+#include "details/componentset.h"
+#include "details/handlerset.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class HandlerSetTest : public CppUnit::TestFixture
+{
+public:
+	HandlerSetTest();
+
+	void testAddressRouteCache();
+	void testStreamingBody();
+	void testRouteOrder();
+
+private:
+	const HandlerSet::HandlerDescription* findHandler(const HandlerSet &handlers,
+		char *script_name, char *server_addr, char *remote_addr);
+	std::string findHandlerId(const HandlerSet &handlers, char *server_addr, char *remote_addr);
+
+private:
+	std::auto_ptr<Logger> logger_;
+
+	CPPUNIT_TEST_SUITE(HandlerSetTest);
+	CPPUNIT_TEST(testAddressRouteCache);
+	CPPUNIT_TEST(testStreamingBody);
+	CPPUNIT_TEST(testRouteOrder);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(HandlerSetTest);
+
+class NullIOStream : public RequestIOStream {
+public:
+	virtual int read(char *buf, int size) {
+		(void)buf;
+		(void)size;
+		return 0;
+	}
+	virtual int write(const char *buf, int size) {
+		(void)buf;
+		return size;
+	}
+	virtual void write(std::streambuf *buf) {
+		(void)buf;
+	}
+};
+
+HandlerSetTest::HandlerSetTest() : logger_(new BulkLogger) {
+}
+
+const HandlerSet::HandlerDescription*
+HandlerSetTest::findHandler(const HandlerSet &handlers, char *script_name, char *server_addr, char *remote_addr) {
+	char *env[] = { "REQUEST_METHOD=GET", script_name, server_addr, remote_addr, NULL };
+
+	Request req(logger_.get(), NULL);
+	NullIOStream stream;
+	req.attach(&stream, env);
+	return handlers.findURIHandler(&req);
+}
+
+std::string
+HandlerSetTest::findHandlerId(const HandlerSet &handlers, char *server_addr, char *remote_addr) {
+	const HandlerSet::HandlerDescription *handler = findHandler(handlers, "SCRIPT_NAME=/test", server_addr, remote_addr);
+	return handler ? handler->id : std::string();
+}
+
+void
+HandlerSetTest::testAddressRouteCache() {
+	std::auto_ptr<Config> config = Config::create("test_handlers.conf");
+	ComponentSet components;
+	HandlerSet handlers;
+	handlers.init(config.get(), &components);
+
+	/* address filter matches server address, remote address must not affect routing */
+	for (int i = 0; i < 2; ++i) {
+		CPPUNIT_ASSERT_EQUAL(std::string("first"),
+			findHandlerId(handlers, "SERVER_ADDR=10.0.0.1", "REMOTE_ADDR=192.168.0.1"));
+		CPPUNIT_ASSERT_EQUAL(std::string("second"),
+			findHandlerId(handlers, "SERVER_ADDR=10.0.0.2", "REMOTE_ADDR=192.168.0.1"));
+		CPPUNIT_ASSERT_EQUAL(std::string("first"),
+			findHandlerId(handlers, "SERVER_ADDR=10.0.0.1", "REMOTE_ADDR=192.168.0.2"));
+		CPPUNIT_ASSERT_EQUAL(std::string(""),
+			findHandlerId(handlers, "SERVER_ADDR=10.0.0.3", "REMOTE_ADDR=192.168.0.1"));
+	}
+
+	RouteCacheInfo info = handlers.getRouteCacheInfo();
+	CPPUNIT_ASSERT_EQUAL((uint64_t)3, info.size);
+	CPPUNIT_ASSERT_EQUAL((uint64_t)3, info.misses);
+	CPPUNIT_ASSERT_EQUAL((uint64_t)5, info.hits);
+}
+
+void
+HandlerSetTest::testStreamingBody() {
+	std::auto_ptr<Config> config = Config::create("test_handlers.conf");
+	ComponentSet components;
+	HandlerSet handlers;
+	handlers.init(config.get(), &components);
+	CPPUNIT_ASSERT(handlers.hasStreamingBody());
+
+	const HandlerSet::HandlerDescription *handler =
+		findHandler(handlers, "SCRIPT_NAME=/stream", "SERVER_ADDR=10.0.0.1", "REMOTE_ADDR=192.168.0.1");
+	CPPUNIT_ASSERT(NULL != handler);
+	CPPUNIT_ASSERT_EQUAL(std::string("stream"), handler->id);
+	CPPUNIT_ASSERT(handlers.isStreamingBody(handler));
+
+	/* earlier handler with param filter could match body arguments, so body has to be read first */
+	handler = findHandler(handlers, "SCRIPT_NAME=/upload", "SERVER_ADDR=10.0.0.1", "REMOTE_ADDR=192.168.0.1");
+	CPPUNIT_ASSERT(NULL != handler);
+	CPPUNIT_ASSERT_EQUAL(std::string("upload-stream"), handler->id);
+	CPPUNIT_ASSERT(!handlers.isStreamingBody(handler));
+
+	handler = findHandler(handlers, "SCRIPT_NAME=/test", "SERVER_ADDR=10.0.0.1", "REMOTE_ADDR=192.168.0.1");
+	CPPUNIT_ASSERT(!handlers.isStreamingBody(handler));
+	CPPUNIT_ASSERT(!handlers.isStreamingBody(NULL));
+}
+
+void
+HandlerSetTest::testRouteOrder() {
+	std::auto_ptr<Config> config = Config::create("test_handlers.conf");
+	ComponentSet components;
+	HandlerSet handlers;
+	handlers.init(config.get(), &components);
+
+	/* indexed and regex handlers are tried in the order they are listed */
+	const char *expected[][3] = {
+		{ "SCRIPT_NAME=/order/exact", "SERVER_ADDR=10.0.0.1", "order-exact" },
+		{ "SCRIPT_NAME=/order/abc", "SERVER_ADDR=10.0.0.1", "order-regex" },
+		{ "SCRIPT_NAME=/order/1", "SERVER_ADDR=10.0.0.2", "order-prefix" },
+		{ "SCRIPT_NAME=/order/1", "SERVER_ADDR=10.0.0.1", "order-digits" },
+	};
+	for (std::size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i) {
+		const HandlerSet::HandlerDescription *handler = findHandler(handlers,
+			const_cast<char*>(expected[i][0]), const_cast<char*>(expected[i][1]), "REMOTE_ADDR=192.168.0.1");
+		CPPUNIT_ASSERT(NULL != handler);
+		CPPUNIT_ASSERT_EQUAL(std::string(expected[i][2]), handler->id);
+	}
+	CPPUNIT_ASSERT(NULL == findHandler(handlers, "SCRIPT_NAME=/order/", "SERVER_ADDR=10.0.0.1", "REMOTE_ADDR=192.168.0.1"));
+}
+
+} // namespace fastcgi
@@ -6,12 +6,17 @@
 #include <cppunit/ui/text/TestRunner.h>
 #include <cppunit/extensions/HelperMacros.h>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
 #include "fastcgi2/component.h"
 #include "fastcgi2/config.h"
 #include "fastcgi2/logger.h"
+#include "fastcgi2/multipart_handler.h"
 #include "fastcgi2/request.h"
 #include "fastcgi2/request_io_stream.h"
 
+#include "details/atomic.h"
 #include "details/componentset.h"
 #include "details/globals.h"
 #include "details/request_cache.h"
@@ -31,15 +36,21 @@ public:
 	void testEmptyGet();
 	void testPost();
 	void testCookie();
+	void testHeaders();
+	void testConcurrentGetters();
+	void testWriteBuffer();
 	void testMultipartN();
 	void testMultipartRN();
 	void testMultipartRN2();
+	void testMultipartNStreaming();
+	void testMultipartNStreamingAttached();
 	void testPostCache();
 	void testMultipartNCache();
 	void testMultipartRNCache();
 	void testMultipartRN2Cache();
 
 private:
+	static void readHeaders(const Request *req, volatile unsigned *failures);
 	RequestCache* getCache(Globals *globals);
 	void testPostImpl(RequestCache* cache);
 	void testMultipartNImpl(RequestCache* cache);
@@ -54,9 +65,14 @@ private:
 	CPPUNIT_TEST(testEmptyGet);
 	CPPUNIT_TEST(testPost);
 	CPPUNIT_TEST(testCookie);
+	CPPUNIT_TEST(testHeaders);
+	CPPUNIT_TEST(testConcurrentGetters);
+	CPPUNIT_TEST(testWriteBuffer);
 	CPPUNIT_TEST(testMultipartN);
 	CPPUNIT_TEST(testMultipartRN);
 	CPPUNIT_TEST(testMultipartRN2);
+	CPPUNIT_TEST(testMultipartNStreaming);
+	CPPUNIT_TEST(testMultipartNStreamingAttached);
 	CPPUNIT_TEST(testPostCache);
 	CPPUNIT_TEST(testMultipartNCache);
 	CPPUNIT_TEST(testMultipartRNCache);
@@ -86,6 +102,25 @@ private:
 	std::ostream *out_;
 };
 
+class TestMultipartHandler : public MultipartHandler {
+public:
+	virtual void onPartBegin(const std::string &name, const std::string &filename, const std::string &type) {
+		names.push_back(name);
+		filenames.push_back(filename);
+		types.push_back(type);
+		sizes.push_back(0);
+	}
+	virtual void onPartData(const char *data, std::size_t size) {
+		(void)data;
+		sizes.back() += size;
+	}
+	virtual void onPartEnd() {
+	}
+
+	std::vector<std::string> names, filenames, types;
+	std::vector<std::size_t> sizes;
+};
+
 RequestTest::RequestTest() : logger_(new BulkLogger) {
 }
 
@@ -121,6 +156,25 @@ RequestTest::testGet() {
 	CPPUNIT_ASSERT_EQUAL(std::string("try again"), req->getArg("success"));
 }
 
+void
+RequestTest::testWriteBuffer() {
+	char *env[] = { "REQUEST_METHOD=GET", "QUERY_STRING=", "HTTP_HOST=yandex.ru", NULL };
+
+	std::auto_ptr<Request> req(new Request(logger_.get(), NULL));
+	std::stringstream in, out;
+	TestIOStream stream(&in, &out);
+	req->attach(&stream, env);
+
+	req->setHeader("Content-Type", "text/plain");
+	DataBuffer buffer = DataBuffer::create("<hello world>", 13);
+	req->write(DataBuffer(buffer, 1, 12));
+
+	const std::string result = out.str();
+	CPPUNIT_ASSERT(std::string::npos != result.find("Content-Type: text/plain\r\n"));
+	CPPUNIT_ASSERT(std::string::npos != result.find("Status: 200 OK\r\n"));
+	CPPUNIT_ASSERT_EQUAL(std::string("\r\n\r\nhello world"), result.substr(result.size() - 15));
+}
+
 void
 RequestTest::testCookie() {
 	char *env[] = { "REQUEST_METHOD=GET", "QUERY_STRING=test=pass&success=try%20again", "HTTP_HOST=yandex.ru", 
@@ -144,6 +198,63 @@ RequestTest::testCookie() {
 	CPPUNIT_ASSERT_EQUAL(std::string("921562781154947430"), req->getCookie("yandexuid"));
 }
 
+void
+RequestTest::testHeaders() {
+	char *env[] = { "REQUEST_METHOD=GET", "SCRIPT_NAME=/test", "SERVER_PORT=8080", "HTTP_HOST=yandex.ru",
+		"HTTP_X_AB=first", "HTTP_X_BA=second", "CONTENT_TYPE=text/plain", NULL };
+
+	std::auto_ptr<Request> req(new Request(logger_.get(), NULL));
+	std::stringstream in, out;
+	TestIOStream stream(&in, &out);
+	req->attach(&stream, env);
+
+	CPPUNIT_ASSERT_EQUAL(std::string("/test"), req->getScriptName());
+	CPPUNIT_ASSERT_EQUAL(static_cast<unsigned short>(8080), req->getServerPort());
+	CPPUNIT_ASSERT_EQUAL(std::string("yandex.ru"), req->getHost());
+	CPPUNIT_ASSERT_EQUAL(std::string("text/plain"), req->getContentType());
+
+	CPPUNIT_ASSERT_EQUAL(std::string("first"), req->getHeader("X-Ab"));
+	CPPUNIT_ASSERT_EQUAL(std::string("first"), req->getHeader("x-ab"));
+	CPPUNIT_ASSERT_EQUAL(std::string("second"), req->getHeader("X-BA"));
+	CPPUNIT_ASSERT(!req->hasHeader("X-Ba-"));
+
+	req->reset();
+	CPPUNIT_ASSERT(req->getScriptName().empty());
+	CPPUNIT_ASSERT(req->getHost().empty());
+}
+
+void
+RequestTest::readHeaders(const Request *req, volatile unsigned *failures) {
+	bool ok = "yandex.ru" == req->getHost() && "/test" == req->getScriptName() &&
+		"first" == req->getHeader("X-Ab") && "second" == req->getHeader("X-BA") &&
+		"value" == req->getCookie("name") && 5 == req->countHeaders();
+	if (!ok) {
+		atomicIncrement(failures);
+	}
+}
+
+void
+RequestTest::testConcurrentGetters() {
+	char *env[] = { "REQUEST_METHOD=GET", "SCRIPT_NAME=/test", "HTTP_HOST=yandex.ru",
+		"HTTP_X_AB=first", "HTTP_X_BA=second", "HTTP_COOKIE=name=value", "CONTENT_TYPE=text/plain", NULL };
+
+	/* first const getters of several threads race to parse env */
+	std::auto_ptr<Request> req(new Request(logger_.get(), NULL));
+	std::stringstream in, out;
+	TestIOStream stream(&in, &out);
+	volatile unsigned failures = 0;
+	for (int i = 0; i < 200; ++i) {
+		req->attach(&stream, env);
+		boost::thread_group threads;
+		for (int j = 0; j < 4; ++j) {
+			threads.create_thread(boost::bind(&RequestTest::readHeaders, req.get(), &failures));
+		}
+		threads.join_all();
+		req->reset();
+	}
+	CPPUNIT_ASSERT_EQUAL(0u, atomicLoad(&failures));
+}
+
 void
 RequestTest::testPost() {
 	RequestTest::testPostImpl((RequestCache*)NULL);
@@ -238,11 +349,67 @@ RequestTest::testMultipartNImpl(RequestCache *cache) {
 	CPPUNIT_ASSERT_EQUAL(std::string("yandex.ru"), req->getHeader("Host"));
 	
 	CPPUNIT_ASSERT_EQUAL(true, req->hasFile("uploaded"));
+	CPPUNIT_ASSERT_EQUAL(std::string("application/octet-stream"), req->remoteFileType("uploaded"));
 	DataBuffer file = req->remoteFile("uploaded");
 
 	CPPUNIT_ASSERT_EQUAL((boost::uint64_t)887, file.size());
 }
 
+void
+RequestTest::testMultipartNStreaming() {
+	std::auto_ptr<Request> req(new Request(logger_.get(), NULL));
+
+	char *env[] = { "REQUEST_METHOD=POST", "QUERY_STRING=test=pass", "HTTP_HOST=yandex.ru", "HTTP_CONTENT_LENGTH=1508",
+		"CONTENT_TYPE=multipart/form-data; boundary=---------------------------15403834263040891721303455736", NULL };
+
+	std::fstream f("multipart-test-n.dat");
+	std::stringstream out;
+	TestIOStream stream(&f, &out);
+	req->attachHeaders(&stream, env);
+
+	CPPUNIT_ASSERT_EQUAL(true, req->isBodyPending());
+	CPPUNIT_ASSERT_EQUAL(1u, req->countArgs());
+	CPPUNIT_ASSERT_EQUAL(std::string("pass"), req->getArg("test"));
+
+	TestMultipartHandler handler;
+	req->readMultipart(&handler);
+
+	CPPUNIT_ASSERT_EQUAL(std::size_t(4), handler.names.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("username"), handler.names[0]);
+	CPPUNIT_ASSERT_EQUAL(std::size_t(4), handler.sizes[0]);
+	CPPUNIT_ASSERT_EQUAL(std::string("uploaded"), handler.names[3]);
+	CPPUNIT_ASSERT_EQUAL(std::string("nopasswd.pem"), handler.filenames[3]);
+	CPPUNIT_ASSERT_EQUAL(std::string("application/octet-stream"), handler.types[3]);
+	CPPUNIT_ASSERT_EQUAL(std::size_t(887), handler.sizes[3]);
+}
+
+void
+RequestTest::testMultipartNStreamingAttached() {
+	std::auto_ptr<Request> req(new Request(logger_.get(), NULL));
+
+	char *env[] = { "REQUEST_METHOD=POST", "HTTP_HOST=yandex.ru", "HTTP_CONTENT_LENGTH=1508",
+		"CONTENT_TYPE=multipart/form-data; boundary=---------------------------15403834263040891721303455736", NULL };
+
+	std::fstream f("multipart-test-n.dat");
+	std::stringstream out;
+	TestIOStream stream(&f, &out);
+	req->attach(&stream, env);
+
+	/* streaming handler chosen after body arguments were parsed reads attached body */
+	CPPUNIT_ASSERT_EQUAL(false, req->isBodyPending());
+	CPPUNIT_ASSERT_EQUAL(std::string("test"), req->getArg("username"));
+
+	TestMultipartHandler handler;
+	req->readMultipart(&handler);
+
+	CPPUNIT_ASSERT_EQUAL(std::size_t(4), handler.names.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("uploaded"), handler.names[3]);
+	CPPUNIT_ASSERT_EQUAL(std::size_t(887), handler.sizes[3]);
+
+	char buf[16];
+	CPPUNIT_ASSERT_EQUAL(std::streamsize(0), req->readBody(buf, sizeof(buf)));
+}
+
 void
 RequestTest::testMultipartRNImpl(RequestCache *cache) {
 	std::auto_ptr<Request> req(new Request(logger_.get(), cache));
@@ -0,0 +1,245 @@
+#include "settings.h"
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <cppunit/TestFixture.h>
+#include <cppunit/ui/text/TestRunner.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "fastcgi2/component.h"
+#include "fastcgi2/config.h"
+#include "fastcgi2/data_buffer.h"
+#include "fastcgi2/logger.h"
+#include "fastcgi2/request.h"
+#include "fastcgi2/request_io_stream.h"
+
+#include "details/componentset.h"
+#include "details/globals.h"
+#include "details/request_cache.h"
+#include "details/request_format.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class RequestFormatTest : public CppUnit::TestFixture
+{
+public:
+	RequestFormatTest();
+
+	void testRoundTrip();
+	void testRoundTripCache();
+	void testLookup();
+	void testCorruptSection();
+	void testTruncated();
+	void testOldLayout();
+
+private:
+	std::auto_ptr<Request> createRequest();
+	void serialize(Request *req, DataBuffer &buffer);
+	void checkRequest(Request *req);
+	DataBuffer copy(DataBuffer buffer, boost::uint64_t size);
+
+private:
+	std::auto_ptr<Logger> logger_;
+
+	CPPUNIT_TEST_SUITE(RequestFormatTest);
+	CPPUNIT_TEST(testRoundTrip);
+	CPPUNIT_TEST(testRoundTripCache);
+	CPPUNIT_TEST(testLookup);
+	CPPUNIT_TEST(testCorruptSection);
+	CPPUNIT_TEST(testTruncated);
+	CPPUNIT_TEST(testOldLayout);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RequestFormatTest);
+
+class FormatIOStream : public RequestIOStream {
+public:
+	FormatIOStream(std::istream *in) : in_(in)
+	{}
+	virtual int read(char *buf, int size) {
+		in_->read(buf, size);
+		return in_->gcount();
+	}
+	virtual int write(const char *buf, int size) {
+		(void)buf;
+		return size;
+	}
+	virtual void write(std::streambuf *buf) {
+		(void)buf;
+	}
+private:
+	std::istream *in_;
+};
+
+static const std::string POST_BODY = "test=pass&success=try%20again";
+
+RequestFormatTest::RequestFormatTest() : logger_(new BulkLogger) {
+}
+
+std::auto_ptr<Request>
+RequestFormatTest::createRequest() {
+	char *env[] = { "REQUEST_METHOD=POST", "QUERY_STRING=query=arg", "HTTP_HOST=yandex.ru",
+		"HTTP_CONTENT_LENGTH=29", "HTTP_COOKIE=yandex_login=highpower; my=Yx4CAAA", NULL };
+
+	std::auto_ptr<Request> req(new Request(logger_.get(), NULL));
+	std::stringstream in(POST_BODY);
+	FormatIOStream stream(&in);
+	req->attach(&stream, env);
+	return req;
+}
+
+void
+RequestFormatTest::serialize(Request *req, DataBuffer &buffer) {
+	req->serialize(buffer);
+	CPPUNIT_ASSERT(buffer.size() > RequestFormat::HEADER_SIZE);
+}
+
+void
+RequestFormatTest::checkRequest(Request *req) {
+	CPPUNIT_ASSERT_EQUAL(std::string("POST"), req->getRequestMethod());
+	CPPUNIT_ASSERT_EQUAL(std::string("yandex.ru"), req->getHeader("Host"));
+	CPPUNIT_ASSERT_EQUAL(std::string("query=arg"), req->getQueryString());
+	CPPUNIT_ASSERT_EQUAL(std::string("highpower"), req->getCookie("yandex_login"));
+	CPPUNIT_ASSERT_EQUAL(std::string("Yx4CAAA"), req->getCookie("my"));
+	CPPUNIT_ASSERT_EQUAL(std::string("arg"), req->getArg("query"));
+	CPPUNIT_ASSERT_EQUAL(std::string("pass"), req->getArg("test"));
+	CPPUNIT_ASSERT_EQUAL(std::string("try again"), req->getArg("success"));
+
+	std::string body;
+	req->requestBody().toString(body);
+	CPPUNIT_ASSERT_EQUAL(POST_BODY, body);
+}
+
+DataBuffer
+RequestFormatTest::copy(DataBuffer buffer, boost::uint64_t size) {
+	std::string data(size, '\0');
+	if (size > 0) {
+		buffer.read(0, &data[0], size);
+	}
+	return DataBuffer::create(data.data(), data.size());
+}
+
+void
+RequestFormatTest::testRoundTrip() {
+	std::auto_ptr<Request> req = createRequest();
+	checkRequest(req.get());
+
+	DataBuffer buffer = DataBuffer::create("", 0);
+	serialize(req.get(), buffer);
+
+	std::auto_ptr<Request> parsed(new Request(logger_.get(), NULL));
+	parsed->parse(buffer);
+	checkRequest(parsed.get());
+}
+
+void
+RequestFormatTest::testRoundTripCache() {
+	std::auto_ptr<Config> config = Config::create("test_cache.conf");
+	boost::shared_ptr<Globals> globals(new Globals(config.get()));
+	RequestCache *cache = dynamic_cast<RequestCache*>(globals->components()->find("request-cache"));
+	CPPUNIT_ASSERT(NULL != cache);
+
+	std::auto_ptr<Request> req = createRequest();
+	DataBuffer buffer = cache->create();
+	serialize(req.get(), buffer);
+
+	std::auto_ptr<Request> parsed(new Request(logger_.get(), NULL));
+	parsed->parse(buffer);
+	checkRequest(parsed.get());
+}
+
+void
+RequestFormatTest::testLookup() {
+	std::auto_ptr<Request> req = createRequest();
+	DataBuffer buffer = DataBuffer::create("", 0);
+	serialize(req.get(), buffer);
+
+	std::string value;
+	CPPUNIT_ASSERT(RequestFormat::lookup(buffer, RequestFormat::ARGS_SECTION, "success", value));
+	CPPUNIT_ASSERT_EQUAL(std::string("try again"), value);
+	CPPUNIT_ASSERT(RequestFormat::lookup(buffer, RequestFormat::COOKIES_SECTION, "my", value));
+	CPPUNIT_ASSERT_EQUAL(std::string("Yx4CAAA"), value);
+	CPPUNIT_ASSERT(RequestFormat::lookup(buffer, RequestFormat::VARS_SECTION, "REQUEST_METHOD", value));
+	CPPUNIT_ASSERT_EQUAL(std::string("POST"), value);
+	CPPUNIT_ASSERT(!RequestFormat::lookup(buffer, RequestFormat::ARGS_SECTION, "missing", value));
+	CPPUNIT_ASSERT(!RequestFormat::lookup(buffer, RequestFormat::ARGS_SECTION, "succes", value));
+}
+
+void
+RequestFormatTest::testCorruptSection() {
+	std::auto_ptr<Request> req = createRequest();
+	DataBuffer buffer = DataBuffer::create("", 0);
+	serialize(req.get(), buffer);
+
+	RequestFormat format;
+	format.read(buffer);
+	CPPUNIT_ASSERT(format.length(RequestFormat::ARGS_SECTION) > 0);
+	boost::uint64_t pos = format.offset(RequestFormat::ARGS_SECTION) + format.length(RequestFormat::ARGS_SECTION) - 1;
+	char byte = buffer.at(pos) ^ 0x20;
+	buffer.write(pos, &byte, 1);
+
+	std::string value;
+	CPPUNIT_ASSERT_THROW(RequestFormat::lookup(buffer, RequestFormat::ARGS_SECTION, "test", value), std::runtime_error);
+	CPPUNIT_ASSERT(RequestFormat::lookup(buffer, RequestFormat::COOKIES_SECTION, "my", value));
+
+	std::auto_ptr<Request> parsed(new Request(logger_.get(), NULL));
+	CPPUNIT_ASSERT_THROW(parsed->parse(buffer), std::runtime_error);
+}
+
+void
+RequestFormatTest::testTruncated() {
+	std::auto_ptr<Request> req = createRequest();
+	DataBuffer buffer = DataBuffer::create("", 0);
+	serialize(req.get(), buffer);
+
+	std::auto_ptr<Request> tail(new Request(logger_.get(), NULL));
+	CPPUNIT_ASSERT_THROW(tail->parse(copy(buffer, buffer.size() - 1)), std::runtime_error);
+
+	std::auto_ptr<Request> header(new Request(logger_.get(), NULL));
+	CPPUNIT_ASSERT_THROW(header->parse(copy(buffer, RequestFormat::HEADER_SIZE - 1)), std::runtime_error);
+
+	std::auto_ptr<Request> empty(new Request(logger_.get(), NULL));
+	CPPUNIT_ASSERT_THROW(empty->parse(copy(buffer, 0)), std::runtime_error);
+}
+
+static void
+addOldInt(std::string &data, boost::uint64_t value) {
+	data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void
+addOldString(std::string &data, const std::string &value) {
+	addOldInt(data, value.size());
+	data.append(value);
+}
+
+void
+RequestFormatTest::testOldLayout() {
+	/* unversioned layout: every section is preceded by its native 64-bit size */
+	std::string data;
+	addOldInt(data, 2 * sizeof(boost::uint64_t) + 4 + 9);
+	addOldString(data, "Host");
+	addOldString(data, "yandex.ru");
+	addOldInt(data, 0);
+	addOldInt(data, 0);
+	std::string body(RequestFormat::HEADER_SIZE, 'x');
+	addOldString(data, body);
+	addOldInt(data, 0);
+	addOldInt(data, 0);
+	CPPUNIT_ASSERT(data.size() > RequestFormat::HEADER_SIZE);
+
+	DataBuffer buffer = DataBuffer::create(data.data(), data.size());
+	std::auto_ptr<Request> parsed(new Request(logger_.get(), NULL));
+	CPPUNIT_ASSERT_THROW(parsed->parse(buffer), std::runtime_error);
+
+	std::string value;
+	CPPUNIT_ASSERT_THROW(RequestFormat::lookup(buffer, RequestFormat::HEADERS_SECTION, "Host", value), std::runtime_error);
+}
+
+} // namespace fastcgi
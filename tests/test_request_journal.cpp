@@ -0,0 +1,260 @@
+#include "settings.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <map>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "fastcgi2/logger.h"
+
+#include "request_journal.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class RequestJournalTest : public CppUnit::TestFixture
+{
+public:
+	RequestJournalTest();
+
+	virtual void setUp();
+	virtual void tearDown();
+
+	void testReload();
+	void testTruncatedTail();
+	void testDamagedMiddle();
+	void testCompaction();
+	void testCompactionWhileAppending();
+
+private:
+	std::string key(int index) const;
+	boost::uint64_t fileSize() const;
+	void load(std::map<std::string, JournalEntry> &live);
+	void append(RequestJournal *journal, int count, bool *done);
+
+private:
+	std::auto_ptr<Logger> logger_;
+	std::string path_;
+	boost::mutex mutex_;
+
+	CPPUNIT_TEST_SUITE(RequestJournalTest);
+	CPPUNIT_TEST(testReload);
+	CPPUNIT_TEST(testTruncatedTail);
+	CPPUNIT_TEST(testDamagedMiddle);
+	CPPUNIT_TEST(testCompaction);
+	CPPUNIT_TEST(testCompactionWhileAppending);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(RequestJournalTest);
+
+/* type, retries, due time, key length, 32 hex digits of key and crc32 */
+static const boost::uint64_t RECORD_SIZE = 14 + 32 + 4;
+
+RequestJournalTest::RequestJournalTest() :
+	logger_(new BulkLogger), path_("test_request.journal")
+{}
+
+void
+RequestJournalTest::setUp() {
+	unlink(path_.c_str());
+}
+
+void
+RequestJournalTest::tearDown() {
+	unlink(path_.c_str());
+}
+
+std::string
+RequestJournalTest::key(int index) const {
+	char buffer[40];
+	snprintf(buffer, sizeof(buffer), "%032x", index);
+	return buffer;
+}
+
+boost::uint64_t
+RequestJournalTest::fileSize() const {
+	struct stat fs;
+	CPPUNIT_ASSERT(0 == stat(path_.c_str(), &fs));
+	return fs.st_size;
+}
+
+void
+RequestJournalTest::load(std::map<std::string, JournalEntry> &live) {
+	RequestJournal journal(path_, logger_.get());
+	journal.load(live);
+}
+
+void
+RequestJournalTest::testReload() {
+	{
+		RequestJournal journal(path_, logger_.get());
+		std::map<std::string, JournalEntry> live;
+		journal.load(live);
+		CPPUNIT_ASSERT(live.empty());
+		journal.enqueue(key(1), 1, 1000);
+		journal.enqueue(key(2), 1, 2000);
+		journal.enqueue(key(1), 2, 3000);
+		journal.complete(key(2));
+		journal.complete(key(3));
+	}
+	CPPUNIT_ASSERT_EQUAL(4 * RECORD_SIZE, fileSize());
+
+	std::map<std::string, JournalEntry> live;
+	load(live);
+	CPPUNIT_ASSERT_EQUAL((std::size_t)1, live.size());
+	CPPUNIT_ASSERT_EQUAL(2, live[key(1)].retries);
+	CPPUNIT_ASSERT_EQUAL((boost::uint64_t)3000, live[key(1)].when);
+	CPPUNIT_ASSERT_EQUAL(RECORD_SIZE, fileSize());
+}
+
+void
+RequestJournalTest::testTruncatedTail() {
+	{
+		RequestJournal journal(path_, logger_.get());
+		std::map<std::string, JournalEntry> live;
+		journal.load(live);
+		journal.enqueue(key(1), 1, 1000);
+		journal.enqueue(key(2), 1, 2000);
+	}
+	CPPUNIT_ASSERT(0 == truncate(path_.c_str(), 2 * RECORD_SIZE - 3));
+
+	std::map<std::string, JournalEntry> live;
+	{
+		RequestJournal journal(path_, logger_.get());
+		journal.load(live);
+		CPPUNIT_ASSERT_EQUAL((std::size_t)1, live.size());
+		CPPUNIT_ASSERT(live.end() != live.find(key(1)));
+		CPPUNIT_ASSERT_EQUAL(RECORD_SIZE, fileSize());
+
+		/* records appended after torn tail is dropped are read back */
+		journal.enqueue(key(3), 1, 3000);
+	}
+	live.clear();
+	load(live);
+	CPPUNIT_ASSERT_EQUAL((std::size_t)2, live.size());
+	CPPUNIT_ASSERT(live.end() != live.find(key(3)));
+}
+
+void
+RequestJournalTest::testDamagedMiddle() {
+	{
+		RequestJournal journal(path_, logger_.get());
+		std::map<std::string, JournalEntry> live;
+		journal.load(live);
+		journal.enqueue(key(1), 1, 1000);
+		journal.enqueue(key(2), 1, 2000);
+		journal.enqueue(key(3), 1, 3000);
+		journal.complete(key(1));
+	}
+
+	int fd = open(path_.c_str(), O_RDWR);
+	CPPUNIT_ASSERT(-1 != fd);
+	char byte = 0;
+	CPPUNIT_ASSERT_EQUAL((ssize_t)1, pread(fd, &byte, 1, RECORD_SIZE + 20));
+	byte ^= 0x01;
+	CPPUNIT_ASSERT_EQUAL((ssize_t)1, pwrite(fd, &byte, 1, RECORD_SIZE + 20));
+	close(fd);
+
+	/* only damaged record is lost, records after it are still applied */
+	std::map<std::string, JournalEntry> live;
+	load(live);
+	CPPUNIT_ASSERT_EQUAL((std::size_t)1, live.size());
+	CPPUNIT_ASSERT(live.end() != live.find(key(3)));
+	CPPUNIT_ASSERT_EQUAL((boost::uint64_t)3000, live[key(3)].when);
+}
+
+void
+RequestJournalTest::testCompaction() {
+	const int live_count = 10, dead_count = 3000;
+	{
+		RequestJournal journal(path_, logger_.get());
+		std::map<std::string, JournalEntry> live;
+		journal.load(live);
+		for (int i = 0; i < live_count; ++i) {
+			journal.enqueue(key(i), i, 1000 + i);
+		}
+		for (int i = live_count; i < live_count + dead_count; ++i) {
+			journal.enqueue(key(i), 1, 1000);
+			journal.complete(key(i));
+		}
+
+		/* appends only request rewrite, it is done by cache thread */
+		CPPUNIT_ASSERT_EQUAL((live_count + 2 * dead_count) * RECORD_SIZE, fileSize());
+		journal.compactIfRequested();
+		CPPUNIT_ASSERT_EQUAL(live_count * RECORD_SIZE, fileSize());
+
+		/* nothing is requested until dead records dominate again */
+		journal.enqueue(key(live_count), 1, 1000);
+		journal.compactIfRequested();
+		CPPUNIT_ASSERT_EQUAL((live_count + 1) * RECORD_SIZE, fileSize());
+		journal.complete(key(live_count));
+	}
+
+	std::map<std::string, JournalEntry> live;
+	load(live);
+	CPPUNIT_ASSERT_EQUAL((std::size_t)live_count, live.size());
+	for (int i = 0; i < live_count; ++i) {
+		std::map<std::string, JournalEntry>::iterator it = live.find(key(i));
+		CPPUNIT_ASSERT(live.end() != it);
+		CPPUNIT_ASSERT_EQUAL(i, it->second.retries);
+		CPPUNIT_ASSERT_EQUAL((boost::uint64_t)(1000 + i), it->second.when);
+	}
+	CPPUNIT_ASSERT_EQUAL(live_count * RECORD_SIZE, fileSize());
+}
+
+void
+RequestJournalTest::append(RequestJournal *journal, int count, bool *done) {
+	for (int i = 0; i < count; ++i) {
+		journal->enqueue(key(i), 1, 1000 + i);
+		if (0 != i % 100) {
+			journal->complete(key(i));
+		}
+	}
+	boost::mutex::scoped_lock lock(mutex_);
+	*done = true;
+}
+
+void
+RequestJournalTest::testCompactionWhileAppending() {
+	const int count = 20000;
+	{
+		RequestJournal journal(path_, logger_.get());
+		std::map<std::string, JournalEntry> live;
+		journal.load(live);
+
+		/* records appended while rewrite is written are copied into new journal */
+		bool done = false;
+		boost::thread writer(boost::bind(&RequestJournalTest::append, this, &journal, count, &done));
+		while (true) {
+			journal.compactIfRequested();
+			boost::mutex::scoped_lock lock(mutex_);
+			if (done) {
+				break;
+			}
+		}
+		writer.join();
+	}
+
+	std::map<std::string, JournalEntry> live;
+	load(live);
+	CPPUNIT_ASSERT_EQUAL((std::size_t)(count / 100), live.size());
+	for (int i = 0; i < count; i += 100) {
+		std::map<std::string, JournalEntry>::iterator it = live.find(key(i));
+		CPPUNIT_ASSERT(live.end() != it);
+		CPPUNIT_ASSERT_EQUAL((boost::uint64_t)(1000 + i), it->second.when);
+	}
+}
+
+} // namespace fastcgi
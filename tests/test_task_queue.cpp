@@ -0,0 +1,345 @@
+#include "settings.h"
+
+#include <algorithm>
+#include <vector>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include "details/atomic.h"
+#include "details/event_count.h"
+#include "details/lockfree_task_queue.h"
+#include "details/work_stealing_task_queue.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class TaskQueueTest : public CppUnit::TestFixture
+{
+public:
+	void testEventCount();
+	void testLockFreeFull();
+	void testLockFreeEmpty();
+	void testLockFreeWrap();
+	void testLockFreeWakeup();
+	void testLockFreeProducersConsumers();
+	void testWorkStealingFull();
+	void testWorkStealingSteal();
+	void testWorkStealingWakeup();
+	void testWorkStealingStealers();
+	void testWorkStealingProducersConsumers();
+
+private:
+	static void produce(TaskQueue<int> *queue, int first, int count);
+	static void consume(TaskQueue<int> *queue, unsigned worker, std::vector<int> *popped, volatile unsigned *total);
+	static void popOne(TaskQueue<int> *queue, int *task, bool *result);
+	static void waitTicket(EventCount *event, int ticket, volatile bool *woken);
+
+	void checkProducersConsumers(TaskQueue<int> &queue, int prefilled, unsigned producers,
+		const std::vector<unsigned> &workers, int count);
+
+private:
+	CPPUNIT_TEST_SUITE(TaskQueueTest);
+	CPPUNIT_TEST(testEventCount);
+	CPPUNIT_TEST(testLockFreeFull);
+	CPPUNIT_TEST(testLockFreeEmpty);
+	CPPUNIT_TEST(testLockFreeWrap);
+	CPPUNIT_TEST(testLockFreeWakeup);
+	CPPUNIT_TEST(testLockFreeProducersConsumers);
+	CPPUNIT_TEST(testWorkStealingFull);
+	CPPUNIT_TEST(testWorkStealingSteal);
+	CPPUNIT_TEST(testWorkStealingWakeup);
+	CPPUNIT_TEST(testWorkStealingStealers);
+	CPPUNIT_TEST(testWorkStealingProducersConsumers);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TaskQueueTest);
+
+static const boost::posix_time::seconds JOIN_TIMEOUT(30);
+
+void
+TaskQueueTest::produce(TaskQueue<int> *queue, int first, int count) {
+	for (int i = first; i < first + count; ++i) {
+		while (!queue->push(i)) {
+			boost::this_thread::yield();
+		}
+	}
+}
+
+void
+TaskQueueTest::consume(TaskQueue<int> *queue, unsigned worker, std::vector<int> *popped, volatile unsigned *total) {
+	int task = 0;
+	while (queue->pop(task, worker)) {
+		popped->push_back(task);
+		atomicIncrement(total);
+	}
+}
+
+void
+TaskQueueTest::popOne(TaskQueue<int> *queue, int *task, bool *result) {
+	*result = queue->pop(*task, 0);
+}
+
+void
+TaskQueueTest::waitTicket(EventCount *event, int ticket, volatile bool *woken) {
+	event->wait(ticket);
+	atomicStore(woken, true);
+}
+
+/*
+ * every pushed task is popped exactly once, consumers are stopped after all tasks are taken.
+ * prefilled tasks are pushed before consumers are started.
+ */
+void
+TaskQueueTest::checkProducersConsumers(TaskQueue<int> &queue, int prefilled, unsigned producers,
+	const std::vector<unsigned> &workers, int count) {
+
+	produce(&queue, 0, prefilled);
+	const unsigned expected = prefilled + producers * count;
+
+	volatile unsigned total = 0;
+	std::vector<std::vector<int> > popped(workers.size());
+	boost::thread_group consumers;
+	for (unsigned i = 0; i < workers.size(); ++i) {
+		consumers.create_thread(boost::bind(&TaskQueueTest::consume, &queue, workers[i], &popped[i], &total));
+	}
+
+	boost::thread_group threads;
+	for (unsigned i = 0; i < producers; ++i) {
+		threads.create_thread(boost::bind(&TaskQueueTest::produce, &queue, prefilled + i * count, count));
+	}
+	threads.join_all();
+
+	boost::system_time deadline = boost::get_system_time() + JOIN_TIMEOUT;
+	while (atomicLoad(&total) < expected && boost::get_system_time() < deadline) {
+		boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+	}
+	queue.stop();
+	consumers.join_all();
+
+	std::vector<int> all;
+	for (unsigned i = 0; i < popped.size(); ++i) {
+		all.insert(all.end(), popped[i].begin(), popped[i].end());
+	}
+	std::sort(all.begin(), all.end());
+	CPPUNIT_ASSERT_EQUAL(static_cast<std::size_t>(expected), all.size());
+	for (int i = 0; i < static_cast<int>(all.size()); ++i) {
+		CPPUNIT_ASSERT_EQUAL(i, all[i]);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(0), queue.size());
+}
+
+void
+TaskQueueTest::testEventCount() {
+	EventCount event;
+
+	/* notification after ticket is taken makes wait return at once */
+	int ticket = event.prepareWait();
+	event.notifyOne();
+	event.wait(ticket);
+
+	ticket = event.prepareWait();
+	event.cancelWait();
+	event.notifyOne();
+
+	/* parked waiter is woken by notification */
+	volatile bool woken = false;
+	ticket = event.prepareWait();
+	boost::thread waiter(boost::bind(&TaskQueueTest::waitTicket, &event, ticket, &woken));
+	boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+	CPPUNIT_ASSERT(!atomicLoad(&woken));
+	event.notifyOne();
+	CPPUNIT_ASSERT(waiter.timed_join(JOIN_TIMEOUT));
+	CPPUNIT_ASSERT(atomicLoad(&woken));
+}
+
+void
+TaskQueueTest::testLockFreeFull() {
+	LockFreeTaskQueue<int> queue(4);
+	for (int i = 0; i < 4; ++i) {
+		CPPUNIT_ASSERT(queue.push(i));
+	}
+	CPPUNIT_ASSERT(!queue.push(4));
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(4), queue.size());
+
+	int task = -1;
+	CPPUNIT_ASSERT(queue.pop(task, 0));
+	CPPUNIT_ASSERT_EQUAL(0, task);
+	CPPUNIT_ASSERT(queue.push(4));
+	CPPUNIT_ASSERT(!queue.push(5));
+
+	for (int i = 1; i <= 4; ++i) {
+		CPPUNIT_ASSERT(queue.pop(task, 0));
+		CPPUNIT_ASSERT_EQUAL(i, task);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(0), queue.size());
+
+	LockFreeTaskQueue<int> empty(0);
+	CPPUNIT_ASSERT(!empty.push(0));
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(0), empty.size());
+}
+
+void
+TaskQueueTest::testLockFreeEmpty() {
+	LockFreeTaskQueue<int> queue(4);
+
+	/* pop waits on empty queue until it is stopped */
+	int task = -1;
+	bool result = true;
+	boost::thread consumer(boost::bind(&TaskQueueTest::popOne, &queue, &task, &result));
+	CPPUNIT_ASSERT(!consumer.timed_join(boost::posix_time::milliseconds(50)));
+	queue.stop();
+	CPPUNIT_ASSERT(consumer.timed_join(JOIN_TIMEOUT));
+	CPPUNIT_ASSERT(!result);
+
+	/* stopped queue does not hand out tasks */
+	CPPUNIT_ASSERT(queue.push(1));
+	CPPUNIT_ASSERT(!queue.pop(task, 0));
+}
+
+void
+TaskQueueTest::testLockFreeWrap() {
+	LockFreeTaskQueue<int> queue(3);
+	int task = -1;
+	for (int i = 0; i < 1000; ++i) {
+		CPPUNIT_ASSERT(queue.push(2 * i));
+		CPPUNIT_ASSERT(queue.push(2 * i + 1));
+		CPPUNIT_ASSERT(queue.pop(task, 0));
+		CPPUNIT_ASSERT_EQUAL(2 * i, task);
+		CPPUNIT_ASSERT(queue.pop(task, 0));
+		CPPUNIT_ASSERT_EQUAL(2 * i + 1, task);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(0), queue.size());
+}
+
+void
+TaskQueueTest::testLockFreeWakeup() {
+	LockFreeTaskQueue<int> queue(4);
+	for (int i = 0; i < 100; ++i) {
+		int task = -1;
+		bool result = false;
+		boost::thread consumer(boost::bind(&TaskQueueTest::popOne, &queue, &task, &result));
+		if (0 == i % 10) {
+			/* let consumer park on futex before task is pushed */
+			boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+		}
+		CPPUNIT_ASSERT(queue.push(i));
+		CPPUNIT_ASSERT(consumer.timed_join(JOIN_TIMEOUT));
+		CPPUNIT_ASSERT(result);
+		CPPUNIT_ASSERT_EQUAL(i, task);
+	}
+}
+
+void
+TaskQueueTest::testLockFreeProducersConsumers() {
+	LockFreeTaskQueue<int> queue(64);
+	std::vector<unsigned> workers;
+	for (unsigned i = 0; i < 4; ++i) {
+		workers.push_back(i);
+	}
+	checkProducersConsumers(queue, 0, 4, workers, 50000);
+}
+
+void
+TaskQueueTest::testWorkStealingFull() {
+	/* length limit is shared by all deques */
+	WorkStealingTaskQueue<int> queue(4, 6);
+	for (int i = 0; i < 6; ++i) {
+		CPPUNIT_ASSERT(queue.push(i));
+	}
+	CPPUNIT_ASSERT(!queue.push(6));
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(6), queue.size());
+
+	int task = -1;
+	CPPUNIT_ASSERT(queue.pop(task, 0));
+	CPPUNIT_ASSERT(queue.push(6));
+	CPPUNIT_ASSERT(!queue.push(7));
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(6), queue.size());
+
+	WorkStealingTaskQueue<int> empty(4, 0);
+	CPPUNIT_ASSERT(!empty.push(0));
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(0), empty.size());
+}
+
+void
+TaskQueueTest::testWorkStealingSteal() {
+	/* tasks are spread over all deques, single worker takes them all */
+	WorkStealingTaskQueue<int> queue(4, 100);
+	for (int i = 0; i < 8; ++i) {
+		CPPUNIT_ASSERT(queue.push(i));
+	}
+
+	/* worker index is wrapped to the number of deques */
+	std::vector<int> popped;
+	int task = -1;
+	for (int i = 0; i < 8; ++i) {
+		CPPUNIT_ASSERT(queue.pop(task, 5));
+		popped.push_back(task);
+	}
+	CPPUNIT_ASSERT_EQUAL(static_cast<boost::uint64_t>(0), queue.size());
+
+	std::sort(popped.begin(), popped.end());
+	for (int i = 0; i < 8; ++i) {
+		CPPUNIT_ASSERT_EQUAL(i, popped[i]);
+	}
+
+	/* pop waits on empty queue until it is stopped */
+	bool result = true;
+	boost::thread consumer(boost::bind(&TaskQueueTest::popOne, &queue, &task, &result));
+	CPPUNIT_ASSERT(!consumer.timed_join(boost::posix_time::milliseconds(50)));
+	queue.stop();
+	CPPUNIT_ASSERT(consumer.timed_join(JOIN_TIMEOUT));
+	CPPUNIT_ASSERT(!result);
+
+	CPPUNIT_ASSERT(queue.push(1));
+	CPPUNIT_ASSERT(!queue.pop(task, 0));
+}
+
+void
+TaskQueueTest::testWorkStealingWakeup() {
+	/* most tasks land in peer deques, parked worker 0 has to steal them */
+	WorkStealingTaskQueue<int> queue(4, 4);
+	for (int i = 0; i < 100; ++i) {
+		int task = -1;
+		bool result = false;
+		boost::thread consumer(boost::bind(&TaskQueueTest::popOne, &queue, &task, &result));
+		if (0 == i % 10) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+		}
+		CPPUNIT_ASSERT(queue.push(i));
+		CPPUNIT_ASSERT(consumer.timed_join(JOIN_TIMEOUT));
+		CPPUNIT_ASSERT(result);
+		CPPUNIT_ASSERT_EQUAL(i, task);
+	}
+}
+
+void
+TaskQueueTest::testWorkStealingStealers() {
+	/* owner of deque 0 never runs, stealers owning deque 1 drain it concurrently */
+	WorkStealingTaskQueue<int> queue(2, 100000);
+	std::vector<unsigned> workers(4, 1);
+	checkProducersConsumers(queue, 100000, 0, workers, 0);
+
+	/* owner takes from its deque while stealers take from it too */
+	WorkStealingTaskQueue<int> shared(2, 64);
+	workers[0] = 0;
+	checkProducersConsumers(shared, 0, 2, workers, 50000);
+}
+
+void
+TaskQueueTest::testWorkStealingProducersConsumers() {
+	WorkStealingTaskQueue<int> queue(4, 64);
+	std::vector<unsigned> workers;
+	for (unsigned i = 0; i < 4; ++i) {
+		workers.push_back(i);
+	}
+	checkProducersConsumers(queue, 0, 4, workers, 50000);
+}
+
+} // namespace fastcgi
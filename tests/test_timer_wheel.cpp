@@ -0,0 +1,178 @@
+#include "settings.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "timer_wheel.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class TimerWheelTest : public CppUnit::TestFixture
+{
+public:
+	void testLevelBoundaries();
+	void testUnalignedStart();
+	void testFarFuture();
+	void testPastDue();
+	void testIdleJump();
+	void testRandom();
+
+private:
+	void checkFiresAt(TimerWheel &wheel, boost::uint64_t tick, const std::string &key);
+
+private:
+	CPPUNIT_TEST_SUITE(TimerWheelTest);
+	CPPUNIT_TEST(testLevelBoundaries);
+	CPPUNIT_TEST(testUnalignedStart);
+	CPPUNIT_TEST(testFarFuture);
+	CPPUNIT_TEST(testPastDue);
+	CPPUNIT_TEST(testIdleJump);
+	CPPUNIT_TEST(testRandom);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(TimerWheelTest);
+
+void
+TimerWheelTest::checkFiresAt(TimerWheel &wheel, boost::uint64_t tick, const std::string &key) {
+	std::vector<DelayTask> due;
+	wheel.advance(tick - 1, due);
+	CPPUNIT_ASSERT(due.empty());
+	wheel.advance(tick, due);
+	CPPUNIT_ASSERT_EQUAL((std::vector<DelayTask>::size_type)1, due.size());
+	CPPUNIT_ASSERT_EQUAL(key, due[0].key);
+}
+
+void
+TimerWheelTest::testLevelBoundaries() {
+	TimerWheel wheel(0);
+	boost::uint64_t ticks[] = { 1, 255, 256, 257, 511, 512, 65535, 65536, 65537, 16777215, 16777216, 16777217 };
+	const std::size_t count = sizeof(ticks) / sizeof(ticks[0]);
+	for (std::size_t i = 0; i < count; ++i) {
+		char key[32];
+		snprintf(key, sizeof(key), "%llu", static_cast<unsigned long long>(ticks[i]));
+		wheel.insert(ticks[i], DelayTask(key, 0));
+	}
+	CPPUNIT_ASSERT_EQUAL(count, wheel.size());
+
+	for (std::size_t i = 0; i < count; ++i) {
+		char key[32];
+		snprintf(key, sizeof(key), "%llu", static_cast<unsigned long long>(ticks[i]));
+		checkFiresAt(wheel, ticks[i], key);
+		CPPUNIT_ASSERT_EQUAL(count - i - 1, wheel.size());
+	}
+	CPPUNIT_ASSERT(wheel.empty());
+}
+
+void
+TimerWheelTest::testUnalignedStart() {
+	TimerWheel wheel(200);
+	wheel.insert(300, DelayTask("level0", 1));
+	wheel.insert(200 + 70000, DelayTask("level2", 2));
+	checkFiresAt(wheel, 300, "level0");
+	checkFiresAt(wheel, 200 + 70000, "level2");
+	CPPUNIT_ASSERT(wheel.empty());
+}
+
+void
+TimerWheelTest::testFarFuture() {
+	/* farther than 2^32 ticks the wheel covers */
+	boost::uint64_t now = 1000;
+	boost::uint64_t far = now + (static_cast<boost::uint64_t>(1) << 32) + 5;
+	boost::uint64_t farther = now + (static_cast<boost::uint64_t>(1) << 40);
+	TimerWheel wheel(now);
+	wheel.insert(farther, DelayTask("farther", 0));
+	wheel.insert(far, DelayTask("far", 0));
+	checkFiresAt(wheel, far, "far");
+	CPPUNIT_ASSERT_EQUAL((std::size_t)1, wheel.size());
+	checkFiresAt(wheel, farther, "farther");
+	CPPUNIT_ASSERT(wheel.empty());
+}
+
+void
+TimerWheelTest::testPastDue() {
+	TimerWheel wheel(0);
+	std::vector<DelayTask> due;
+	wheel.advance(100, due);
+	CPPUNIT_ASSERT(due.empty());
+
+	/* ticks already passed fire on advance to the first tick which is not */
+	wheel.insert(50, DelayTask("past", 3));
+	wheel.insert(100, DelayTask("now", 4));
+	CPPUNIT_ASSERT_EQUAL((std::size_t)2, wheel.size());
+	CPPUNIT_ASSERT_EQUAL((boost::uint64_t)101, wheel.nextTick());
+	wheel.advance(101, due);
+	CPPUNIT_ASSERT_EQUAL((std::vector<DelayTask>::size_type)2, due.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("past"), due[0].key);
+	CPPUNIT_ASSERT_EQUAL(3, due[0].retries);
+	CPPUNIT_ASSERT_EQUAL(std::string("now"), due[1].key);
+	CPPUNIT_ASSERT(wheel.empty());
+}
+
+void
+TimerWheelTest::testIdleJump() {
+	TimerWheel wheel(0);
+	std::vector<DelayTask> due;
+
+	/* empty wheel jumps without walking ticks */
+	boost::uint64_t now = static_cast<boost::uint64_t>(1) << 40;
+	wheel.advance(now, due);
+	CPPUNIT_ASSERT(due.empty());
+	wheel.insert(now + 3, DelayTask("after idle", 0));
+	checkFiresAt(wheel, now + 3, "after idle");
+
+	/* single jump far past several level boundaries delivers everything due */
+	wheel.insert(now + 10, DelayTask("first", 0));
+	wheel.insert(now + 100000, DelayTask("second", 0));
+	wheel.insert(now + 20000000, DelayTask("third", 0));
+	wheel.advance(now + 100000, due);
+	CPPUNIT_ASSERT_EQUAL((std::vector<DelayTask>::size_type)2, due.size());
+	CPPUNIT_ASSERT_EQUAL(std::string("first"), due[0].key);
+	CPPUNIT_ASSERT_EQUAL(std::string("second"), due[1].key);
+	due.clear();
+	checkFiresAt(wheel, now + 20000000, "third");
+}
+
+void
+TimerWheelTest::testRandom() {
+	srand(17);
+	boost::uint64_t now = 12345;
+	TimerWheel wheel(now);
+	std::multimap<boost::uint64_t, std::string> expected;
+	for (int step = 0; step < 20000; ++step) {
+		if (rand() % 3) {
+			boost::uint64_t delta = 1 + rand() % (rand() % 2 ? 300 : 200000);
+			char key[32];
+			snprintf(key, sizeof(key), "%d", step);
+			wheel.insert(now + delta, DelayTask(key, 0));
+			expected.insert(std::make_pair(now + delta, key));
+			continue;
+		}
+		now += rand() % 1000;
+		std::vector<DelayTask> due;
+		wheel.advance(now, due);
+		std::multimap<boost::uint64_t, std::string>::iterator end = expected.upper_bound(now);
+		CPPUNIT_ASSERT_EQUAL((std::size_t)std::distance(expected.begin(), end), due.size());
+		for (std::vector<DelayTask>::iterator it = due.begin(); it != due.end(); ++it) {
+			bool found = false;
+			for (std::multimap<boost::uint64_t, std::string>::iterator e = expected.begin(); e != end; ++e) {
+				if (e->second == it->key) {
+					found = true;
+					break;
+				}
+			}
+			CPPUNIT_ASSERT(found);
+		}
+		expected.erase(expected.begin(), end);
+		CPPUNIT_ASSERT_EQUAL(expected.size(), wheel.size());
+	}
+}
+
+} // namespace fastcgi
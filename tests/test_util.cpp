@@ -0,0 +1,85 @@
+#include "settings.h"
+
+#include <string>
+#include <cppunit/TestFixture.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "fastcgi2/data_buffer.h"
+#include "fastcgi2/util.h"
+
+#ifdef HAVE_DMALLOC_H
+#include <dmalloc.h>
+#endif
+
+namespace fastcgi {
+
+class StringUtilsTest : public CppUnit::TestFixture
+{
+public:
+	void testUrldecode();
+	void testUrldecodeMalformed();
+	void testUrldecodeBuffer();
+	void testUrlencode();
+
+private:
+	CPPUNIT_TEST_SUITE(StringUtilsTest);
+	CPPUNIT_TEST(testUrldecode);
+	CPPUNIT_TEST(testUrldecodeMalformed);
+	CPPUNIT_TEST(testUrldecodeBuffer);
+	CPPUNIT_TEST(testUrlencode);
+	CPPUNIT_TEST_SUITE_END();
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION(StringUtilsTest);
+
+void
+StringUtilsTest::testUrldecode() {
+	CPPUNIT_ASSERT_EQUAL(std::string(), StringUtils::urldecode(std::string()));
+	CPPUNIT_ASSERT_EQUAL(std::string("plain"), StringUtils::urldecode(std::string("plain")));
+	CPPUNIT_ASSERT_EQUAL(std::string("a b  c"), StringUtils::urldecode(std::string("a+b++c")));
+	CPPUNIT_ASSERT_EQUAL(std::string("AB"), StringUtils::urldecode(std::string("%41%42")));
+	CPPUNIT_ASSERT_EQUAL(std::string("100%"), StringUtils::urldecode(std::string("100%25")));
+	CPPUNIT_ASSERT_EQUAL(std::string("\xe2\x82\xac"), StringUtils::urldecode(std::string("%e2%82%AC")));
+	CPPUNIT_ASSERT_EQUAL(std::string("a+b"), StringUtils::urldecode(std::string("a%2Bb")));
+}
+
+void
+StringUtilsTest::testUrldecodeMalformed() {
+	/* escape without two following characters is kept as is */
+	CPPUNIT_ASSERT_EQUAL(std::string("%"), StringUtils::urldecode(std::string("%")));
+	CPPUNIT_ASSERT_EQUAL(std::string("abc%"), StringUtils::urldecode(std::string("abc%")));
+	CPPUNIT_ASSERT_EQUAL(std::string("%4"), StringUtils::urldecode(std::string("%4")));
+	CPPUNIT_ASSERT_EQUAL(std::string("abc%4"), StringUtils::urldecode(std::string("abc%4")));
+
+	/* non hex digits are not validated, the result matches previous implementation */
+	CPPUNIT_ASSERT_EQUAL(std::string("S"), StringUtils::urldecode(std::string("%zz")));
+	CPPUNIT_ASSERT_EQUAL(std::string("T1"), StringUtils::urldecode(std::string("%%41")));
+}
+
+void
+StringUtilsTest::testUrldecodeBuffer() {
+	std::string data("key+1=%D0%B0%2F");
+	CPPUNIT_ASSERT_EQUAL(std::string("key 1=\xd0\xb0/"),
+		StringUtils::urldecode(DataBuffer::create(data.data(), data.size())));
+	CPPUNIT_ASSERT_EQUAL(std::string(), StringUtils::urldecode(DataBuffer::create("", 0)));
+}
+
+void
+StringUtilsTest::testUrlencode() {
+	CPPUNIT_ASSERT_EQUAL(std::string(), StringUtils::urlencode(std::string()));
+	CPPUNIT_ASSERT_EQUAL(std::string("azAZ09-_.!~*'()"), StringUtils::urlencode(std::string("azAZ09-_.!~*'()")));
+	CPPUNIT_ASSERT_EQUAL(std::string("%20a%2Fb%3Fc%3Dd%26e%2B%25"),
+		StringUtils::urlencode(std::string(" a/b?c=d&e+%")));
+
+	/* high bit bytes are escaped as unsigned */
+	CPPUNIT_ASSERT_EQUAL(std::string("%D0%BF%80%FF%7F"), StringUtils::urlencode(std::string("\xd0\xbf\x80\xff\x7f")));
+	CPPUNIT_ASSERT_EQUAL(std::string("a%00b"), StringUtils::urlencode(std::string("a\0b", 3)));
+
+	std::string binary;
+	for (int i = 0; i < 256; ++i) {
+		binary.push_back(static_cast<char>(i));
+	}
+	CPPUNIT_ASSERT_EQUAL(binary, StringUtils::urldecode(StringUtils::urlencode(binary)));
+}
+
+} // namespace fastcgi